@@ -7,56 +7,112 @@
 #include <cmath>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
+#include <stdexcept>
 
 void saveHdrImage(cv::Mat& hdrImage, const std::string& fileName) {
   auto baseName = fileName.substr(0, fileName.find_last_of('.'));
   cv::imwrite(baseName + ".exr", hdrImage);
 }
 
-AccumulatedImage::AccumulatedImage(std::size_t w, std::size_t h)
-    : hdrImage(h, w, CV_32FC3) {
+std::string viewFileName(const std::string& fileName, std::size_t view) {
+  const auto dot = fileName.find_last_of('.');
+  const auto suffix = "_view" + std::to_string(view);
+  if (dot == std::string::npos) {
+    return fileName + suffix;
+  }
+  return fileName.substr(0, dot) + suffix + fileName.substr(dot);
+}
+
+AccumulatedImage::AccumulatedImage(std::size_t w, std::size_t h, std::size_t views)
+    : hdrImage(h, w, CV_32FC3), views(views), steps(0), stale(false) {
+  if (views == 0 || h % views != 0) {
+    throw std::invalid_argument("Image height must be a multiple of the number of views.");
+  }
   reset();
+  clearIfReset();
 }
 
 AccumulatedImage::~AccumulatedImage() {}
 
-const cv::Mat& AccumulatedImage::updateLdrImage(std::size_t step, float exposure, float gamma) {
-  cv::Mat scaledImage = hdrImage * 1.f / step;
-
-  // Allocate low dynamic range image of same dimensions:
-  cv::Mat ldrImage(scaledImage.rows, scaledImage.cols, CV_32FC3);
-  image.create(scaledImage.rows, scaledImage.cols, CV_8UC3);
+void toneMap(const cv::Mat& hdrImage, float exposure, float gamma, cv::Mat& ldrImage) {
+  // Allocate floating point image of same dimensions for the intermediate result:
+  cv::Mat mapped(hdrImage.rows, hdrImage.cols, CV_32FC3);
 
   // Simple tone-map for the HDR image:
   const float exposureScale = std::pow(2.f, exposure);
   const float invGamma = 1.f / gamma;
 
   #pragma omp parallel for schedule(auto)
-  for (auto r = 0; r < scaledImage.rows; ++r) {
-    auto inPtr = scaledImage.ptr<float>(r);
-    auto outPtr = ldrImage.ptr<float>(r);
-    for (auto i = 0; i < 3 * scaledImage.cols; ++i, ++inPtr, ++outPtr) {
+  for (auto r = 0; r < hdrImage.rows; ++r) {
+    auto inPtr = hdrImage.ptr<float>(r);
+    auto outPtr = mapped.ptr<float>(r);
+    for (auto i = 0; i < 3 * hdrImage.cols; ++i, ++inPtr, ++outPtr) {
       // Apply exposure setting and gamma correction:
       *outPtr = std::pow(*inPtr * exposureScale, invGamma);
     }
   }
 
-  ldrImage.convertTo(image, CV_8UC3, 255.0);
+  mapped.convertTo(ldrImage, CV_8UC3, 255.0);
+}
+
+const cv::Mat& AccumulatedImage::updateLdrImage(std::size_t step, float exposure, float gamma) {
+  clearIfReset();
+
+  // Release the scaled image first so that a new buffer is always allocated
+  // (results previously returned by getScaledImage() are never modified):
+  scaledImage.release();
+  scaledImage = hdrImage * 1.f / step;
+
+  if (!region.empty()) {
+    // Composite the region of interest over the full-frame image:
+    cv::Mat roi = scaledImage(region);
+    #pragma omp parallel for schedule(auto)
+    for (auto r = 0; r < roi.rows; ++r) {
+      for (auto c = 0; c < roi.cols; ++c) {
+        const auto count = regionCount.at<float>(r, c);
+        if (count > 0.f) {
+          roi.at<cv::Vec3f>(r, c) = regionSum.at<cv::Vec3f>(r, c) / count;
+        }
+      }
+    }
+  }
+
+  toneMap(scaledImage, exposure, gamma, image);
   return image;
 }
 
 void AccumulatedImage::saveImages(const std::string& fileName, std::size_t step, float exposure, float gamma) {
-  cv::imwrite(fileName, updateLdrImage(step, exposure, gamma));
+  // Tone mapping divides the image accumulated so far by the number
+  // of iterations in order that the final integrand is divided by the
+  // total sample count (and composites any region of interest):
+  const auto& ldr = updateLdrImage(step, exposure, gamma);
+  if (views == 1) {
+    cv::imwrite(fileName, ldr);
+    saveHdrImage(scaledImage, fileName);
+    return;
+  }
 
-  // The image accumulated so far must be divided by the number
-  // of iterations in order that the final integrand is divided
-  // by the total sample count:
-  cv::Mat scaledImage = hdrImage * 1.f / step;
-  saveHdrImage(scaledImage, fileName);
+  for (auto v = 0u; v < views; ++v) {
+    const auto viewName = viewFileName(fileName, v);
+    cv::Mat hdrView = scaledImage(getViewRect(v));
+    cv::imwrite(viewName, ldr(getViewRect(v)));
+    saveHdrImage(hdrView, viewName);
+  }
+}
+
+cv::Rect AccumulatedImage::getViewRect(std::size_t view) const {
+  const int viewHeight = hdrImage.rows / views;
+  return cv::Rect(0, view * viewHeight, hdrImage.cols, viewHeight);
 }
 
 /// Accumulate the trace results converting from RGB to BGR in the process:
-void AccumulatedImage::accumulate(const std::vector<TraceRecord>& traces) {
+void AccumulatedImage::accumulate(const HostBuffer<TraceRecord>& traces, const cv::Rect& tracedRegion) {
+  if (!tracedRegion.empty()) {
+    accumulateRegion(traces, tracedRegion);
+    return;
+  }
+
+  clearIfReset();
 
   #pragma omp parallel for schedule(auto)
   for (std::size_t i = 0; i < traces.size(); ++i) {
@@ -71,8 +127,60 @@ void AccumulatedImage::accumulate(const std::vector<TraceRecord>& traces) {
       hdrImage.at<cv::Vec3f>(r, c) += bgr * scale;
     }
   }
+  steps += 1;
+}
+
+void AccumulatedImage::accumulateRegion(const HostBuffer<TraceRecord>& traces, const cv::Rect& tracedRegion) {
+  if (tracedRegion != region) {
+    // Traced before the region of interest changed:
+    return;
+  }
+
+  // Each pixel can appear many times in the list so updates must be atomic:
+  #pragma omp parallel for schedule(auto)
+  for (std::size_t i = 0; i < traces.size(); ++i) {
+    auto& t = traces[i];
+    const int c = t.u - region.x;
+    const int r = t.v - region.y;
+    if (c < 0 || r < 0 || c >= region.width || r >= region.height) {
+      continue;
+    }
+    const auto scale = 1.f / t.sampleCount;
+    auto sum = regionSum.ptr<float>(r) + 3 * c;
+    auto count = regionCount.ptr<float>(r) + c;
+    #pragma omp atomic
+    sum[0] += t.b * scale;
+    #pragma omp atomic
+    sum[1] += t.g * scale;
+    #pragma omp atomic
+    sum[2] += t.r * scale;
+    #pragma omp atomic
+    *count += 1.f;
+  }
+}
+
+void AccumulatedImage::setRegion(const cv::Rect& newRegion) {
+  region = newRegion;
+  if (region.empty()) {
+    regionSum.release();
+    regionCount.release();
+  } else {
+    regionSum.create(region.height, region.width, CV_32FC3);
+    regionCount.create(region.height, region.width, CV_32FC1);
+    regionSum = cv::Vec3f(0.f, 0.f, 0.f);
+    regionCount = 0.f;
+  }
 }
 
 void AccumulatedImage::reset() {
-  hdrImage = cv::Vec3f(0.f, 0.f, 0.f);
+  steps = 0;
+  stale = true;
+  setRegion(region);
+}
+
+void AccumulatedImage::clearIfReset() {
+  if (stale) {
+    hdrImage = cv::Vec3f(0.f, 0.f, 0.f);
+    stale = false;
+  }
 }
@@ -2,6 +2,8 @@
 
 #pragma once
 
+#include "HostAllocator.hpp"
+
 #include <opencv2/imgproc.hpp>
 
 struct TraceRecord;
@@ -10,24 +12,77 @@ void saveLdrImage(cv::Mat& hdrImage, const std::string& fileName);
 
 void saveHdrImage(cv::Mat& hdrImage, const std::string& fileName);
 
+/// File name for one view of a multi-view render: the view index is
+/// inserted before the extension (e.g. "image.png" -> "image_view1.png"):
+std::string viewFileName(const std::string& fileName, std::size_t view);
+
+/// Apply exposure and gamma to a (sample count normalised) HDR image
+/// writing the 8-bit result into ldrImage:
+void toneMap(const cv::Mat& hdrImage, float exposure, float gamma, cv::Mat& ldrImage);
+
 struct AccumulatedImage {
-  AccumulatedImage(std::size_t w, std::size_t h);
+  /// The height is the height of the whole frame. Multiple views (see
+  /// --views) are stacked vertically in the frame so the height must be a
+  /// multiple of the view count.
+  AccumulatedImage(std::size_t w, std::size_t h, std::size_t views = 1);
   virtual ~AccumulatedImage();
 
-  /// Tone map the HDR image and return a reference to the result.
+  /// Tone map the HDR image and return a reference to the result. The step
+  /// is the number of full-frame passes accumulated (see getStepCount()).
+  /// If there is a region of interest it is composited over the result.
   const cv::Mat& updateLdrImage(std::size_t step, float exposure, float gamma);
 
+  /// Save the tone-mapped and HDR images. With multiple views each view
+  /// is saved to its own file (see viewFileName()):
   void saveImages(const std::string& fileName, std::size_t step, float exposure, float gamma);
 
-  /// Accumulate the trace results converting from RGB to BGR in the process:
-  void accumulate(const std::vector<TraceRecord>& traces);
+  std::size_t getViewCount() const { return views; }
+
+  /// Rows of the frame that hold a view:
+  cv::Rect getViewRect(std::size_t view) const;
+
+  /// Accumulate the trace results converting from RGB to BGR in the process.
+  /// The region is the one the results were traced for: an empty region
+  /// means the full frame. Results for a region of interest that has since
+  /// been changed are discarded.
+  void accumulate(const HostBuffer<TraceRecord>& traces, const cv::Rect& tracedRegion = cv::Rect());
 
+  /// Set the region of interest. Results traced for the region accumulate
+  /// into a separate buffer (each pixel can be traced by many records in one
+  /// step) and the full-frame image is left as it was so that an empty region
+  /// returns to full-frame rendering. Changing the region discards the
+  /// samples taken for the previous one.
+  void setRegion(const cv::Rect& newRegion);
+
+  /// Number of full-frame passes accumulated since the last reset:
+  std::size_t getStepCount() const { return steps; }
+
+  const cv::Rect& getRegion() const { return region; }
+
+  /// Discard everything accumulated so far. The image is only cleared when
+  /// it is next used so that a reset is cheap enough for the render thread
+  /// (reset the image in the thread that owns it).
   void reset();
 
   /// Return a copy of the raw HDR image:
   cv::Mat getHdrImage() const { return hdrImage; }
 
+  /// Return the HDR image normalised by the step count at the last call to
+  /// updateLdrImage(). The result shares its buffer but is never modified
+  /// afterwards so it can be handed to other threads without a copy:
+  cv::Mat getScaledImage() const { return scaledImage; }
+
 private:
+  void accumulateRegion(const HostBuffer<TraceRecord>& traces, const cv::Rect& tracedRegion);
+  void clearIfReset();
+
   cv::Mat hdrImage;
+  cv::Mat scaledImage;
+  std::size_t views;
+  std::size_t steps;
+  bool stale;  // The image must be cleared before it is next used.
+  cv::Rect region;
+  cv::Mat regionSum;    // Sum of the results for each pixel in the region.
+  cv::Mat regionCount;  // Number of results summed for each pixel in the region.
   cv::Mat image;
 };
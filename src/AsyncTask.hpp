@@ -5,7 +5,7 @@
 #include <thread>
 #include "ipu_utils.hpp"
 
-#include <pvti/pvti.hpp>
+#include "trace_utils.hpp"
 
 /// Class for launching asynchronous processing tasks
 /// in a separate thread. Tasks that are launched must
@@ -37,7 +37,7 @@ public:
       running = false;
     };
 
-    pvti::Tracepoint scoped(&asyncTraceChannel, "thread_launch");
+    trace_utils::Tracepoint scoped(&asyncTraceChannel, "thread_launch");
     job.reset(new std::thread(wrapperFunc));
   }
 
@@ -46,7 +46,7 @@ public:
   void waitForCompletion() {
     if (job != nullptr) {
       try {
-        pvti::Tracepoint scoped(&asyncTraceChannel, "thread_join");
+        trace_utils::Tracepoint scoped(&asyncTraceChannel, "thread_join");
         job->join();
         job.reset();
       } catch (std::system_error& e) {
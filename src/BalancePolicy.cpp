@@ -0,0 +1,288 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "BalancePolicy.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+namespace {
+
+void checkSizes(const WorkCosts& costs, std::size_t numTiles, std::size_t itemsPerTile) {
+  if (costs.size() != numTiles * itemsPerTile) {
+    throw std::logic_error("Number of work items must equal tiles x items per tile.");
+  }
+}
+
+/// Indices of the items sorted by cost. Ties are kept in index order so results
+/// are reproducible (as a stable sort would but without its temporary buffer):
+void sortByCost(const WorkCosts& costs, bool descending, WorkOrder& sorted) {
+  sorted.resize(costs.size());
+  std::iota(sorted.begin(), sorted.end(), 0u);
+  std::sort(sorted.begin(), sorted.end(), [&](std::uint32_t a, std::uint32_t b) {
+    if (costs[a] != costs[b]) {
+      return descending ? costs[a] > costs[b] : costs[a] < costs[b];
+    }
+    return a < b;
+  });
+}
+
+/// Empty the per-tile lists, keeping their storage for the next call:
+void clearTiles(std::vector<WorkOrder>& perTile, std::size_t numTiles, std::size_t itemsPerTile) {
+  perTile.resize(numTiles);
+  for (auto& t : perTile) {
+    t.clear();
+    t.reserve(itemsPerTile);
+  }
+}
+
+void flatten(const std::vector<WorkOrder>& perTile, WorkOrder& order) {
+  order.clear();
+  for (const auto& t : perTile) {
+    order.insert(order.end(), t.begin(), t.end());
+  }
+}
+
+} // end anonymous namespace
+
+std::vector<std::string> balancePolicyNames() {
+  return {"pairing", "lpt", "kk", "incremental"};
+}
+
+std::unique_ptr<BalancePolicy> createBalancePolicy(const std::string& name) {
+  if (name == "pairing") {
+    return std::make_unique<PairingPolicy>();
+  } else if (name == "lpt") {
+    return std::make_unique<LptPolicy>();
+  } else if (name == "kk") {
+    return std::make_unique<KarmarkarKarpPolicy>();
+  } else if (name == "incremental") {
+    return std::make_unique<IncrementalPolicy>();
+  }
+  throw std::invalid_argument("Unknown load balancing policy: '" + name + "'");
+}
+
+std::vector<std::uint64_t> tileLoads(const WorkCosts& costs, const WorkOrder& order, std::size_t itemsPerTile) {
+  std::vector<std::uint64_t> loads(order.size() / itemsPerTile, 0);
+  for (auto i = 0u; i < loads.size() * itemsPerTile; ++i) {
+    loads[i / itemsPerTile] += costs[order[i]];
+  }
+  return loads;
+}
+
+double loadImbalance(const std::vector<std::uint64_t>& loads) {
+  if (loads.empty()) {
+    return 1.0;
+  }
+  const double total = std::accumulate(loads.begin(), loads.end(), 0.0);
+  const double mean = total / loads.size();
+  return mean > 0.0 ? *std::max_element(loads.begin(), loads.end()) / mean : 1.0;
+}
+
+void PairingPolicy::assign(const WorkCosts& costs, std::size_t numTiles, std::size_t itemsPerTile, WorkOrder& order) {
+  checkSizes(costs, numTiles, itemsPerTile);
+  sortByCost(costs, false, sorted);
+  clearTiles(perTile, numTiles, itemsPerTile);
+
+  // Each tile takes the cheapest and most expensive remaining items in
+  // turn. If items per tile is odd the last item dealt is a cheap one:
+  auto shortItr = sorted.begin();
+  auto longItr = sorted.end();
+  while (shortItr != longItr) {
+    for (auto& t : perTile) {
+      if (shortItr != longItr && t.size() < itemsPerTile) {
+        t.push_back(*shortItr++);
+      }
+      if (shortItr != longItr && t.size() < itemsPerTile) {
+        t.push_back(*--longItr);
+      }
+    }
+  }
+
+  flatten(perTile, order);
+}
+
+void LptPolicy::assign(const WorkCosts& costs, std::size_t numTiles, std::size_t itemsPerTile, WorkOrder& order) {
+  checkSizes(costs, numTiles, itemsPerTile);
+  sortByCost(costs, true, sorted);
+  clearTiles(perTile, numTiles, itemsPerTile);
+
+  // Min-heap of (load, tile). Full tiles are not pushed back:
+  const auto minLoad = std::greater<std::pair<std::uint64_t, std::uint32_t>>();
+  heap.clear();
+  for (auto t = 0u; t < numTiles; ++t) {
+    heap.emplace_back(0, t);
+  }
+  std::make_heap(heap.begin(), heap.end(), minLoad);
+
+  for (auto item : sorted) {
+    std::pop_heap(heap.begin(), heap.end(), minLoad);
+    auto load = heap.back();
+    heap.pop_back();
+    perTile[load.second].push_back(item);
+    if (perTile[load.second].size() < itemsPerTile) {
+      heap.emplace_back(load.first + costs[item], load.second);
+      std::push_heap(heap.begin(), heap.end(), minLoad);
+    }
+  }
+
+  flatten(perTile, order);
+}
+
+void KarmarkarKarpPolicy::assign(const WorkCosts& costs, std::size_t numTiles, std::size_t itemsPerTile, WorkOrder& order) {
+  checkSizes(costs, numTiles, itemsPerTile);
+  if (costs.empty()) {
+    order.clear();
+    return;
+  }
+  sortByCost(costs, true, sorted);
+
+  // Subsets are linked lists threaded through 'next' so merging is O(1) per subset:
+  constexpr auto end = std::numeric_limits<std::uint32_t>::max();
+  next.assign(costs.size(), end);
+
+  // Initial partial partitions deal consecutive items (in cost order) to every tile:
+  partitions.resize(itemsPerTile);
+  for (auto p = 0u; p < itemsPerTile; ++p) {
+    partitions[p].clear();
+    partitions[p].reserve(numTiles);
+    for (auto t = 0u; t < numTiles; ++t) {
+      const auto item = sorted[p * numTiles + t];
+      partitions[p].push_back(Subset{costs[item], item, item});
+    }
+  }
+
+  auto spread = [&](std::uint32_t p) {
+    return partitions[p].front().sum - partitions[p].back().sum;
+  };
+  auto bySpread = [&](std::uint32_t a, std::uint32_t b) { return spread(a) < spread(b); };
+  heap.clear();
+  for (auto p = 0u; p < partitions.size(); ++p) {
+    heap.push_back(p);
+    std::push_heap(heap.begin(), heap.end(), bySpread);
+  }
+  auto popLargestSpread = [&]() {
+    std::pop_heap(heap.begin(), heap.end(), bySpread);
+    const auto p = heap.back();
+    heap.pop_back();
+    return p;
+  };
+
+  // Merge the two partitions with the largest spread so that they cancel out
+  // as much as possible (heaviest subset of one with the lightest of the other):
+  while (heap.size() > 1) {
+    const auto a = popLargestSpread();
+    const auto b = popLargestSpread();
+    auto& pa = partitions[a];
+    auto& pb = partitions[b];
+    for (auto t = 0u; t < numTiles; ++t) {
+      auto& sa = pa[t];
+      const auto& sb = pb[numTiles - 1 - t];
+      sa.sum += sb.sum;
+      next[sa.tail] = sb.head;
+      sa.tail = sb.tail;
+    }
+    std::sort(pa.begin(), pa.end(), [](const Subset& x, const Subset& y) { return x.sum > y.sum; });
+    pb.clear();
+    heap.push_back(a);
+    std::push_heap(heap.begin(), heap.end(), bySpread);
+  }
+
+  order.clear();
+  for (const auto& s : partitions[heap.front()]) {
+    for (auto i = s.head; i != end; i = next[i]) {
+      order.push_back(i);
+    }
+  }
+}
+
+void IncrementalPolicy::assign(const WorkCosts& costs, std::size_t numTiles, std::size_t itemsPerTile, WorkOrder& order) {
+  checkSizes(costs, numTiles, itemsPerTile);
+  order.resize(costs.size());
+  std::iota(order.begin(), order.end(), 0u);
+  if (costs.empty()) {
+    return;
+  }
+
+  loads.assign(numTiles, 0);
+  for (auto i = 0u; i < order.size(); ++i) {
+    loads[i / itemsPerTile] += costs[i];
+  }
+
+  // The nodes of the set are kept from the last call and reused so that
+  // updating the tile loads does not allocate:
+  while (!byLoad.empty()) {
+    spareNodes.push_back(byLoad.extract(byLoad.begin()));
+  }
+  auto setLoad = [&](std::uint32_t tile, std::uint64_t load) {
+    loads[tile] = load;
+    if (spareNodes.empty()) {
+      byLoad.emplace(load, tile);
+      return;
+    }
+    auto node = std::move(spareNodes.back());
+    spareNodes.pop_back();
+    node.value() = TileLoad(load, tile);
+    byLoad.insert(std::move(node));
+  };
+  for (auto t = 0u; t < numTiles; ++t) {
+    setLoad(t, loads[t]);
+  }
+
+  // Each swap moves cost from the most to the least loaded tile. The best
+  // swap exchanges items whose difference is closest to half of the gap:
+  lightItems.resize(itemsPerTile);
+  for (auto swaps = 0u; swaps < maxSwapsPerTile * numTiles; ++swaps) {
+    const auto minTile = byLoad.begin()->second;
+    const auto maxTile = byLoad.rbegin()->second;
+    const auto gap = loads[maxTile] - loads[minTile];
+    if (gap <= 1) {
+      break;
+    }
+
+    auto heavy = order.begin() + maxTile * itemsPerTile;
+    auto light = order.begin() + minTile * itemsPerTile;
+    std::iota(lightItems.begin(), lightItems.end(), 0u);
+    std::sort(lightItems.begin(), lightItems.end(), [&](std::uint32_t a, std::uint32_t b) {
+      return costs[light[a]] < costs[light[b]];
+    });
+
+    // Find the pair (h, l) with 0 < cost[h] - cost[l] < gap and the difference closest to gap / 2:
+    const double target = gap / 2.0;
+    double bestError = target;
+    std::size_t bestHeavy = 0, bestLight = 0;
+    bool found = false;
+    for (auto h = 0u; h < itemsPerTile; ++h) {
+      const double want = costs[heavy[h]] - target;
+      auto itr = std::lower_bound(lightItems.begin(), lightItems.end(), want, [&](std::uint32_t l, double v) {
+        return costs[light[l]] < v;
+      });
+      for (auto candidate : {itr, itr == lightItems.begin() ? itr : itr - 1}) {
+        if (candidate == lightItems.end()) {
+          continue;
+        }
+        const double diff = double(costs[heavy[h]]) - costs[light[*candidate]];
+        const double error = std::abs(diff - target);
+        if (diff > 0 && diff < gap && error < bestError) {
+          bestError = error;
+          bestHeavy = h;
+          bestLight = *candidate;
+          found = true;
+        }
+      }
+    }
+    if (!found) {
+      break;
+    }
+
+    const auto diff = costs[heavy[bestHeavy]] - costs[light[bestLight]];
+    spareNodes.push_back(byLoad.extract({loads[maxTile], maxTile}));
+    spareNodes.push_back(byLoad.extract({loads[minTile], minTile}));
+    setLoad(maxTile, loads[maxTile] - diff);
+    setLoad(minTile, loads[minTile] + diff);
+    std::swap(heavy[bestHeavy], light[bestLight]);
+  }
+}
@@ -0,0 +1,110 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+using WorkCosts = std::vector<std::uint32_t>;
+using WorkOrder = std::vector<std::uint32_t>;
+
+/// Interface for algorithms that decide which tile processes each work item.
+///
+/// Items are described by their predicted cost (e.g. the path length they
+/// had in the last render step) and are given in their current order, i.e.
+/// item i is currently on tile i / itemsPerTile. Every tile must be given
+/// exactly itemsPerTile items because the per-tile work buffers have a fixed
+/// size. The result is a permutation of the item indices in tile order. It
+/// is written to order, reusing its storage so that the caller can keep one
+/// buffer for every step. Policies also keep their scratch buffers between
+/// calls so an instance must only be used by one thread at a time.
+class BalancePolicy {
+public:
+  virtual ~BalancePolicy() {}
+  virtual std::string name() const = 0;
+  virtual void assign(const WorkCosts& costs, std::size_t numTiles, std::size_t itemsPerTile, WorkOrder& order) = 0;
+};
+
+/// Names accepted by createBalancePolicy():
+std::vector<std::string> balancePolicyNames();
+
+/// Throws std::invalid_argument if the name is not recognised:
+std::unique_ptr<BalancePolicy> createBalancePolicy(const std::string& name);
+
+/// Sum of the costs on each tile for a work order:
+std::vector<std::uint64_t> tileLoads(const WorkCosts& costs, const WorkOrder& order, std::size_t itemsPerTile);
+
+/// Ratio of the maximum to the mean of the tile loads (1 is perfectly balanced):
+double loadImbalance(const std::vector<std::uint64_t>& loads);
+
+/// Sort by cost then deal items to tiles in turn, taking alternately from the
+/// cheapest and the most expensive end of the list so that each tile pairs
+/// long paths with short ones.
+class PairingPolicy : public BalancePolicy {
+public:
+  std::string name() const override { return "pairing"; }
+  void assign(const WorkCosts& costs, std::size_t numTiles, std::size_t itemsPerTile, WorkOrder& order) override;
+
+private:
+  WorkOrder sorted;
+  std::vector<WorkOrder> perTile;
+};
+
+/// Longest processing time first: take items in order of decreasing cost and
+/// give each to the least loaded tile that still has space (using a min-heap
+/// of tile loads).
+class LptPolicy : public BalancePolicy {
+public:
+  std::string name() const override { return "lpt"; }
+  void assign(const WorkCosts& costs, std::size_t numTiles, std::size_t itemsPerTile, WorkOrder& order) override;
+
+private:
+  WorkOrder sorted;
+  std::vector<WorkOrder> perTile;
+  std::vector<std::pair<std::uint64_t, std::uint32_t>> heap; // (load, tile)
+};
+
+/// Balanced largest differencing (Karmarkar-Karp for partitions of equal size):
+/// items are dealt into partial partitions one item per tile, then the two partial
+/// partitions with the largest spread are repeatedly merged, pairing the heaviest
+/// tiles of one with the lightest tiles of the other.
+class KarmarkarKarpPolicy : public BalancePolicy {
+public:
+  std::string name() const override { return "kk"; }
+  void assign(const WorkCosts& costs, std::size_t numTiles, std::size_t itemsPerTile, WorkOrder& order) override;
+
+private:
+  struct Subset {
+    std::uint64_t sum;
+    std::uint32_t head;
+    std::uint32_t tail;
+  };
+  using Partition = std::vector<Subset>; // Sorted by decreasing sum.
+
+  WorkOrder sorted;
+  std::vector<std::uint32_t> next;
+  std::vector<Partition> partitions;
+  std::vector<std::uint32_t> heap;
+};
+
+/// Keep the current assignment and only swap items between the most and least
+/// loaded tiles. This is cheap when the load changes little between steps.
+class IncrementalPolicy : public BalancePolicy {
+public:
+  IncrementalPolicy(std::size_t maxSwapsPerTile = 4) : maxSwapsPerTile(maxSwapsPerTile) {}
+  std::string name() const override { return "incremental"; }
+  void assign(const WorkCosts& costs, std::size_t numTiles, std::size_t itemsPerTile, WorkOrder& order) override;
+
+private:
+  using TileLoad = std::pair<std::uint64_t, std::uint32_t>; // (load, tile)
+
+  const std::size_t maxSwapsPerTile;
+  std::vector<std::uint64_t> loads;
+  std::set<TileLoad> byLoad;
+  std::vector<std::set<TileLoad>::node_type> spareNodes;
+  std::vector<std::uint32_t> lightItems;
+};
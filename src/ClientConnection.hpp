@@ -0,0 +1,199 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include "logging.hpp"
+
+#include <PacketComms.h>
+#include <PacketSerialisation.h>
+#include <network/TcpSocket.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// A connection to one remote-ui client. Every packet is queued and handed
+/// to the client's muxer from a dedicated thread so that a slow client can
+/// never stall the encoder or any other client (and the muxer is only ever
+/// written by that thread). Video payloads are shared between all clients
+/// so data is only produced once regardless of the number of clients. If more than a fixed number of bytes is queued
+/// the client is considered to be lagging and it skips whole video frames
+/// until its queue has drained.
+class ClientConnection {
+public:
+  using Payload = std::shared_ptr<const std::vector<VectorStream::CharType>>;
+
+  ClientConnection(std::unique_ptr<TcpSocket>&& clientSocket,
+                   const std::vector<std::string>& packetTypes,
+                   std::uint32_t clientId,
+                   std::size_t maxBytesQueued)
+      : socket(std::move(clientSocket)),
+        id(clientId),
+        maxQueued(maxBytesQueued),
+        queuedBytes(0),
+        droppedFrames(0),
+        lagging(false),
+        receivingFrame(true),
+        stopping(false),
+        closing(false) {
+    socket->setBlocking(false);
+    receiver.reset(new PacketDemuxer(*socket, packetTypes));
+    sender.reset(new PacketMuxer(*socket, packetTypes));
+    writer = std::thread(&ClientConnection::writeLoop, this);
+  }
+
+  virtual ~ClientConnection() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    queueReady.notify_all();
+    writer.join();
+    // Subscriptions must be released before the demuxer:
+    subscriptions.clear();
+  }
+
+  std::uint32_t getId() const { return id; }
+  PacketDemuxer& getReceiver() { return *receiver; }
+
+  bool ok() const { return !closing && receiver->ok() && sender->ok(); }
+
+  /// Ask for the connection to be closed. The connection can not be
+  /// destroyed from its own receive thread so the owner reaps it later:
+  void requestClose() { closing = true; }
+  bool closeRequested() const { return closing; }
+
+  /// Keep a subscription alive for the lifetime of the connection:
+  void addSubscription(PacketSubscription&& s) {
+    subscriptions.push_back(std::move(s));
+  }
+
+  /// Decide whether this client will receive the next video frame. Once a
+  /// client starts lagging it skips frames until its queue is half empty:
+  void beginFrame() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (lagging) {
+      lagging = queuedBytes > maxQueued / 2;
+    } else {
+      lagging = queuedBytes > maxQueued;
+    }
+    receivingFrame = !lagging;
+    if (lagging) {
+      droppedFrames += 1;
+      ipu_utils::logger()->debug("UI client {} is lagging ({} bytes queued): dropped frame ({} in total)",
+                                 id, queuedBytes, droppedFrames);
+    }
+  }
+
+  /// Queue a packet belonging to the current video frame (unless
+  /// this client is skipping the frame):
+  void enqueueFramePacket(const std::string& type, const Payload& payload) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!receivingFrame) {
+      return;
+    }
+    pushLocked(Item{type, payload, {}});
+    lock.unlock();
+    queueReady.notify_one();
+  }
+
+  /// Queue a packet that must always be delivered (e.g. stream headers):
+  void enqueue(const std::string& type, const Payload& payload) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pushLocked(Item{type, payload, {}});
+    }
+    queueReady.notify_one();
+  }
+
+  /// Queue a small value (e.g. control or telemetry) that must always be
+  /// delivered. It is serialised by the writer thread:
+  template <class T>
+  void enqueueValue(const std::string& type, T value) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pushLocked(makeValueItem(type, std::move(value)));
+    }
+    queueReady.notify_one();
+  }
+
+  /// Queue a small value that describes the current video frame so that it
+  /// is only delivered if the client receives the frame:
+  template <class T>
+  void enqueueFrameValue(const std::string& type, T value) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!receivingFrame) {
+      return;
+    }
+    pushLocked(makeValueItem(type, std::move(value)));
+    lock.unlock();
+    queueReady.notify_one();
+  }
+
+private:
+  /// Either a shared payload or a value to serialise (only payloads count
+  /// towards the bytes queued):
+  struct Item {
+    std::string type;
+    Payload payload;
+    std::function<void(PacketMuxer&)> write;
+
+    std::size_t size() const { return payload ? payload->size() : 0; }
+  };
+
+  template <class T>
+  static Item makeValueItem(const std::string& type, T value) {
+    auto write = [type, value = std::move(value)](PacketMuxer& muxer) { serialise(muxer, type.c_str(), value); };
+    return Item{type, nullptr, std::move(write)};
+  }
+
+  void pushLocked(Item&& item) {
+    queuedBytes += item.size();
+    queue.push_back(std::move(item));
+  }
+
+  void writeLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      queueReady.wait(lock, [&]() { return stopping || !queue.empty(); });
+      if (stopping) {
+        break;
+      }
+      auto item = std::move(queue.front());
+      queue.pop_front();
+      lock.unlock();
+      if (item.write) {
+        item.write(*sender);
+      } else {
+        // The muxer only reads the data so casting away const is safe:
+        auto data = const_cast<VectorStream::CharType*>(item.payload->data());
+        sender->emplacePacket(item.type, data, item.payload->size());
+      }
+      lock.lock();
+      queuedBytes -= item.size();
+    }
+  }
+
+  std::unique_ptr<TcpSocket> socket;
+  std::unique_ptr<PacketDemuxer> receiver;
+  std::unique_ptr<PacketMuxer> sender;
+  std::vector<PacketSubscription> subscriptions;
+  const std::uint32_t id;
+  const std::size_t maxQueued;
+
+  std::mutex mutex;
+  std::condition_variable queueReady;
+  std::deque<Item> queue;
+  std::size_t queuedBytes;
+  std::size_t droppedFrames;
+  bool lagging;
+  bool receivingFrame;
+  bool stopping;
+  std::atomic<bool> closing;
+  std::thread writer;
+};
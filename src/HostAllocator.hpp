@@ -0,0 +1,146 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include "logging.hpp"
+
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+/// Allocation of the host buffers that are connected to device streams
+/// (work lists, NIF weights and NIF results). Large buffers are mapped
+/// directly and backed by 2 MB huge pages so that stream copies touch
+/// far fewer pages (and TLB entries). They can optionally be locked into
+/// physical memory and bound to the NUMA node closest to the IPUs.
+/// Small buffers come from the normal heap.
+namespace host_memory {
+
+constexpr std::size_t hugePageBytes = 2 * 1024 * 1024;
+
+// The node mask passed to mbind() is a single word:
+constexpr int maxNumaNode = 8 * sizeof(unsigned long) - 1;
+
+struct Config {
+  bool hugePages = true;  // Try to back large buffers with huge pages.
+  bool lock = false;      // Lock large buffers into physical memory.
+  int numaNode = -1;      // Bind large buffers to this NUMA node (-1 for no binding, at most maxNumaNode).
+};
+
+/// Set the configuration before any stream buffers are allocated:
+inline Config& config() {
+  static Config c;
+  return c;
+}
+
+inline std::size_t roundUpToHugePage(std::size_t bytes) {
+  return (bytes + hugePageBytes - 1) & ~(hugePageBytes - 1);
+}
+
+/// Map an anonymous region whose start is aligned to a huge page so
+/// that the kernel can back it with transparent huge pages:
+inline void* mapAligned(std::size_t size) {
+  void* raw = mmap(nullptr, size + hugePageBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) {
+    throw std::bad_alloc();
+  }
+  auto start = reinterpret_cast<std::uintptr_t>(raw);
+  auto aligned = (start + hugePageBytes - 1) & ~std::uintptr_t(hugePageBytes - 1);
+  const auto head = aligned - start;
+  if (head) {
+    munmap(raw, head);
+  }
+  munmap(reinterpret_cast<void*>(aligned + size), hugePageBytes - head);
+  return reinterpret_cast<void*>(aligned);
+}
+
+inline void* allocate(std::size_t bytes) {
+  if (bytes < hugePageBytes) {
+    return ::operator new(bytes);
+  }
+
+  const auto& c = config();
+  const auto size = roundUpToHugePage(bytes);
+  void* p = MAP_FAILED;
+  if (c.hugePages) {
+    p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p == MAP_FAILED) {
+      static std::atomic<bool> warned(false);
+      if (!warned.exchange(true)) {
+        ipu_utils::logger()->warn("Huge pages are unavailable (see /proc/sys/vm/nr_hugepages): "
+                                  "falling back to transparent huge pages for stream buffers.");
+      }
+    }
+  }
+  if (p == MAP_FAILED) {
+    p = mapAligned(size);
+    if (c.hugePages) {
+      madvise(p, size, MADV_HUGEPAGE);
+    }
+  }
+
+  // Memory policy must be set before the pages are first touched:
+  if (c.numaNode >= 0) {
+    unsigned long mask = 1ul << c.numaNode;
+    if (syscall(SYS_mbind, p, size, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0) != 0) {
+      ipu_utils::logger()->warn("Could not bind stream buffer to NUMA node {}.", c.numaNode);
+    }
+  }
+
+  if (c.lock) {
+    if (mlock(p, size) != 0) {
+      static std::atomic<bool> warned(false);
+      if (!warned.exchange(true)) {
+        ipu_utils::logger()->warn("Could not lock stream buffers into memory (check 'ulimit -l').");
+      }
+    }
+  }
+
+  return p;
+}
+
+/// Must be called with the same size that was allocated:
+inline void deallocate(void* p, std::size_t bytes) noexcept {
+  if (bytes < hugePageBytes) {
+    ::operator delete(p);
+    return;
+  }
+  // Unmapping also unlocks the pages:
+  munmap(p, roundUpToHugePage(bytes));
+}
+
+} // end namespace host_memory
+
+/// Standard allocator for buffers that are connected to device streams:
+template <class T>
+struct HostAllocator {
+  using value_type = T;
+
+  HostAllocator() noexcept {}
+  template <class U>
+  HostAllocator(const HostAllocator<U>&) noexcept {}
+
+  T* allocate(std::size_t n) {
+    return static_cast<T*>(host_memory::allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, std::size_t n) noexcept {
+    host_memory::deallocate(p, n * sizeof(T));
+  }
+};
+
+template <class T, class U>
+bool operator==(const HostAllocator<T>&, const HostAllocator<U>&) { return true; }
+
+template <class T, class U>
+bool operator!=(const HostAllocator<T>&, const HostAllocator<U>&) { return false; }
+
+template <class T>
+using HostBuffer = std::vector<T, HostAllocator<T>>;
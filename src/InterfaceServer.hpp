@@ -3,7 +3,14 @@
 #pragma once
 
 #include "ipu_utils.hpp"
+#include "AccumulatedImage.hpp"
 #include "AsyncTask.hpp"
+#include "ClientConnection.hpp"
+#include "LatencyStats.hpp"
+#include "Mailbox.hpp"
+#include "PreviewFilter.hpp"
+#include "UiSession.hpp"
+#include "ui_packets.hpp"
 
 #include <PacketComms.h>
 #include <PacketSerialisation.h>
@@ -11,205 +18,660 @@
 #include <network/TcpSocket.h>
 #include <opencv2/imgproc.hpp>
 
+#include <algorithm>
 #include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <system_error>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #include <cereal/types/string.hpp>
 #include <cereal/types/vector.hpp>
 
-namespace {
-
-const std::vector<std::string> packetTypes {
-    "stop",                // Tell server to stop rendering and exit (client -> server)
-    "detach",              // Detach the remote-ui but continue: server can destroy the
-                           // communication interface and continue (client -> server)
-    "progress",            // Send render progress (server -> client)
-    "sample_rate",         // Send throughput measurement (server -> client)
-    "env_rotation",        // Update environment light rotation (client -> server)
-    "exposure",            // Update tone-map exposure (client -> server)
-    "gamma",               // Update tone-map gamma (client -> server)
-    "fov",                 // Update field-of-view (client -> server)
-    "load_nif",            // Insruct server to load a new
-                           // NIF environemnt light (client -> server)
-    "render_preview",      // used to send compressed video packets
-                           // for render preview (server -> client)
-    "hdr_header",          // Header for sending full uncompressed HDR
-                           // image data (server -> client).
-    "hdr_packet",          // Packet containing a portion of the full uncompressed
-                           // HDR image (server -> client).
-    "interactive_samples", // New value for interactive samples per step
-};
+using namespace std::chrono_literals;
 
-// Struct and serialize function for HDR
-// image data header packet.
-struct HdrHeader {
-  std::int32_t width;  // image width
-  std::int32_t height; // image height
-  // Data will be broken into this many packets
-  // for transmission so that the comms-link is not
-  // blocking on a single giant image packet:
-  std::uint32_t packets;
+/// A TcpSocket that exposes its descriptor so that the server thread can
+/// wait for connections in poll() (see InterfaceServer::waitForClient()):
+class ListeningSocket : public TcpSocket {
+public:
+  int descriptor() const { return m_socket; }
 };
 
-template <typename T>
-void serialize(T& ar, HdrHeader& s) {
-  ar(s.width, s.height, s.packets);
-}
+class InterfaceServer {
+public:
+  using Clock = std::chrono::steady_clock;
 
+  /// Identifies a user input by sequence number and the time it was received:
+  struct InputStamp {
+    std::uint32_t id = 0;
+    Clock::time_point time;
+  };
 
-struct HdrPacket {
-  std::uint32_t id;
-  std::vector<float> data;
-};
+  /// How an input takes effect:
+  enum class InputEffect {
+    Restart,  // Restarts the render.
+    ToneMap,  // Only changes tone-mapping (done on the host).
+    Region    // Changes the region of interest between steps (no restart).
+  };
 
-template <typename T>
-void serialize(T& ar, HdrPacket& p) {
-  ar(p.id, p.data);
-}
+  enum class Status {
+    Stop,
+    Restart,
+    Continue,
+    Disconnected
+  };
 
-// Struct and serialize function to send
-// telemetry in a single packet:
-struct SampleRates {
-  float pathRate;
-  float rayRate;
-};
+  struct State {
+    float envRotationDegrees = 0.f;
+    float exposure = 0.f;
+    float gamma = 2.2f;
+    float fov = 90.f;
+    std::uint32_t interactiveSamples;
+    std::string newNif;
+    std::uint32_t nifRequests = 0;
+    bool stop = false;
+    bool detach = false;
+    cv::Rect region;         // Region of interest to render (empty for the full frame).
+    InputStamp renderInput;  // Last input that requires a render restart.
+    InputStamp toneInput;    // Last input that only changes tone-mapping.
+    InputStamp regionInput;  // Last input that changed the region of interest.
+  };
 
-template <typename T>
-void serialize(T& ar, SampleRates& s) {
-  ar(s.pathRate, s.rayRate);
-}
+private:
+  struct PreviewFrame {
+    cv::Mat image;
+    Clock::time_point submitted;
+    InputStamp renderInput;
+    InputStamp toneInput;
+    InputStamp regionInput;
+  };
 
-}  // end anonymous namespace
+  /// Apply a modification to the UI state and atomically publish a new
+  /// snapshot of it. Writers are serialised (each client has its own
+  /// receive thread) and readers never see a partially updated state.
+  void publishState(const std::function<void(State&)>& modify, InputEffect effect) {
+    std::lock_guard<std::mutex> lock(stateWriteMutex);
+    State next = *std::atomic_load(&snapshot);
+    modify(next);
+    auto& stamp = effect == InputEffect::Restart ? next.renderInput
+                : effect == InputEffect::ToneMap ? next.toneInput
+                : next.regionInput;
+    stamp.id += 1;
+    stamp.time = Clock::now();
+    std::atomic_store(&snapshot, std::make_shared<const State>(std::move(next)));
+    if (effect == InputEffect::Restart) {
+      stateUpdated = true;
+    }
+  }
 
-using namespace std::chrono_literals;
+  /// Subscribe a client to a packet that modifies the UI state. Only
+  /// the client that currently holds control can modify the state:
+  void subscribeControl(ClientConnection& client, const std::string& type, InputEffect effect,
+                        const std::function<void(const ComPacket::ConstSharedPacket&, State&)>& apply) {
+    const auto id = client.getId();
+    client.addSubscription(client.getReceiver().subscribe(type,
+      [this, id, type, effect, apply](const ComPacket::ConstSharedPacket& packet) {
+        if (id != controllerId) {
+          ipu_utils::logger()->debug("Ignored '{}' from UI client {}: it does not have control.", type, id);
+          return;
+        }
+        publishState([&](State& state) {
+          apply(packet, state);
+          if (sessionRecorder) {
+            sessionRecorder->record(type, describeInput(type, state));
+          }
+        }, effect);
+        if (effect == InputEffect::ToneMap) {
+          // Tone-only changes are shown without waiting for the next render step:
+          toneRequests.post(true);
+        }
+      }));
+  }
+
+  /// Format the value of an input (after it was applied to the state) in
+  /// the form that a client would send it (see UiSession.hpp):
+  static std::string describeInput(const std::string& type, const State& state) {
+    if (type == "env_rotation") {
+      return fmt::format("{}", state.envRotationDegrees);
+    } else if (type == "exposure") {
+      return fmt::format("{}", state.exposure);
+    } else if (type == "gamma") {
+      return fmt::format("{}", state.gamma);
+    } else if (type == "fov") {
+      return fmt::format("{}", state.fov * (180.f / M_PI));
+    } else if (type == "load_nif") {
+      return state.newNif;
+    } else if (type == "interactive_samples") {
+      return fmt::format("{}", state.interactiveSamples);
+    } else if (type == "stop") {
+      return state.stop ? "1" : "0";
+    } else if (type == "roi") {
+      const auto& r = state.region;
+      return fmt::format("{} {} {} {}", r.x, r.y, r.width, r.height);
+    }
+    return "";
+  }
+
+  void addClient(std::unique_ptr<TcpSocket>&& socket) {
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    if (clients.size() >= maxClients) {
+      ipu_utils::logger()->warn("Rejected UI client: maximum number of clients ({}) already connected.", maxClients);
+      return;
+    }
+
+    const auto id = nextClientId++;
+    clients.emplace_back(new ClientConnection(std::move(socket), packetTypes, id, maxClientQueueBytes));
+    auto& client = *clients.back();
+    if (clients.size() == 1) {
+      controllerId = id;
+    }
+    ipu_utils::logger()->info("User interface client {} connected ({} connected, client {} has control).",
+                              id, clients.size(), controllerId.load());
+
+    subscribeControl(client, "env_rotation", InputEffect::Restart, [](const ComPacket::ConstSharedPacket& packet, State& state) {
+      deserialise(packet, state.envRotationDegrees);
+      ipu_utils::logger()->trace("Env rotation new value: {}", state.envRotationDegrees);
+    });
+
+    subscribeControl(client, "stop", InputEffect::Restart, [](const ComPacket::ConstSharedPacket& packet, State& state) {
+      deserialise(packet, state.stop);
+      ipu_utils::logger()->trace("Render stopped by remote UI.");
+    });
+
+    // NOTE: Tone mapping is not done on IPU so for exposure and gamma changes we
+    // don't mark state as updated to avoid causing an unecessary render re-start.
+    subscribeControl(client, "exposure", InputEffect::ToneMap, [](const ComPacket::ConstSharedPacket& packet, State& state) {
+      deserialise(packet, state.exposure);
+      ipu_utils::logger()->trace("Exposure new value: {}", state.exposure);
+    });
+
+    subscribeControl(client, "gamma", InputEffect::ToneMap, [](const ComPacket::ConstSharedPacket& packet, State& state) {
+      deserialise(packet, state.gamma);
+      ipu_utils::logger()->trace("Gamma new value: {}", state.gamma);
+    });
+
+    subscribeControl(client, "fov", InputEffect::Restart, [](const ComPacket::ConstSharedPacket& packet, State& state) {
+      deserialise(packet, state.fov);
+      // To radians:
+      state.fov = state.fov * (M_PI / 180.f);
+      ipu_utils::logger()->trace("FOV new value: {}", state.fov);
+    });
+
+    subscribeControl(client, "load_nif", InputEffect::Restart, [](const ComPacket::ConstSharedPacket& packet, State& state) {
+      deserialise(packet, state.newNif);
+      state.nifRequests += 1;
+      ipu_utils::logger()->trace("Received new NIF path: {}", state.newNif);
+    });
+
+    subscribeControl(client, "interactive_samples", InputEffect::Restart, [](const ComPacket::ConstSharedPacket& packet, State& state) {
+      deserialise(packet, state.interactiveSamples);
+      ipu_utils::logger()->trace("Interactive samples new value: {}", state.interactiveSamples);
+    });
+
+    // The region of interest is applied between steps so it does not restart
+    // the render. An empty rectangle returns to full-frame rendering:
+    subscribeControl(client, "roi", InputEffect::Region, [](const ComPacket::ConstSharedPacket& packet, State& state) {
+      PreviewRegion r;
+      deserialise(packet, r);
+      state.region = r.width > 0 && r.height > 0 ? cv::Rect(r.x, r.y, r.width, r.height) : cv::Rect();
+      ipu_utils::logger()->trace("Region of interest new value: {} {} {} {}", r.x, r.y, r.width, r.height);
+    });
+
+    // Detach is handled per client: a viewer detaching just closes its own
+    // connection. The whole UI only detaches when the last client leaves.
+    // The connection can't be destroyed from its own receive thread so it
+    // is removed by the server thread:
+    auto clientPtr = &client;
+    client.addSubscription(client.getReceiver().subscribe("detach",
+      [this, clientPtr](const ComPacket::ConstSharedPacket& packet) {
+        bool detach = false;
+        deserialise(packet, detach);
+        if (detach) {
+          clientPtr->requestClose();
+          wakeServer();
+        }
+      }));
+
+    // Any client can inspect raw HDR values. Only the requested region of the
+    // latest film is copied and the reply only goes to the client that asked:
+    client.addSubscription(client.getReceiver().subscribe("hdr_region_request",
+      [this, clientPtr](const ComPacket::ConstSharedPacket& packet) {
+        HdrRegionRequest request;
+        deserialise(packet, request);
+        clientPtr->enqueueValue("hdr_region", getHdrRegion(request));
+      }));
+
+    client.enqueueValue("control", client.getId() == controllerId);
+
+    // Late joiners need the stream header before they can decode any frames.
+    // They will start decoding properly at the next key frame:
+    for (const auto& p : streamHeader) {
+      client.enqueue("render_preview", p);
+    }
+    if (streamStarted) {
+      // The replayed first frame shows no input of this client:
+      client.enqueueValue("preview_frame", PreviewFrameInfo{0, false});
+    }
+  }
+
+  /// Copy the requested rectangle out of the latest film snapshot (the
+  /// snapshot shares its buffer so the whole image is never copied):
+  HdrRegion getHdrRegion(const HdrRegionRequest& request) {
+    cv::Mat hdr;
+    {
+      std::lock_guard<std::mutex> lock(filmMutex);
+      hdr = film;
+    }
+
+    HdrRegion reply{request.id, 0, 0, 0, 0, {}};
+    const auto r = cv::Rect(request.x, request.y, request.width, request.height) & cv::Rect(0, 0, hdr.cols, hdr.rows);
+    if (r.empty()) {
+      ipu_utils::logger()->debug("HDR region request {} is empty or outside the image.", request.id);
+      return reply;
+    }
+    if (std::size_t(r.area()) > maxHdrRegionPixels) {
+      ipu_utils::logger()->warn("HDR region request {} is too large: {} pixels (max {}).",
+                                request.id, r.area(), maxHdrRegionPixels);
+      return reply;
+    }
+
+    reply.x = r.x;
+    reply.y = r.y;
+    reply.width = r.width;
+    reply.height = r.height;
+    reply.data.reserve(3 * r.area());
+    for (auto row = r.y; row < r.y + r.height; ++row) {
+      // The film is BGR but the client expects RGB:
+      auto bgr = hdr.ptr<float>(row) + 3 * r.x;
+      for (auto c = 0; c < r.width; ++c, bgr += 3) {
+        reply.data.insert(reply.data.end(), {bgr[2], bgr[1], bgr[0]});
+      }
+    }
+    return reply;
+  }
+
+  /// Destroy connections that dropped or detached. If the controlling
+  /// client went away control passes to the longest connected client:
+  void removeDisconnectedClients() {
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    auto itr = std::remove_if(clients.begin(), clients.end(), [](const auto& c) { return !c->ok(); });
+    if (itr == clients.end()) {
+      return;
+    }
+    bool detached = false;
+    for (auto c = itr; c != clients.end(); ++c) {
+      ipu_utils::logger()->info("User interface client {} {}.", (*c)->getId(),
+                                (*c)->closeRequested() ? "detached" : "disconnected");
+      detached |= (*c)->closeRequested();
+    }
+    clients.erase(itr, clients.end());
+
+    if (clients.empty() && detached) {
+      publishState([&](State& state) {
+        state.detach = true;
+        ipu_utils::logger()->trace("Remote UI detached.");
+      }, InputEffect::Restart);
+      return;
+    }
+
+    auto hasControl = [&](const auto& c) { return c->getId() == controllerId; };
+    if (!clients.empty() && std::none_of(clients.begin(), clients.end(), hasControl)) {
+      controllerId = clients.front()->getId();
+      ipu_utils::logger()->info("Control passed to user interface client {}.", controllerId.load());
+      clients.front()->enqueueValue("control", true);
+    }
+  }
+
+  /// Queue a small packet for every connected client:
+  template <class T>
+  void broadcast(const char* type, const T& value) {
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    for (auto& c : clients) {
+      c->enqueueValue(type, value);
+    }
+  }
+
+  /// Queue a packet only for the client that has control.
+  /// Returns false if there was no such client:
+  template <class T>
+  bool sendToController(const char* type, const T& value) {
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    for (auto& c : clients) {
+      if (c->getId() == controllerId) {
+        c->enqueueValue(type, value);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// Wake the server thread so that it reaps clients that went away (or
+  /// notices that it has been stopped, see waitForClient()):
+  void wakeServer() {
+    const std::uint64_t one = 1;
+    auto written = write(wakeFd, &one, sizeof(one));
+    (void)written;  // Can only fail if the counter is saturated, which still wakes the server.
+  }
+
+  /// Block until a client connects (returns its socket) or the server is
+  /// stopped (returns nullptr). The server thread waits in poll() on the
+  /// listening socket and an eventfd (see wakeServer()) so new clients,
+  /// departing clients and shutdown are all handled immediately:
+  std::unique_ptr<TcpSocket> waitForClient(int listenFd) {
+    pollfd fds[2] = {{listenFd, POLLIN, 0}, {wakeFd, POLLIN, 0}};
+    while (!stopServer) {
+      if (poll(fds, 2, -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        ipu_utils::logger()->error("User interface server could not wait for clients: {}", std::strerror(errno));
+        break;
+      }
+      if (fds[1].revents & POLLIN) {
+        std::uint64_t count;
+        auto drained = read(wakeFd, &count, sizeof(count));
+        (void)drained;
+        removeDisconnectedClients();
+      }
+      if ((fds[0].revents & POLLIN) && !stopServer) {
+        // The listening socket is non-blocking so a connection that went
+        // away before it was accepted can not stall this thread:
+        auto socket = serverSocket.Accept();
+        if (socket) {
+          return socket;
+        }
+      }
+    }
+    return nullptr;
+  }
 
-class InterfaceServer {
   void communicate() {
-    ipu_utils::logger()->info("User interface server listening on port {}", port);
-    serverSocket.Bind(port);
-    serverSocket.Listen(0);
-    connection = serverSocket.Accept();
-    if (connection) {
-      ipu_utils::logger()->info("User interface client connected.");
-      connection->setBlocking(false);
-      PacketDemuxer receiver(*connection, packetTypes);
-      sender.reset(new PacketMuxer(*connection, packetTypes));
-
-      // Lambda that enqueues video packets via the Muxing system:
-      FFMpegStdFunctionIO videoIO(FFMpegCustomIO::WriteBuffer, [&](uint8_t* buffer, int size) {
-        if (sender) {
-          ipu_utils::logger()->debug("Sending compressed video packet of size: {}", size);
-          sender->emplacePacket("render_preview", reinterpret_cast<VectorStream::CharType*>(buffer), size);
-          return sender->ok() ? size : -1;
+    ipu_utils::logger()->info("User interface server listening on port {} (max clients: {})", port, maxClients);
+    if (!serverSocket.Bind(port) || !serverSocket.Listen(maxClients)) {
+      ipu_utils::logger()->error("User interface server could not listen on port {}: {}", port, std::strerror(errno));
+      signalEvent([&]() { serverExited = true; });
+      return;
+    }
+    serverSocket.setBlocking(false);
+    const int listenFd = serverSocket.descriptor();
+
+    // Lambda that fans video packets out to all clients. Each packet is only
+    // copied once and the copy is shared by every client's send queue:
+    FFMpegStdFunctionIO videoIO(FFMpegCustomIO::WriteBuffer, [&](uint8_t* buffer, int size) {
+      ipu_utils::logger()->debug("Sending compressed video packet of size: {}", size);
+      auto data = reinterpret_cast<VectorStream::CharType*>(buffer);
+      auto payload = std::make_shared<const std::vector<VectorStream::CharType>>(data, data + size);
+      std::lock_guard<std::mutex> lock(clientsMutex);
+      if (!streamStarted) {
+        // Stream header and first frame packets are cached for late joiners:
+        streamHeader.push_back(payload);
+        for (auto& c : clients) {
+          c->enqueue("render_preview", payload);
         }
-        return -1;
-      });
-      videoStream.reset(new LibAvWriter(videoIO));
+      } else {
+        for (auto& c : clients) {
+          c->enqueueFramePacket("render_preview", payload);
+        }
+      }
+      return size;
+    });
 
-      auto subs1 = receiver.subscribe("env_rotation",
-                                      [&](const ComPacket::ConstSharedPacket& packet) {
-                                        deserialise(packet, state.envRotationDegrees);
-                                        ipu_utils::logger()->trace("Env rotation new value: {}", state.envRotationDegrees);
-                                        stateUpdated = true;
-                                      });
-
-      auto subs2 = receiver.subscribe("detach",
-                                      [&](const ComPacket::ConstSharedPacket& packet) {
-                                        deserialise(packet, state.detach);
-                                        ipu_utils::logger()->trace("Remote UI detached.");
-                                        stateUpdated = true;
-                                      });
-
-      auto subs3 = receiver.subscribe("stop",
-                                      [&](const ComPacket::ConstSharedPacket& packet) {
-                                        deserialise(packet, state.stop);
-                                        ipu_utils::logger()->trace("Render stopped by remote UI.");
-                                        stateUpdated = true;
-                                      });
-
-      // NOTE: Tone mapping is not done on IPU so for exposure and gamma changes we
-      // don't mark state as updated to avoid causing an unecessary render re-start.
-      auto subs4 = receiver.subscribe("exposure",
-                                      [&](const ComPacket::ConstSharedPacket& packet) {
-                                        deserialise(packet, state.exposure);
-                                        ipu_utils::logger()->trace("Exposure new value: {}", state.exposure);
-                                      });
-
-      auto subs5 = receiver.subscribe("gamma",
-                                      [&](const ComPacket::ConstSharedPacket& packet) {
-                                        deserialise(packet, state.gamma);
-                                        ipu_utils::logger()->trace("Gamma new value: {}", state.gamma);
-                                      });
-
-      auto subs6 = receiver.subscribe("fov",
-                                      [&](const ComPacket::ConstSharedPacket& packet) {
-                                        deserialise(packet, state.fov);
-                                        // To radians:
-                                        state.fov = state.fov * (M_PI / 180.f);
-                                        ipu_utils::logger()->trace("FOV new value: {}", state.fov);
-                                        stateUpdated = true;
-                                      });
-
-      auto subs7 = receiver.subscribe("load_nif",
-                                      [&](const ComPacket::ConstSharedPacket& packet) {
-                                        deserialise(packet, state.newNif);
-                                        ipu_utils::logger()->trace("Received new NIF path: {}", state.newNif);
-                                        stateUpdated = true;
-                                      });
-
-      auto subs8 = receiver.subscribe("interactive_samples",
-                                      [&](const ComPacket::ConstSharedPacket& packet) {
-                                        deserialise(packet, state.interactiveSamples);
-                                        ipu_utils::logger()->trace("Interactive samples new value: {}", state.interactiveSamples);
-                                        stateUpdated = true;
-                                      });
+    auto first = waitForClient(listenFd);
+    if (first) {
+      videoStream.reset(new LibAvWriter(videoIO));
+      addClient(std::move(first));
 
       ipu_utils::logger()->info("User interface server entering Tx/Rx loop.");
-      serverReady = true;
-      while (!stopServer && receiver.ok()) {
-        std::this_thread::sleep_for(5ms);
+      signalEvent([&]() { serverReady = true; });
+
+      // Packets are handled by each client's own threads so this thread
+      // only accepts new clients and reaps ones that went away:
+      while (auto socket = waitForClient(listenFd)) {
+        addClient(std::move(socket));
       }
     }
+
+    // The video IO object is about to go out of scope:
+    videoStream.reset();
+    {
+      std::lock_guard<std::mutex> lock(clientsMutex);
+      clients.clear();
+    }
+    signalEvent([&]() { serverExited = true; });
     ipu_utils::logger()->info("User interface server Tx/Rx loop exited.");
   }
 
-  /// Wait until server has initialised everything and enters its main loop:
-  void waitForServerReady() {
-    while (!serverReady) {
-      std::this_thread::sleep_for(5ms);
+  /// Modify event state under the lock then wake all waiting threads:
+  void signalEvent(const std::function<void()>& f) {
+    {
+      std::lock_guard<std::mutex> lock(eventMutex);
+      f();
     }
+    events.notify_all();
   }
 
-public:
-  enum class Status {
-    Stop,
-    Restart,
-    Continue,
-    Disconnected
-  };
+  /// Video encoding runs in its own thread so that slow encoding can never
+  /// delay the render loop. Frames arrive via a single slot mailbox so that
+  /// if the encoder falls behind frames are dropped rather than queued:
+  void encodeVideo() {
+    ipu_utils::logger()->debug("Video encoder thread started.");
+    PreviewFrame frame;
+    while (previewFrames.wait(frame)) {
+      auto encodeStart = Clock::now();
+      if (!filterPreview(frame)) {
+        continue;
+      }
+      bool sent = encodePreviewImage(frame.image, PreviewFrameInfo{framesSent, reflectsNewInput(frame)});
+      auto encodeEnd = Clock::now();
+      encodeMs = std::chrono::duration<float, std::milli>(encodeEnd - encodeStart).count();
+      encodeLatencyMs = std::chrono::duration<float, std::milli>(encodeEnd - frame.submitted).count();
+      framesEncoded += 1;
+      if (sent) {
+        framesSent += 1;
+        recordInteractionLatency(frame, encodeEnd);
+      }
+    }
+    ipu_utils::logger()->debug("Video encoder thread exited.");
+  }
 
-  struct State {
-    float envRotationDegrees = 0.f;
-    float exposure = 0.f;
-    float gamma = 2.2f;
-    float fov = 90.f;
-    std::uint32_t interactiveSamples;
-    std::string newNif;
-    bool stop = false;
-    bool detach = false;
-  };
+  /// Fast path for tone-mapping changes: re-tone-map the latest film
+  /// snapshot and submit it straight to the encoder so that exposure and
+  /// gamma changes do not have to wait for an IPU step to complete.
+  /// Requests arrive via a single slot mailbox so a burst of slider
+  /// changes is coalesced and only the latest values are applied:
+  void retoneFilm() {
+    ipu_utils::logger()->debug("Tone-mapping thread started.");
+    bool request;
+    while (toneRequests.wait(request)) {
+      cv::Mat hdr;
+      InputStamp renderInput;
+      InputStamp regionInput;
+      {
+        std::lock_guard<std::mutex> lock(filmMutex);
+        hdr = film;
+        renderInput = filmRenderInput;
+        regionInput = filmRegionInput;
+      }
+      if (hdr.empty()) {
+        continue;  // Nothing has been rendered yet.
+      }
+      const auto state = getState();
+      PreviewFrame frame{cv::Mat(), Clock::now(), renderInput, state.toneInput, regionInput};
+      toneMap(hdr, state.exposure, state.gamma, frame.image);
+      framesRetoned += 1;
+      ipu_utils::logger()->trace("Re-tone-mapped preview: exposure {} gamma {}", state.exposure, state.gamma);
+      if (previewFrames.post(std::move(frame))) {
+        framesDropped += 1;
+      }
+    }
+    ipu_utils::logger()->debug("Tone-mapping thread exited.");
+  }
+
+  /// True if no preview that reflects one of the frame's inputs has been sent yet:
+  bool reflectsNewInput(const PreviewFrame& frame) const {
+    return frame.renderInput.id > lastRenderInputMeasured ||
+           frame.toneInput.id > lastToneInputMeasured ||
+           frame.regionInput.id > lastRegionInputMeasured;
+  }
+
+  /// If this is the first preview sent that reflects a new user input
+  /// then record the time it took and report the latency percentiles:
+  void recordInteractionLatency(const PreviewFrame& frame, Clock::time_point sentTime) {
+    bool updated = false;
+    auto record = [&](const InputStamp& stamp, std::uint32_t& lastMeasured) {
+      if (stamp.id > lastMeasured) {
+        lastMeasured = stamp.id;
+        interactionLatency.add(std::chrono::duration<float, std::milli>(sentTime - stamp.time).count());
+        updated = true;
+      }
+    };
+    record(frame.renderInput, lastRenderInputMeasured);
+    record(frame.toneInput, lastToneInputMeasured);
+    record(frame.regionInput, lastRegionInputMeasured);
+
+    if (updated) {
+      LatencyReport report{
+          interactionLatency.percentile(50.f),
+          interactionLatency.percentile(90.f),
+          interactionLatency.percentile(99.f),
+          interactionLatency.max(),
+          static_cast<std::uint32_t>(interactionLatency.total())};
+      ipu_utils::logger()->debug("Interaction latency p50: {} ms p90: {} ms p99: {} ms max: {} ms",
+                                 report.p50, report.p90, report.p99, report.max);
+      broadcast("interaction_latency", report);
+    }
+  }
+
+  /// Returns false if the preview filter (if enabled) drops the frame. Frames
+  /// that show a new user input are always sent so interactive feedback never
+  /// waits for the filter, and a restart resets the filter so that the first
+  /// frame of the new render is compared against nothing stale:
+  bool filterPreview(const PreviewFrame& frame) {
+    if (!previewFilter) {
+      return true;
+    }
+    if (frame.renderInput.id != lastFilteredRenderInput) {
+      previewFilter->reset();
+    }
+    const bool newInput = frame.renderInput.id != lastFilteredRenderInput ||
+                          frame.toneInput.id != lastFilteredToneInput ||
+                          frame.regionInput.id != lastFilteredRegionInput;
+    lastFilteredRenderInput = frame.renderInput.id;
+    lastFilteredToneInput = frame.toneInput.id;
+    lastFilteredRegionInput = frame.regionInput.id;
+
+    auto result = previewFilter->update(frame.image, newInput);
+    if (!result.send) {
+      return false;
+    }
+    broadcast("preview_roi", PreviewRegion{result.dirty.x, result.dirty.y, result.dirty.width, result.dirty.height});
+    ipu_utils::logger()->debug("Preview changed fraction: {} (sent: {} dropped: {})",
+                               result.changedFraction, previewFilter->getSentCount(), previewFilter->getDroppedCount());
+    return true;
+  }
+
+  /// Returns true if the frame was sent to the video stream. The frame's
+  /// info is queued for each client that receives the frame right after
+  /// its video packets:
+  bool encodePreviewImage(const cv::Mat& ldrImage, const PreviewFrameInfo& info) {
+    // Decide which clients receive this frame before any of its packets are
+    // written. Connections that dropped are reaped by the server thread:
+    {
+      std::lock_guard<std::mutex> lock(clientsMutex);
+      bool disconnected = false;
+      for (auto& c : clients) {
+        c->beginFrame();
+        disconnected |= !c->ok();
+      }
+      if (disconnected) {
+        wakeServer();
+      }
+    }
+
+    VideoFrame frame(ldrImage.data, AV_PIX_FMT_BGR24, ldrImage.cols, ldrImage.rows, ldrImage.step);
+    bool ok = videoStream->PutVideoFrame(frame);
+    {
+      std::lock_guard<std::mutex> lock(clientsMutex);
+      if (ok) {
+        for (auto& c : clients) {
+          if (streamStarted) {
+            c->enqueueFrameValue("preview_frame", info);
+          } else {
+            c->enqueueValue("preview_frame", info);
+          }
+        }
+      }
+      // Everything written up to the end of the first frame is replayed to late joiners:
+      streamStarted = true;
+    }
+    if (!ok) {
+      ipu_utils::logger()->warn("Could not send video frame.");
+    }
+    return ok;
+  }
+
+  void startEncoder() {
+    previewFrames.open();
+    toneRequests.open();
+    encoderThread.reset(new std::thread(&InterfaceServer::encodeVideo, this));
+    toneThread.reset(new std::thread(&InterfaceServer::retoneFilm, this));
+  }
+
+  void stopEncoder() {
+    toneRequests.close();
+    if (toneThread != nullptr) {
+      try {
+        toneThread->join();
+        toneThread.reset();
+        ipu_utils::logger()->trace("Tone-mapping thread joined successfuly");
+      } catch (std::system_error& e) {
+        ipu_utils::logger()->error("Tone-mapping thread could not be joined.");
+      }
+    }
+    previewFrames.close();
+    if (encoderThread != nullptr) {
+      try {
+        encoderThread->join();
+        encoderThread.reset();
+        ipu_utils::logger()->trace("Encoder thread joined successfuly");
+      } catch (std::system_error& e) {
+        ipu_utils::logger()->error("Video encoder thread could not be joined.");
+      }
+    }
+  }
+
+  /// Wait until server has initialised everything and enters its main
+  /// loop (or until the server thread exits if no client connected):
+  bool waitForServerReady() {
+    std::unique_lock<std::mutex> lock(eventMutex);
+    events.wait(lock, [&]() { return serverReady || serverExited; });
+    return serverReady;
+  }
 
-  /// Return a copy of the state and mark it as consumed:
+public:
+  /// Return a copy of the latest state and mark it as consumed. A NIF
+  /// load request is only returned by the first call that sees it:
   State consumeState() {
-    State tmp = state;
-    stateUpdated = false;  // Clear the update flag.
-    state.newNif.clear();  // Clear model load request.
+    stateUpdated = false;  // Clear the update flag before taking the snapshot.
+    State tmp = *std::atomic_load(&snapshot);
+    if (tmp.nifRequests == consumedNifRequests) {
+      tmp.newNif.clear();
+    }
+    consumedNifRequests = tmp.nifRequests;
     return tmp;
   }
 
-  const State& getState() const {
-    return state;
+  /// Return a consistent copy of the latest state (safe to call from any thread):
+  State getState() const {
+    return *std::atomic_load(&snapshot);
   }
 
   /// Has the state changed since it was last consumed?:
@@ -217,40 +679,76 @@ public:
     return stateUpdated;
   }
 
-  InterfaceServer(int portNumber)
+  /// Up to maxClientCount clients can connect. The first client to connect
+  /// has control and the rest can only view (control is passed on if the
+  /// controlling client leaves). Each client can have up to maxQueueBytes
+  /// of video queued before it starts skipping frames.
+  InterfaceServer(int portNumber, std::size_t maxClientCount = 1,
+                  std::size_t maxQueueBytes = 8 * 1024 * 1024)
       : port(portNumber),
+        maxClients(std::max<std::size_t>(1, maxClientCount)),
+        maxClientQueueBytes(maxQueueBytes),
         stopServer(false),
+        wakeFd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
         serverReady(false),
-        stateUpdated(false) {}
+        serverExited(false),
+        stateUpdated(false),
+        snapshot(std::make_shared<const State>()),
+        consumedNifRequests(0),
+        nextClientId(0),
+        controllerId(0),
+        streamStarted(false),
+        encodeLatencyMs(0.f),
+        encodeMs(0.f),
+        framesEncoded(0),
+        framesDropped(0),
+        framesSent(0),
+        framesRetoned(0),
+        lastRenderInputMeasured(0),
+        lastToneInputMeasured(0),
+        lastRegionInputMeasured(0),
+        lastFilteredRenderInput(0),
+        lastFilteredToneInput(0),
+        lastFilteredRegionInput(0) {
+    if (wakeFd < 0) {
+      throw std::system_error(errno, std::generic_category(), "Could not create user interface server wake event");
+    }
+  }
 
   /// Launches the UI thread and blocks until a connection is
   /// made and all server state is initialised. Note that some
   /// server state can not be initialised until after the client
-  /// has connected.
+  /// has connected. Only returns without a client if stop() is
+  /// called from another thread (or the server fails to listen).
   void start() {
     stopServer = false;
     serverReady = false;
+    serverExited = false;
     stateUpdated = false;
     thread.reset(new std::thread(&InterfaceServer::communicate, this));
-    waitForServerReady();
+    if (!waitForServerReady()) {
+      ipu_utils::logger()->warn("User interface server exited before a client connected.");
+    }
   }
 
   void initialiseVideoStream(std::size_t width, std::size_t height) {
     if (videoStream) {
       videoStream->AddVideoStream(width, height, 30, video::FourCc('F', 'M', 'P', '4'));
+      startEncoder();
     } else {
       ipu_utils::logger()->warn("No object to add video stream to.");
     }
   }
 
   void stop() {
-    stopServer = true;
+    stopEncoder();
+    signalEvent([&]() { stopServer = true; });
+    wakeServer();
     if (thread != nullptr) {
       try {
         thread->join();
         thread.reset();
         ipu_utils::logger()->trace("Server thread joined successfuly");
-        sender.reset();
       } catch (std::system_error& e) {
         ipu_utils::logger()->error("User interface server thread could not be joined.");
       }
@@ -258,23 +756,67 @@ public:
   }
 
   void updateProgress(int step, int totalSteps) {
-    if (sender) {
-      serialise(*sender, "progress", step / (float)totalSteps);
-    }
+    broadcast("progress", step / (float)totalSteps);
   }
 
   void updateSampleRate(float pathRate, float rayRate) {
-    if (sender) {
-      serialise(*sender, "sample_rate", SampleRates{pathRate, rayRate});
-    }
+    broadcast("sample_rate", SampleRates{pathRate, rayRate});
   }
 
-  void sendPreviewImage(const cv::Mat& ldrImage) {
-    VideoFrame frame(ldrImage.data, AV_PIX_FMT_BGR24, ldrImage.cols, ldrImage.rows, ldrImage.step);
-    bool ok = videoStream->PutVideoFrame(frame);
-    if (!ok) {
-      ipu_utils::logger()->warn("Could not send video frame.");
+  void updateEncoderStats() {
+    EncoderStats stats{encodeLatencyMs, encodeMs, framesEncoded, framesDropped};
+    ipu_utils::logger()->debug("Video encoder latency: {} ms encode time: {} ms frames encoded: {} dropped: {} re-tone-mapped: {}",
+                               stats.latencyMs, stats.encodeMs, stats.encoded, stats.dropped, framesRetoned.load());
+    broadcast("encoder_stats", stats);
+  }
+
+  /// Record every input accepted from the controlling client to a session
+  /// file that can be replayed with src/tools/ui_replay (call before start()):
+  void recordSession(const std::string& fileName) {
+    sessionRecorder.reset(new UiSessionRecorder(fileName));
+    ipu_utils::logger()->info("Recording remote UI session to '{}'", fileName);
+  }
+
+  /// Enable dropping of preview frames that have changed by less than
+  /// the given fraction since the last frame that was sent. At most
+  /// maxSkippedFrames consecutive frames will be dropped.
+  void enablePreviewFilter(float minChangeFraction, std::uint32_t maxSkippedFrames) {
+    previewFilter.reset(new PreviewFilter(minChangeFraction, maxSkippedFrames));
+  }
+
+  /// Submit a new preview frame to the video encoder thread. The image is
+  /// copied so the caller is free to modify it as soon as this returns.
+  /// If the encoder has not yet consumed the previous frame it is dropped.
+  /// The input stamps identify the latest user inputs that the frame
+  /// reflects so that input-to-preview latency can be measured.
+  void sendPreviewImage(const cv::Mat& ldrImage, const InputStamp& renderInput,
+                        const InputStamp& toneInput, const InputStamp& regionInput) {
+    if (!encoderThread) {
+      ipu_utils::logger()->warn("Video encoder is not running: preview frame ignored.");
+      return;
+    }
+    bool dropped = previewFrames.post(PreviewFrame{ldrImage.clone(), Clock::now(), renderInput, toneInput, regionInput});
+    if (dropped) {
+      framesDropped += 1;
+      ipu_utils::logger()->debug("Video encoder busy: dropped preview frame ({} dropped in total)", framesDropped.load());
     }
+
+    // If the tone settings changed while this frame was being tone-mapped
+    // then the fast path must replace it (it may have used the old film):
+    if (toneInput.id != getState().toneInput.id) {
+      toneRequests.post(true);
+    }
+  }
+
+  /// Update the film snapshot used to re-tone-map the preview when only
+  /// exposure or gamma change. The image must be normalised by the sample
+  /// count and must not be modified after this call (it is not copied).
+  /// Call before submitting the preview that was tone-mapped from it:
+  void updateFilm(const cv::Mat& scaledHdrImage, const InputStamp& renderInput, const InputStamp& regionInput) {
+    std::lock_guard<std::mutex> lock(filmMutex);
+    film = scaledHdrImage;
+    filmRenderInput = renderInput;
+    filmRegionInput = regionInput;
   }
 
   bool startSendingRawImage(cv::Mat&& rawImage, std::size_t step) {
@@ -296,12 +838,11 @@ public:
     const std::uint32_t floats = hdrImage.cols * hdrImage.rows * hdrImage.channels();
     const std::uint32_t chunks = floats / chunkSize;
 
-    // Send the header packet:
-    if (sender) {
+    // Send the header packet (the full HDR image only goes to the controlling client):
+    if (sendToController("hdr_header", HdrHeader{hdrImage.cols, hdrImage.rows, chunks})) {
       ipu_utils::logger()->debug("Initiating large data transfer: {} chunks", chunks);
-      serialise(*sender, "hdr_header", HdrHeader{hdrImage.cols, hdrImage.rows, chunks});
     } else {
-      ipu_utils::logger()->debug("No muxer available: large data transfer aborted.");
+      ipu_utils::logger()->debug("No client available: large data transfer aborted.");
       return false;
     }
 
@@ -317,7 +858,10 @@ public:
       for (std::uint32_t c = 0; c < chunks; ++c) {
         float* sendPtr = hdrImage.ptr<float>(c);
         std::copy(sendPtr, sendPtr + data.size(), data.begin());
-        serialise(*sender, "hdr_packet", HdrPacket{c, data});
+        if (!sendToController("hdr_packet", HdrPacket{c, data})) {
+          ipu_utils::logger()->debug("Controlling client went away: large data transfer aborted.");
+          return;
+        }
         ipu_utils::logger()->debug("large transfer: sent chunk {} / {}", c + 1, chunks);
         // Throttle the send rate to maintain interactivity:
         std::this_thread::sleep_for(2ms);
@@ -333,19 +877,58 @@ public:
   virtual ~InterfaceServer() {
     sendHdrTask.waitForCompletion();
     stop();
+    close(wakeFd);
   }
 
 private:
   int port;
-  TcpSocket serverSocket;
+  const std::size_t maxClients;
+  const std::size_t maxClientQueueBytes;
+  ListeningSocket serverSocket;
   std::unique_ptr<std::thread> thread;
   std::atomic<bool> stopServer;
+  const int wakeFd;  // eventfd signalled to wake the server thread.
   std::atomic<bool> serverReady;
+  std::atomic<bool> serverExited;
   std::atomic<bool> stateUpdated;
-  std::unique_ptr<TcpSocket> connection;
-  std::unique_ptr<PacketMuxer> sender;
+  std::mutex eventMutex;
+  std::condition_variable events;
+  std::shared_ptr<const State> snapshot;  // Only access via std::atomic_load/store.
+  std::mutex stateWriteMutex;
+  std::uint32_t consumedNifRequests;
+  std::mutex clientsMutex;
+  std::vector<std::unique_ptr<ClientConnection>> clients;  // Oldest first.
+  std::uint32_t nextClientId;
+  std::atomic<std::uint32_t> controllerId;
+  std::vector<ClientConnection::Payload> streamHeader;
+  bool streamStarted;
   std::unique_ptr<LibAvWriter> videoStream;
-  State state;
+  std::unique_ptr<PreviewFilter> previewFilter;
+  std::unique_ptr<UiSessionRecorder> sessionRecorder;
+
+  Mailbox<PreviewFrame> previewFrames;
+  std::unique_ptr<std::thread> encoderThread;
+  std::atomic<float> encodeLatencyMs;
+  std::atomic<float> encodeMs;
+  std::atomic<std::uint32_t> framesEncoded;
+  std::atomic<std::uint32_t> framesDropped;
+  std::uint32_t framesSent;  // Only used by the encoder thread.
+  static constexpr std::size_t maxHdrRegionPixels = 256 * 256;
+  Mailbox<bool> toneRequests;
+  std::unique_ptr<std::thread> toneThread;
+  std::mutex filmMutex;
+  cv::Mat film;  // Latest film normalised by sample count (shared, never modified).
+  InputStamp filmRenderInput;
+  InputStamp filmRegionInput;
+  std::atomic<std::uint32_t> framesRetoned;
+  LatencyStats interactionLatency;
+  std::uint32_t lastRenderInputMeasured;
+  std::uint32_t lastToneInputMeasured;
+  std::uint32_t lastRegionInputMeasured;
+  std::uint32_t lastFilteredRenderInput;  // Input stamps of the last frame given to the preview filter.
+  std::uint32_t lastFilteredToneInput;
+  std::uint32_t lastFilteredRegionInput;
+
   cv::Mat hdrImage;
   AsyncTask sendHdrTask;
 };
@@ -123,12 +123,20 @@ void IpuPathTraceJob::buildGraph(poplar::Graph& graph,
 
   auto traceRecordSize = sizeof(TraceRecord);
 
+  // Each worker adds up the cycles it spends in the path-trace and
+  // accumulate compute sets over every iteration of a step (the counts
+  // are zeroed by the setup program): row 0 is path-trace, row 1 accumulate.
+  auto tileCycles = inputs.at("tile-cycles");
+
   const auto intervals = splitTilePixelsOverWorkers(getPixelCount(), workers);
   for (const auto& interval : intervals) {
+    const auto worker = tracerVertices.size();
     tracerVertices.push_back(graph.addVertex(pathTraceCs, "RayTraceKernel"));
     accumulatorVertices.push_back(graph.addVertex(accumulateCs, "AccumulateContributions"));
     auto& v1 = tracerVertices.back();
     auto& v2 = accumulatorVertices.back();
+    graph.connect(v1["cycles"], tileCycles[0][worker]);
+    graph.connect(v2["cycles"], tileCycles[1][worker]);
 
     addScalarConstant(graph, v1, "refractiveIndex", poplar::HALF,
                       args.at("refractive-index").as<float>());
@@ -151,6 +159,8 @@ void IpuPathTraceJob::buildGraph(poplar::Graph& graph,
   poplar::Tensor uvInput = inputs.at("uv-input");
   auto v3 = graph.addVertex(preProcEscapedRaysCs, "PreProcessEscapedRays");
   graph.connect(v3["contributionData"], contributionData);
+  graph.connect(v3["traceBuffer"], traceBuffer);
+  addScalarConstant<unsigned>(graph, v3, "imageHeight", poplar::UNSIGNED_INT, imageHeight);
   graph.connect(v3["azimuthalOffset"], localRotation);
   graph.connect(v3["u"], uvInput[0][0]);
   graph.connect(v3["v"], uvInput[1][0]);
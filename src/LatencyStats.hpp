@@ -0,0 +1,50 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/// Keeps a rolling window of the most recent latency
+/// measurements and computes percentiles over it.
+class LatencyStats {
+public:
+  LatencyStats(std::size_t windowSize = 256)
+      : window(windowSize), next(0), count(0) {}
+  virtual ~LatencyStats() {}
+
+  void add(float latency) {
+    window[next] = latency;
+    next = (next + 1) % window.size();
+    count += 1;
+  }
+
+  /// Return the pth percentile (p in [0, 100]) of the values in the window:
+  float percentile(float p) const {
+    const auto n = size();
+    if (n == 0) {
+      return 0.f;
+    }
+    std::vector<float> sorted(window.begin(), window.begin() + n);
+    auto k = std::min<std::size_t>(n - 1, (p / 100.f) * n);
+    std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    return sorted[k];
+  }
+
+  float max() const {
+    const auto n = size();
+    return n ? *std::max_element(window.begin(), window.begin() + n) : 0.f;
+  }
+
+  /// Number of values in the current window:
+  std::size_t size() const { return std::min<std::size_t>(count, window.size()); }
+
+  /// Total number of values ever added:
+  std::uint64_t total() const { return count; }
+
+private:
+  std::vector<float> window;
+  std::size_t next;
+  std::uint64_t count;
+};
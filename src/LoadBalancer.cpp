@@ -4,17 +4,16 @@
 
 #include "codelets/TraceRecord.hpp"
 
-#include "io_utils.hpp"
-#include "ipu_utils.hpp"
+#include "logging.hpp"
+#include "stream_utils.hpp"
 
 #include <algorithm>
+#include <cmath>
 #include <random>
 #include <limits>
 
-std::size_t calculateMaxRaysPerTile(std::size_t imageWidth, std::size_t imageHeight, const poplar::Target& target) {
-  const auto numTiles = target.getNumTiles();
-  const auto numWorkers = target.getNumWorkerContexts();
-
+std::size_t calculateMaxRaysPerTile(std::size_t imageWidth, std::size_t imageHeight,
+                                    std::size_t numTiles, std::size_t numWorkers) {
   // Check for performance hint:
   if ((imageWidth * imageHeight) % (numTiles * numWorkers)) {
     ipu_utils::logger()->warn(
@@ -25,7 +24,7 @@ std::size_t calculateMaxRaysPerTile(std::size_t imageWidth, std::size_t imageHei
   const auto totalRayCount = imageWidth * imageHeight;
 
   // First round up rays per tile so all tiles have same worklist size:
-  unsigned raysPerTile = std::ceil(totalRayCount / (float)numTiles);
+  std::size_t raysPerTile = std::ceil(totalRayCount / (float)numTiles);
 
   // Then round rays per tile to be next multiple of num-workers:
   raysPerTile += raysPerTile % numWorkers;
@@ -51,11 +50,11 @@ std::vector<TraceRecord> createWorkListForImage(std::size_t imageWidth, std::siz
   return workList;
 }
 
-std::vector<RecordList> createTracingJobs(std::size_t imageWidth, std::size_t imageHeight, const poplar::Target& target) {
+std::vector<RecordList> createTracingJobs(std::size_t imageWidth, std::size_t imageHeight,
+                                          std::size_t numTiles, std::size_t numWorkers) {
   // Calculate number of rays each tile needs to trace
   // to take one sample-per-pixel of the whole image:
-  const auto numTiles = target.getNumTiles();
-  const auto maxRaysPerTile = calculateMaxRaysPerTile(imageWidth, imageHeight, target);
+  const auto maxRaysPerTile = calculateMaxRaysPerTile(imageWidth, imageHeight, numTiles, numWorkers);
   auto paddedRayCount = maxRaysPerTile * numTiles;
 
   // Make a worklist that contains every pixel in the image:
@@ -85,6 +84,22 @@ std::vector<RecordList> createTracingJobs(std::size_t imageWidth, std::size_t im
   return perTileWork;
 }
 
+double pathLengthImbalance(const RecordList& work, std::size_t numTiles) {
+  const auto recordsPerTile = work.size() / numTiles;
+  std::size_t total = 0;
+  std::size_t maxPerTile = 0;
+  for (auto t = 0u; t < numTiles; ++t) {
+    std::size_t sum = 0;
+    for (auto i = t * recordsPerTile; i < (t + 1) * recordsPerTile; ++i) {
+      sum += work[i].pathLength;
+    }
+    total += sum;
+    maxPerTile = std::max(maxPerTile, sum);
+  }
+  const double mean = total / double(numTiles);
+  return mean > 0.0 ? maxPerTile / mean : 1.0;
+}
+
 WorkList::WorkList(std::size_t size)
     : activeWork(size),
       inactiveWork(size) {}
@@ -102,13 +117,22 @@ RecordList& WorkList::inactive() {
 /// Retutn the next batch of work:
 void WorkList::swap() {
   std::swap(activeWork, inactiveWork);
+  std::swap(activeRect, inactiveRect);
   if (activeWork.empty()) {
     throw std::logic_error("The new active worklist is empty.");
   }
 }
 
+void WorkList::swapActive(WorkList& other) {
+  std::swap(activeWork, other.activeWork);
+  std::swap(activeRect, other.activeRect);
+}
+
 LoadBalancer::LoadBalancer(std::size_t workItemCount)
-    : work(workItemCount) {
+    : work(workItemCount),
+      balanced(workItemCount),
+      costs(workItemCount) {
+  order.reserve(workItemCount);
 }
 
 LoadBalancer::~LoadBalancer() {
@@ -117,7 +141,7 @@ LoadBalancer::~LoadBalancer() {
 // Randomise the inactive worklist:
 void LoadBalancer::randomiseWorkList(const std::vector<RecordList>& jobs) {
   // Take a copy of the active worklist:
-  std::vector<TraceRecord> workList;
+  RecordList workList;
   workList.reserve(jobs.size() * jobs.front().size());
 
   ipu_utils::logger()->trace("Work capacity:\n{}", workList.capacity());
@@ -134,61 +158,70 @@ void LoadBalancer::randomiseWorkList(const std::vector<RecordList>& jobs) {
   std::mt19937 g(workSeed);
   std::shuffle(workList.begin(), workList.end(), g);
 
-  // Overwrite the inactive worklist:
-  work.inactive() = workList;
+  // Replace the inactive worklist:
+  work.inactive().swap(workList);
+  work.setInactiveRegion(cv::Rect());
 }
 
-void LoadBalancer::allocateWorkByPathLength(const IpuJobList& jobs) {
-  // Sort a copy of the inactive work list by path length:
-  auto sorted = work.inactive();
-
-  ipu_utils::logger()->trace("Worklist before sort:\n{}", sorted);
+double LoadBalancer::allocateWorkByPathLength(BalancePolicy& policy, std::size_t numTiles, std::size_t recordsPerTile) {
+  auto& list = work.inactive();
+  ipu_utils::logger()->trace("Worklist before load balancing:\n{}", list);
 
-  std::sort(sorted.begin(), sorted.end(), [](const TraceRecord& a, const TraceRecord& b) -> bool {
-    return a.pathLength < b.pathLength;
-  });
+  costs.resize(list.size());
+  for (auto i = 0u; i < list.size(); ++i) {
+    costs[i] = list[i].pathLength;
+  }
+  const auto before = pathLengthImbalance(list, numTiles);
+  policy.assign(costs, numTiles, recordsPerTile, order);
+  const auto predicted = loadImbalance(tileLoads(costs, order, recordsPerTile));
+
+  // Permute the work list into the scratch list and swap the buffers (the
+  // stream connections are remade whenever the active list is swapped):
+  balanced.resize(list.size());
+  for (auto i = 0u; i < order.size(); ++i) {
+    balanced[i] = list[order[i]];
+  }
+  list.swap(balanced);
 
-  ipu_utils::logger()->trace("Worklist after sort:\n{}", sorted);
+  ipu_utils::logger()->trace("Worklist after load balancing:\n{}", list);
+  ipu_utils::logger()->info("Load balancing ({}): tile load max/mean {:.4f} -> {:.4f} (predicted)",
+                            policy.name(), before, predicted);
+  return predicted;
+}
 
-  // Pre-allocate per tile worklists:
-  std::vector<RecordList> perTileWork(jobs.size());
-  for (auto& t : perTileWork) {
-    t.reserve(jobs[0].getPixelCount());
+std::size_t LoadBalancer::fillRegion(const cv::Rect& region, std::size_t imageWidth, std::size_t imageHeight) {
+  auto& list = work.inactive();
+  const cv::Rect image(0, 0, imageWidth, imageHeight);
+  const auto pixels = region.empty() ? image : region & image;
+  const std::size_t pixelCount = pixels.area();
+  if (pixelCount == 0) {
+    throw std::invalid_argument("Region of interest does not overlap the image.");
   }
-
-  // Iterators for longest and shortest paths:
-  auto shortItr = sorted.begin();
-  auto longItr = sorted.end() - 1;
-
-  // Allocate work to tiles by taking pairs of items from both ends of the sorted list.
-  // I.e. the tile that takes the longest path from the last render step also takes the
-  // shortest path, and so on until the worklist is exhausted:
-  ipu_utils::logger()->info("Load balancing started ({} work items)", sorted.size());
-  ipu_utils::logger()->info("Path length min/max: {}/{}", shortItr->pathLength, longItr->pathLength);
-  while (true) {
-    for (auto& t : perTileWork) {
-      // Take 2 work items, one from each end of queue:
-      t.push_back(*shortItr);
-      t.push_back(*longItr);
-      ++shortItr;
-      --longItr;
-    }
-    if (longItr <= shortItr) {
-      break;
-    }
+  if (pixelCount > list.size()) {
+    throw std::logic_error("Work list is too small to trace the region of interest.");
   }
-  ipu_utils::logger()->info("Load balancing finished");
-
-  // Flatten the new worklist by tiles:
-  auto itr = sorted.begin();
-  for (auto& t : perTileWork) {
-    for (auto& w : t) {
-      *itr = w;
-      ++itr;
+
+  // A full frame is padded with null work (see createTracingJobs) but a
+  // region of interest repeats its pixels until the list is full:
+  const bool repeat = !region.empty();
+  const auto dummyCoord = std::numeric_limits<std::uint16_t>::max();
+  for (std::size_t i = 0; i < list.size(); ++i) {
+    if (repeat || i < pixelCount) {
+      const auto p = i % pixelCount;
+      list[i] = TraceRecord(pixels.x + p % pixels.width, pixels.y + p / pixels.width);
+    } else {
+      list[i] = TraceRecord(dummyCoord, dummyCoord);
     }
   }
 
-  work.inactive() = sorted;
+  // Shuffle so that the copies of each pixel are spread over tiles (the
+  // same seed as randomiseWorkList is used so runs are reproducible):
+  auto workSeed = 142u;
+  std::mt19937 g(workSeed);
+  std::shuffle(list.begin(), list.end(), g);
+  work.setInactiveRegion(region);
+
+  return repeat ? list.size() / pixelCount : 1;
 }
 
 /// Clear the accumulators in the inactive work list and
@@ -2,26 +2,39 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <vector>
 
-#include "IpuPathTraceJob.hpp"
+#include "BalancePolicy.hpp"
+#include "HostAllocator.hpp"
+
+#include <opencv2/core.hpp>
 
 // fwd declarations:
 struct TraceRecord;
 
-using RecordList = std::vector<TraceRecord>;
+/// Work lists are connected to device streams so use stream buffers:
+using RecordList = HostBuffer<TraceRecord>;
 
 /// Calculate the maximum number of rays every tile needs to trace in
 /// order to generate one sample per pixel for the whole image of the
 /// specified size.
-std::size_t calculateMaxRaysPerTile(std::size_t imageWidth, std::size_t imageHeight, const poplar::Target& target);
+std::size_t calculateMaxRaysPerTile(std::size_t imageWidth, std::size_t imageHeight,
+                                    std::size_t numTiles, std::size_t numWorkers);
 
 /// Create a worklist that contains one item for every pixel in the image.
 std::vector<TraceRecord> createWorkListForImage(std::size_t imageWidth, std::size_t imageHeight);
 
 /// Return a vector of work items per-tile.
-std::vector<RecordList> createTracingJobs(std::size_t imageWidth, std::size_t imageHeight, const poplar::Target& target);
+std::vector<RecordList> createTracingJobs(std::size_t imageWidth, std::size_t imageHeight,
+                                          std::size_t numTiles, std::size_t numWorkers);
+
+/// Return the ratio of the maximum to the mean total path length over
+/// tiles for a worklist that is split into equal chunks per tile. This
+/// estimates how unevenly the work in the list was spread over tiles.
+double pathLengthImbalance(const RecordList& work, std::size_t numTiles);
 
 /// A double buffered work list.
 struct WorkList {
@@ -32,12 +45,24 @@ struct WorkList {
   /// Swap the buffers:
   void swap();
 
+  /// Swap the active buffer with the active buffer of another work list
+  /// (this does not copy any records):
+  void swapActive(WorkList& other);
+
   RecordList& active();
   RecordList& inactive();
 
+  /// Region of interest that each buffer was filled for (an empty
+  /// region means the buffer traces the full frame):
+  const cv::Rect& activeRegion() const { return activeRect; }
+  const cv::Rect& inactiveRegion() const { return inactiveRect; }
+  void setInactiveRegion(const cv::Rect& region) { inactiveRect = region; }
+
 private:
   RecordList activeWork;
   RecordList inactiveWork;
+  cv::Rect activeRect;
+  cv::Rect inactiveRect;
 };
 
 struct LoadBalancer {
@@ -47,10 +72,29 @@ struct LoadBalancer {
   WorkList& getWork() { return work; }
 
   void randomiseWorkList(const std::vector<RecordList>& jobs);
-  void allocateWorkByPathLength(const IpuJobList& jobs);
+
+  /// Reorder the inactive work list so that the policy decides which tile
+  /// traces each record, using the path lengths from the last step as the
+  /// cost of each record. Returns the resulting ratio of max to mean tile
+  /// load (predicted from those same path lengths).
+  double allocateWorkByPathLength(BalancePolicy& policy, std::size_t numTiles, std::size_t recordsPerTile);
+
+  /// Overwrite the pixels traced by the inactive work list (which must have
+  /// been cleared) so that it only traces the given region of interest. The
+  /// size of the list is fixed so each pixel in the region is repeated to
+  /// fill it, taking several samples per pixel in each step. An empty region
+  /// returns to tracing every pixel in the image once. Returns the minimum
+  /// number of records per pixel.
+  std::size_t fillRegion(const cv::Rect& region, std::size_t imageWidth, std::size_t imageHeight);
   std::size_t clearInactiveAccumulators();
   void clearActiveAccumulators();
 
 private:
   WorkList work;
+
+  // Scratch space for load balancing, allocated once so that balancing
+  // does not map a new stream buffer every step:
+  RecordList balanced;
+  WorkCosts costs;
+  WorkOrder order;
 };
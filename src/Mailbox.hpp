@@ -0,0 +1,68 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+
+/// Single slot mailbox that only ever holds the most recently posted
+/// value. If the consumer falls behind then unconsumed values are
+/// overwritten (i.e. dropped) rather than queued, so the consumer
+/// always works on the latest data and the producer never blocks
+/// waiting for it.
+template <class T>
+class Mailbox {
+public:
+  Mailbox() : full(false), closed(false) {}
+  virtual ~Mailbox() {}
+
+  /// Post a new value. Returns true if an unconsumed value was dropped.
+  bool post(T&& value) {
+    bool dropped = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      dropped = full;
+      slot = std::move(value);
+      full = true;
+    }
+    cv.notify_one();
+    return dropped;
+  }
+
+  /// Block until a value is available and move it into the argument.
+  /// Returns false (leaving the argument unchanged) if the mailbox
+  /// was closed.
+  bool wait(T& value) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&]() { return full || closed; });
+    if (closed) {
+      return false;
+    }
+    value = std::move(slot);
+    full = false;
+    return true;
+  }
+
+  /// Wake any waiting consumer and make all subsequent waits return false.
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+    }
+    cv.notify_all();
+  }
+
+  /// Re-open a closed mailbox (any value left in the slot is discarded).
+  void open() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = false;
+    full = false;
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable cv;
+  T slot;
+  bool full;
+  bool closed;
+};
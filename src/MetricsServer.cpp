@@ -0,0 +1,270 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "MetricsServer.hpp"
+
+#include "logging.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+void MetricCounter::add(double v) {
+  auto old = total.load(std::memory_order_relaxed);
+  while (!total.compare_exchange_weak(old, old + v, std::memory_order_relaxed)) {}
+}
+
+MetricHistogram::MetricHistogram(const std::vector<double>& b)
+    : bounds(b),
+      buckets(new std::atomic<std::uint64_t>[b.size() + 1]),
+      observations(0) {
+  if (!std::is_sorted(bounds.begin(), bounds.end())) {
+    throw std::logic_error("Histogram bucket bounds must be sorted.");
+  }
+  for (auto i = 0u; i <= bounds.size(); ++i) {
+    buckets[i] = 0;
+  }
+}
+
+void MetricHistogram::observe(double v) {
+  // Buckets are stored non-cumulatively and summed when rendered:
+  const auto i = std::lower_bound(bounds.begin(), bounds.end(), v) - bounds.begin();
+  buckets[i].fetch_add(1, std::memory_order_relaxed);
+  total.add(v);
+  observations.fetch_add(1, std::memory_order_relaxed);
+}
+
+MetricsServer::MetricsServer() : listenFd(-1), wakeFd(-1), stopServing(false) {}
+
+MetricsServer::~MetricsServer() {
+  stop();
+}
+
+MetricsServer::Series& MetricsServer::addSeries(const std::string& name, const std::string& help,
+                                                const std::string& type, const MetricLabels& labels) {
+  if (thread) {
+    throw std::logic_error("Metrics can not be added after the metrics server has started.");
+  }
+  auto itr = std::find_if(families.begin(), families.end(), [&](const Family& f) { return f.name == name; });
+  if (itr == families.end()) {
+    families.push_back(Family{name, help, type, {}});
+    itr = families.end() - 1;
+  } else if (itr->type != type) {
+    throw std::logic_error("Metric '" + name + "' was already added with a different type.");
+  }
+  itr->series.push_back(Series{labels, nullptr, nullptr, nullptr});
+  return itr->series.back();
+}
+
+MetricCounter& MetricsServer::addCounter(const std::string& name, const std::string& help, const MetricLabels& labels) {
+  auto& s = addSeries(name, help, "counter", labels);
+  s.counter.reset(new MetricCounter());
+  return *s.counter;
+}
+
+MetricGauge& MetricsServer::addGauge(const std::string& name, const std::string& help, const MetricLabels& labels) {
+  auto& s = addSeries(name, help, "gauge", labels);
+  s.gauge.reset(new MetricGauge());
+  return *s.gauge;
+}
+
+MetricHistogram& MetricsServer::addHistogram(const std::string& name, const std::string& help,
+                                             const std::vector<double>& bounds, const MetricLabels& labels) {
+  auto& s = addSeries(name, help, "histogram", labels);
+  s.histogram.reset(new MetricHistogram(bounds));
+  return *s.histogram;
+}
+
+namespace {
+
+std::string formatValue(double v) {
+  if (std::isinf(v)) {
+    return v > 0 ? "+Inf" : "-Inf";
+  }
+  // Shortest representation that round trips:
+  return fmt::format("{}", v);
+}
+
+std::string formatLabels(const MetricLabels& labels, const std::string& extraName = "", const std::string& extraValue = "") {
+  auto all = labels;
+  if (!extraName.empty()) {
+    all[extraName] = extraValue;
+  }
+  if (all.empty()) {
+    return "";
+  }
+  std::string s = "{";
+  for (const auto& l : all) {
+    if (s.size() > 1) {
+      s += ",";
+    }
+    s += l.first + "=\"";
+    for (auto c : l.second) {
+      if (c == '\n') {
+        s += "\\n";
+        continue;
+      }
+      if (c == '"' || c == '\\') {
+        s += '\\';
+      }
+      s += c;
+    }
+    s += "\"";
+  }
+  return s + "}";
+}
+
+} // end anonymous namespace
+
+std::string MetricsServer::render() const {
+  std::ostringstream out;
+  for (const auto& f : families) {
+    out << "# HELP " << f.name << " " << f.help << "\n";
+    out << "# TYPE " << f.name << " " << f.type << "\n";
+    for (const auto& s : f.series) {
+      if (s.counter) {
+        out << f.name << formatLabels(s.labels) << " " << formatValue(s.counter->value()) << "\n";
+      } else if (s.gauge) {
+        out << f.name << formatLabels(s.labels) << " " << formatValue(s.gauge->value()) << "\n";
+      } else if (s.histogram) {
+        const auto& h = *s.histogram;
+        std::uint64_t cumulative = 0;
+        for (auto b = 0u; b <= h.getBounds().size(); ++b) {
+          cumulative += h.bucketCount(b);
+          const auto le = b < h.getBounds().size() ? formatValue(h.getBounds()[b]) : "+Inf";
+          out << f.name << "_bucket" << formatLabels(s.labels, "le", le) << " " << cumulative << "\n";
+        }
+        out << f.name << "_sum" << formatLabels(s.labels) << " " << formatValue(h.sum()) << "\n";
+        out << f.name << "_count" << formatLabels(s.labels) << " " << h.count() << "\n";
+      }
+    }
+  }
+  return out.str();
+}
+
+void MetricsServer::start(int port) {
+  if (thread) {
+    throw std::logic_error("Metrics server is already running.");
+  }
+
+  listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listenFd < 0) {
+    throw std::runtime_error(std::string("Could not create metrics socket: ") + std::strerror(errno));
+  }
+  int reuse = 1;
+  setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  // Metrics are only served locally (use port forwarding to scrape remotely):
+  sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listenFd, 8) != 0) {
+    const std::string error = std::strerror(errno);
+    close(listenFd);
+    listenFd = -1;
+    throw std::runtime_error("Could not listen for metrics on port " + std::to_string(port) + ": " + error);
+  }
+  wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wakeFd < 0) {
+    const std::string error = std::strerror(errno);
+    close(listenFd);
+    listenFd = -1;
+    throw std::runtime_error("Could not create metrics server wake event: " + error);
+  }
+
+  stopServing = false;
+  thread.reset(new std::thread(&MetricsServer::serve, this));
+  ipu_utils::logger()->info("Serving metrics at http://localhost:{}/metrics", port);
+}
+
+void MetricsServer::stop() {
+  if (thread) {
+    stopServing = true;
+    const std::uint64_t one = 1;
+    auto written = write(wakeFd, &one, sizeof(one));
+    (void)written;  // Can only fail if the counter is saturated, which still wakes the thread.
+    thread->join();
+    thread.reset();
+  }
+  if (listenFd >= 0) {
+    close(listenFd);
+    listenFd = -1;
+  }
+  if (wakeFd >= 0) {
+    close(wakeFd);
+    wakeFd = -1;
+  }
+}
+
+void MetricsServer::serve() {
+  // Block until a scrape arrives or stop() signals the wake event:
+  pollfd fds[2] = {{listenFd, POLLIN, 0}, {wakeFd, POLLIN, 0}};
+  while (!stopServing) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ipu_utils::logger()->error("Metrics server could not wait for requests: {}", std::strerror(errno));
+      break;
+    }
+    if (stopServing || !(fds[0].revents & POLLIN)) {
+      continue;
+    }
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0) {
+      continue;
+    }
+    try {
+      respond(fd);
+    } catch (const std::exception& e) {
+      ipu_utils::logger()->warn("Metrics request failed: {}", e.what());
+    }
+    close(fd);
+  }
+}
+
+void MetricsServer::respond(int fd) const {
+  // Read the request line (a slow client can not hold up the thread for long):
+  timeval timeout{1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  char request[1024];
+  const auto n = recv(fd, request, sizeof(request) - 1, 0);
+  if (n <= 0) {
+    return;
+  }
+  request[n] = '\0';
+
+  const std::string requestLine(request, std::strcspn(request, "\r\n"));
+  std::string status = "200 OK";
+  std::string body;
+  if (requestLine.rfind("GET /metrics", 0) == 0 || requestLine.rfind("GET / ", 0) == 0) {
+    body = render();
+  } else {
+    status = "404 Not Found";
+    body = "Metrics are served at /metrics\n";
+  }
+
+  const auto response = "HTTP/1.0 " + status + "\r\n"
+                        "Content-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                        "Connection: close\r\n\r\n" + body;
+  std::size_t sent = 0;
+  while (sent < response.size()) {
+    const auto s = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+    if (s <= 0) {
+      throw std::runtime_error(std::string("send failed: ") + std::strerror(errno));
+    }
+    sent += s;
+  }
+}
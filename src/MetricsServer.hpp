@@ -0,0 +1,127 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using MetricLabels = std::map<std::string, std::string>;
+
+/// Lock free metric types. These are updated by the render loop and read
+/// by the metrics server thread, so a scrape never blocks rendering.
+
+/// Value that only ever increases (e.g. a total):
+class MetricCounter {
+public:
+  MetricCounter() : total(0.0) {}
+  void add(double v);
+  double value() const { return total.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<double> total;
+};
+
+/// Value that can go up and down (e.g. the latest measurement):
+class MetricGauge {
+public:
+  MetricGauge() : current(0.0) {}
+  void set(double v) { current.store(v, std::memory_order_relaxed); }
+  double value() const { return current.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<double> current;
+};
+
+/// Counts observations in cumulative buckets (Prometheus histogram):
+class MetricHistogram {
+public:
+  /// Bounds are the (sorted) upper bounds of the buckets; an
+  /// implicit +Inf bucket is added.
+  MetricHistogram(const std::vector<double>& bounds);
+  void observe(double v);
+
+  const std::vector<double>& getBounds() const { return bounds; }
+  std::uint64_t bucketCount(std::size_t i) const { return buckets[i].load(std::memory_order_relaxed); }
+  std::uint64_t count() const { return observations.load(std::memory_order_relaxed); }
+  double sum() const { return total.value(); }
+
+private:
+  const std::vector<double> bounds;
+  std::unique_ptr<std::atomic<std::uint64_t>[]> buckets;
+  std::atomic<std::uint64_t> observations;
+  MetricCounter total;
+};
+
+/// Observes the time (in seconds) from construction until stop()
+/// is called or the timer is destroyed:
+class MetricTimer {
+public:
+  MetricTimer(MetricHistogram& h) : histogram(h), start(std::chrono::steady_clock::now()), running(true) {}
+  ~MetricTimer() { stop(); }
+
+  void stop() {
+    if (running) {
+      running = false;
+      histogram.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+  }
+
+private:
+  MetricHistogram& histogram;
+  const std::chrono::steady_clock::time_point start;
+  bool running;
+};
+
+/// Registry of metrics that can be served over HTTP in the Prometheus
+/// text exposition format. All metrics must be added before start()
+/// is called: after that only their values may change.
+class MetricsServer {
+public:
+  MetricsServer();
+  virtual ~MetricsServer();
+
+  MetricCounter& addCounter(const std::string& name, const std::string& help, const MetricLabels& labels = {});
+  MetricGauge& addGauge(const std::string& name, const std::string& help, const MetricLabels& labels = {});
+  MetricHistogram& addHistogram(const std::string& name, const std::string& help,
+                                const std::vector<double>& bounds, const MetricLabels& labels = {});
+
+  /// Serve the metrics on the port at /metrics from a separate thread.
+  /// Throws if the port can not be bound.
+  void start(int port);
+  void stop();
+  bool serving() const { return listenFd >= 0; }
+
+  /// The current metrics in the Prometheus text format:
+  std::string render() const;
+
+private:
+  struct Series {
+    MetricLabels labels;
+    std::unique_ptr<MetricCounter> counter;
+    std::unique_ptr<MetricGauge> gauge;
+    std::unique_ptr<MetricHistogram> histogram;
+  };
+
+  struct Family {
+    std::string name;
+    std::string help;
+    std::string type;
+    std::vector<Series> series;
+  };
+
+  Series& addSeries(const std::string& name, const std::string& help, const std::string& type, const MetricLabels& labels);
+  void serve();
+  void respond(int fd) const;
+
+  std::vector<Family> families;
+  int listenFd;
+  int wakeFd;  // eventfd signalled by stop() to wake the server thread.
+  std::atomic<bool> stopServing;
+  std::unique_ptr<std::thread> thread;
+};
@@ -3,18 +3,26 @@
 #include "PathTracerApp.hpp"
 
 #include "AsyncTask.hpp"
+#include "HostAllocator.hpp"
+#include "SessionScheduler.hpp"
+#include "SharedMemoryPreview.hpp"
 #include "codelets/TraceRecord.hpp"
 #include "ipu_utils.hpp"
+#include "regression_utils.hpp"
 #include "shard_utils.hpp"
 
 #include <poplar/CycleCount.hpp>
+#include <opencv2/imgcodecs.hpp>
 #include <popops/Loop.hpp>
+#include <popops/Zero.hpp>
 
 #include <light/src/jobs.hpp>
 
 #include <poplar/OptionFlags.hpp>
 #include <poplin/MatMul.hpp>
 
+#include <fstream>
+
 /// Adjust samples per pixel to be multiple of samples per ipu step:
 std::size_t roundSamplesPerPixel(std::size_t samplesPerPixel,
                                  std::size_t samplesPerIpuStep) {
@@ -44,6 +52,46 @@ poplar::Tensor buildAaNoise(poplar::Graph& graph, poplar::Tensor& layoutTensor,
   }
 }
 
+RenderMetrics::RenderMetrics(MetricsServer& server)
+    : samplesPerSec(server.addGauge("ipu_trace_samples_per_second", "Pixel samples per second in the last render step.")),
+      raysPerSec(server.addGauge("ipu_trace_rays_per_second", "Rays (path segments) per second in the last render step.")),
+      steps(server.addCounter("ipu_trace_steps_total", "Render steps completed.")),
+      samples(server.addCounter("ipu_trace_samples_total", "Pixel samples rendered.")),
+      stepSeconds(server.addHistogram("ipu_trace_step_seconds", "Wall time of each render step.",
+                                      {0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30})),
+      worklistImbalance(server.addGauge("ipu_trace_worklist_imbalance",
+                                        "Ratio of max to mean total path length per tile in the last render step.")),
+      predictedImbalance(server.addGauge("ipu_trace_predicted_load_imbalance",
+                                         "Ratio of max to mean tile load predicted by the load balancing policy.")),
+      bytesToDevice(server.addCounter("ipu_trace_stream_bytes_total", "Bytes streamed between host and IPU.", {{"direction", "to_device"}})),
+      bytesFromDevice(server.addCounter("ipu_trace_stream_bytes_total", "Bytes streamed between host and IPU.", {{"direction", "from_device"}})),
+      nifSwapSeconds(server.addHistogram("ipu_trace_nif_swap_seconds", "Time to load a new NIF and upload its weights.",
+                                         {0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30})),
+      nifUploadSeconds(server.addHistogram("ipu_trace_nif_upload_seconds", "Time to upload the NIF weights to all IPUs.",
+                                           {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1})),
+      saveSeconds(server.addHistogram("ipu_trace_save_seconds", "Time to save the output images.",
+                                      {0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10})),
+      resetSeconds(server.addHistogram("ipu_trace_reset_seconds", "Time to reset the host render state after user interaction.",
+                                       {1e-6, 1e-5, 1e-4, 0.001, 0.01, 0.1, 1})) {
+  for (auto p : {"nif", "path_trace", "iteration"}) {
+    deviceCycles[p] = &server.addGauge("ipu_trace_device_cycles", "Device cycles for one iteration of each program.", {{"program", p}});
+  }
+  for (auto d : {"to_device", "from_device"}) {
+    transferSeconds[d] = &server.addHistogram("ipu_trace_transfer_seconds", "Wall time of the work list stream copies each step.",
+                                              {1e-5, 1e-4, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.1},
+                                              {{"direction", d}});
+  }
+  for (auto s : {"wait_for_host", "accumulate_framebuffers", "tone_map", "run_load_balancing", "clear_accumulators"}) {
+    hostStageSeconds[s] = &server.addHistogram("ipu_trace_host_stage_seconds", "Wall time of host processing stages.",
+                                               {0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1},
+                                               {{"stage", s}});
+  }
+  for (auto c : {"path_trace", "accumulate"}) {
+    tileCycleImbalance[c] = &server.addGauge("ipu_trace_tile_cycle_imbalance",
+                                             "Ratio of max to mean tile cycles (see --tile-cycle-interval).", {{"compute_set", c}});
+  }
+}
+
 PathTracerApp::PathTracerApp()
     : traceChannel("ipu_path_tracer"),
       seedTensor("seed"),
@@ -54,19 +102,117 @@ PathTracerApp::PathTracerApp()
       nifCycleCount("nif_cycle_count"),
       pathTraceCycleCount("path_trace_cycle_count"),
       iterationCycles("iter_cycle_count"),
-      traceBuffer("trace_buffer") {}
+      tileCycleCounts("tile_cycle_counts"),
+      numPartitions(1),
+      ipusPerPartition(1),
+      numViews(1),
+      metrics(metricsServer) {}
+
+PathTracerApp::~PathTracerApp() {
+  // Complete the trace here so that it is valid however execution ends:
+  trace_utils::ChromeTrace::instance().close();
+}
 
 
 void PathTracerApp::init(const boost::program_options::variables_map& options) {
   args = options;
+  if (!args.at("chrome-trace").as<std::string>().empty()) {
+    trace_utils::ChromeTrace::instance().enable(args.at("chrome-trace").as<std::string>());
+  }
   samplesPerPixel = args.at("samples").as<std::uint32_t>();
   samplesPerIpuStep = args.at("samples-per-step").as<std::uint32_t>();
   samplesPerPixel = roundSamplesPerPixel(samplesPerPixel, samplesPerIpuStep);
 
-  // Read the metadata saved with the model:
+  numViews = args.at("views").as<std::uint32_t>();
+  if (numViews == 0) {
+    throw std::invalid_argument("At least one view is required.");
+  }
+  if (args.count("view-fov")) {
+    viewFovDegrees = args.at("view-fov").as<std::vector<float>>();
+  }
+  viewAzimuthDegrees.assign(numViews, 0.f);
+  if (args.count("view-env-map-rotation")) {
+    viewAzimuthDegrees = args.at("view-env-map-rotation").as<std::vector<float>>();
+  }
+  if ((!viewFovDegrees.empty() && viewFovDegrees.size() != numViews) || viewAzimuthDegrees.size() != numViews) {
+    throw std::invalid_argument("Per-view settings must have one value for each view.");
+  }
+  if (args.at("height").as<std::uint32_t>() * numViews > std::numeric_limits<std::uint16_t>::max()) {
+    throw std::invalid_argument("Image height times the number of views must fit in 16-bit pixel coordinates.");
+  }
+
+  // Every partition needs whole IPUs as each IPU runs the NIF of its partition:
   auto numIpus = args.at("ipus").as<std::size_t>();
-  auto assetPath = args.at("assets").as<std::string>();
-  if (!loadNifModels(numIpus, assetPath)) {
+  numPartitions = args.at("partitions").as<std::uint32_t>();
+  if (numPartitions == 0 || numIpus % numPartitions != 0) {
+    throw std::invalid_argument("The number of IPUs must be a multiple of the number of partitions.");
+  }
+  ipusPerPartition = numIpus / numPartitions;
+  if (numPartitions > 1 && args.count("session")) {
+    throw std::invalid_argument("Partitions (--partitions) can not be used with render sessions (--session).");
+  }
+  if (args.count("session") || numPartitions > 1) {
+    // These are only implemented for a single render:
+    const std::pair<const char*, bool> singleRenderOptions[] = {
+      {"ui-port", args.at("ui-port").as<int>() != 0},
+      {"golden-image", !args.at("golden-image").as<std::string>().empty()},
+      {"cycle-baseline", !args.at("cycle-baseline").as<std::string>().empty()},
+      {"tile-cycle-interval", args.at("tile-cycle-interval").as<std::uint32_t>() != 0},
+      {"record-work-trace", !args.at("record-work-trace").as<std::string>().empty()}};
+    for (const auto& option : singleRenderOptions) {
+      if (option.second) {
+        throw std::invalid_argument(fmt::format(
+          "--{} can not be used with render sessions (--session) or partitions (--partitions).", option.first));
+      }
+    }
+  }
+  // Fail before the graph is compiled if the golden results have not been recorded:
+  const std::pair<const char*, bool> goldenResults[] = {
+    {"golden-image", true},
+    {"cycle-baseline", !args.at("record-baseline").as<bool>()}};
+  for (const auto& golden : goldenResults) {
+    const auto fileName = args.at(golden.first).as<std::string>();
+    if (golden.second && !fileName.empty() && !std::ifstream(fileName)) {
+      throw std::invalid_argument(fmt::format(
+        "Could not open --{} '{}': record the golden results with --record-baseline first.", golden.first, fileName));
+    }
+  }
+  std::vector<std::string> partitionAssets(numPartitions, args.at("assets").as<std::string>());
+  if (args.count("partition-assets")) {
+    partitionAssets = args.at("partition-assets").as<std::vector<std::string>>();
+  }
+  if (partitionAssets.size() != numPartitions ||
+      (args.count("partition") && args.at("partition").as<std::vector<std::string>>().size() != numPartitions)) {
+    throw std::invalid_argument("Per-partition settings must have one value for each partition.");
+  }
+  if (args.count("partition")) {
+    // Partitions run concurrently so there is nothing for a weight to share:
+    for (const auto& description : args.at("partition").as<std::vector<std::string>>()) {
+      if (("," + description).find(",weight=") != std::string::npos) {
+        throw std::invalid_argument("Partition settings can not set a weight: '" + description + "'");
+      }
+    }
+  }
+
+  // Stream names are needed whether the graph is built or loaded:
+  traceBuffers.clear();
+  for (auto p = 0u; p < numPartitions; ++p) {
+    traceBuffers.emplace_back(numPartitions == 1 ? "trace_buffer" : "trace_buffer_part" + std::to_string(p));
+  }
+  viewFovHalf.resize(numPartitions * numViews);
+  viewRadians.resize(numPartitions * numViews);
+
+  // Configure stream buffers before any are allocated (NIF weights are next):
+  auto& hostMemory = host_memory::config();
+  hostMemory.hugePages = args.at("host-huge-pages").as<bool>();
+  hostMemory.lock = args.at("lock-host-buffers").as<bool>();
+  hostMemory.numaNode = args.at("host-numa-node").as<int>();
+  if (hostMemory.numaNode < -1 || hostMemory.numaNode > host_memory::maxNumaNode) {
+    throw std::invalid_argument(fmt::format("--host-numa-node must be between -1 and {}.", host_memory::maxNumaNode));
+  }
+
+  // Read the metadata saved with the model:
+  if (!loadNifModels(numIpus, partitionAssets)) {
     throw std::runtime_error("Could not load NIF model.");
   }
 }
@@ -89,7 +235,8 @@ ipu_utils::RuntimeConfig PathTracerApp::getRuntimeConfig() const {
       !args.at("save-exe").as<std::string>().empty(),
       !args.at("load-exe").as<std::string>().empty(),
       compileOnly,
-      compileOnly || deferAttach};
+      compileOnly || deferAttach,
+      args.at("profile").as<std::string>()};
 }
 
 poplar::Tensor PathTracerApp::createNifInput(poplar::Graph& g, std::size_t numJobsInBatch, std::size_t pixelsPerJob) {
@@ -103,33 +250,52 @@ poplar::Tensor PathTracerApp::createNifInput(poplar::Graph& g, std::size_t numJo
   return uvInput;
 }
 
-bool PathTracerApp::loadNifModels(std::size_t numIpus, const std::string& assetPath) {
-  try {
-    // Load new NIFs and reconnect the streams:
-    const auto metaFile = assetPath + "/nif_metadata.txt";
-    const auto h5File = assetPath + "/converted.hdf5";
-    // The host-side data is shared among replicas:
-    auto nifData = std::make_shared<NifModel::Data>(h5File, metaFile);
-    models.clear();
-    for (auto c = 0u; c < numIpus; ++c) {
-      models.push_back(std::make_unique<NifModel>(nifData, "env_nif_ipu" + std::to_string(c)));
+bool PathTracerApp::loadNifModels(std::size_t numIpus, const std::vector<std::string>& assetPaths) {
+  const auto ipusPerAsset = numIpus / assetPaths.size();
+  std::vector<std::unique_ptr<NifModel>> newModels;
+  for (const auto& assetPath : assetPaths) {
+    try {
+      // Load new NIFs and reconnect the streams:
+      const auto metaFile = assetPath + "/nif_metadata.txt";
+      const auto h5File = assetPath + "/converted.hdf5";
+      // The host-side data is shared among replicas:
+      auto nifData = std::make_shared<NifModel::Data>(h5File, metaFile);
+      for (auto i = 0u; i < ipusPerAsset; ++i) {
+        const auto c = newModels.size();
+        newModels.push_back(std::make_unique<NifModel>(nifData, "env_nif_ipu" + std::to_string(c)));
+      }
+    } catch (std::exception& e) {
+      ipu_utils::logger()->error("Could not load NIF model from '{}'. Exception: {}", assetPath, e.what());
+      return false;
     }
-  } catch (std::exception& e) {
-    ipu_utils::logger()->error("Could not load NIF model from '{}'. Exception: {}", assetPath, e.what());
-    return false;
   }
 
+  models = std::move(newModels);
   return true;
 }
 
+bool PathTracerApp::isNifWeightSource(std::size_t ipu) const {
+  return !args.at("broadcast-nif-weights").as<bool>() || ipu % ipusPerPartition == 0;
+}
+
 void PathTracerApp::connectNifStreams(poplar::Engine& engine) {
   // Connect the parameter streams for each NIF:
-  for (auto& model : models) {
-    model->connectStreams(engine);
+  for (auto c = 0u; c < models.size(); ++c) {
+    models[c]->connectStreams(engine, isNifWeightSource(c));
   }
 }
 
-std::pair<poplar::program::Sequence, poplar::program::Sequence>
+void PathTracerApp::uploadNifWeights(poplar::Engine& engine) {
+  connectNifStreams(engine);
+  trace_utils::Tracepoint scopedTrace(&traceChannel, "upload_nif_weights");
+  auto startTime = std::chrono::steady_clock::now();
+  getPrograms().run(engine, "init_nif_weights");
+  auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  metrics.nifUploadSeconds.observe(secs);
+  ipu_utils::logger()->info("Uploaded NIF weights to {} IPUs in {} seconds", models.size(), secs);
+}
+
+poplar::program::Sequence
 PathTracerApp::buildEnvironmentNif(poplar::Graph& g, std::unique_ptr<NifModel>& model, poplar::Tensor input, poplar::Tensor& result) {
   if (!model) {
     throw std::runtime_error("Empty NIF model object.");
@@ -197,9 +363,7 @@ PathTracerApp::buildEnvironmentNif(poplar::Graph& g, std::unique_ptr<NifModel>&
     unrolledLoop.add(poplar::program::Copy(nifResultSlice, resultSlice));
   }
 
-  auto init = model->buildInit(g, optimiseStreamMemory);
-
-  return std::make_pair(init, unrolledLoop);
+  return unrolledLoop;
 }
 
 // When using multiple IPUs we want to have one replica of the environment NIF
@@ -232,17 +396,30 @@ PathTracerApp::buildNifReplicas(poplar::Graph& g, poplar::Tensor uvInput) {
 
     // For each shard of UVs build a NIF on corresponding IPU's virtual graph:
     poplar::Tensor result;
-    poplar::program::Sequence initNifModel;
-    poplar::program::Sequence execNifModel;
 #ifdef NO_VIRTUAL_GRAPHS
-    std::tie(initNifModel, execNifModel) = buildEnvironmentNif(g, models[s], ipuSlice, result);
+    auto& ipuGraph = g;
 #else
-    std::tie(initNifModel, execNifModel) = buildEnvironmentNif(graphs[s], models[s], ipuSlice, result);
+    auto& ipuGraph = graphs[s];
 #endif
+    execAllNifs.add(buildEnvironmentNif(ipuGraph, models[s], ipuSlice, result));
     shardResults.push_back(result);
     ipu_utils::logger()->debug("Shard result shape in IPU {}: {}", s, result.shape());
-    initAllNifs.add(initNifModel);
-    execAllNifs.add(execNifModel);
+    if (isNifWeightSource(s)) {
+      const bool optimiseStreamMemory = true;
+      initAllNifs.add(models[s]->buildInit(ipuGraph, optimiseStreamMemory));
+    }
+  }
+
+  if (args.at("broadcast-nif-weights").as<bool>()) {
+    // Weights are streamed from the host once per partition and then copied
+    // over IPU-links to the other IPUs of the partition:
+    for (auto p = 0u; p < numPartitions; ++p) {
+      std::vector<NifModel*> replicas;
+      for (auto s = p * ipusPerPartition; s < (p + 1) * ipusPerPartition; ++s) {
+        replicas.push_back(models[s].get());
+      }
+      initAllNifs.add(NifModel::buildBroadcastWeights(replicas, "broadcast_nif_weights"));
+    }
   }
 
   auto nifResult = poplar::concat(shardResults, 0);
@@ -310,17 +487,20 @@ poplar::Tensor PathTracerApp::buildPathRecords(poplar::Graph& g, const std::stri
 void PathTracerApp::build(poplar::Graph& g, const poplar::Target& target) {
   using namespace poplar;
 
-  pvti::Tracepoint::begin(&traceChannel, "create_path_tracing_jobs");
+  trace_utils::Tracepoint::begin(&traceChannel, "create_path_tracing_jobs");
   auto imageWidth = args.at("width").as<std::uint32_t>();
-  auto imageHeight = args.at("height").as<std::uint32_t>();
+  // Views are stacked vertically so that all views share every device step:
+  auto imageHeight = args.at("height").as<std::uint32_t>() * numViews;
   const auto tiles = target.getNumTiles();
-  auto raysPerJob = calculateMaxRaysPerTile(imageWidth, imageHeight, target);
+  // Each partition traces the whole image on its own range of tiles:
+  const auto tilesPerPartition = tiles / numPartitions;
+  auto raysPerJob = calculateMaxRaysPerTile(imageWidth, imageHeight, tilesPerPartition, target.getNumWorkerContexts());
 
   ipuJobs.reserve(tiles);
   for (auto t = 0u; t < tiles; ++t) {
     ipuJobs.emplace_back(raysPerJob, args, t);
   }
-  pvti::Tracepoint::end(&traceChannel, "create_path_tracing_jobs");
+  trace_utils::Tracepoint::end(&traceChannel, "create_path_tracing_jobs");
 
   poprand::addCodelets(g);
   popops::addCodelets(g);
@@ -341,12 +521,12 @@ void PathTracerApp::build(poplar::Graph& g, const poplar::Target& target) {
   initRenderSettings.add(aaScaleTensor.buildWrite(g, optimiseCopyMemoryUse));
 
   // Allow FOV to be changed at runtime:
-  fovTensor.buildTensor(g, poplar::HALF, {});
+  fovTensor.buildTensor(g, poplar::HALF, {numPartitions, numViews});
   g.setTileMapping(fovTensor, 2);
   initRenderSettings.add(fovTensor.buildWrite(g, optimiseCopyMemoryUse));
 
   // Allow env map rotation to be a runtime variable also:
-  azimuthRotation.buildTensor(g, poplar::FLOAT, {});
+  azimuthRotation.buildTensor(g, poplar::FLOAT, {numPartitions, numViews});
   g.setTileMapping(azimuthRotation, 0);
   initRenderSettings.add(azimuthRotation.buildWrite(g, optimiseCopyMemoryUse));
 
@@ -354,14 +534,14 @@ void PathTracerApp::build(poplar::Graph& g, const poplar::Target& target) {
   g.setTileMapping(deviceSampleLimit, 0);
   initRenderSettings.add(deviceSampleLimit.buildWrite(g, optimiseCopyMemoryUse));
 
-  pvti::Tracepoint::begin(&traceChannel, "build_nifs");
+  trace_utils::Tracepoint::begin(&traceChannel, "build_nifs");
   auto numJobsInBatch = ipuJobs.size();
   auto pixelsPerJob = ipuJobs.front().getPixelCount();
   auto uvInput = createNifInput(g, numJobsInBatch, pixelsPerJob);
   auto envNifs = buildNifReplicas(g, uvInput);
-  pvti::Tracepoint::end(&traceChannel, "build_nifs");
+  trace_utils::Tracepoint::end(&traceChannel, "build_nifs");
 
-  pvti::Tracepoint::begin(&traceChannel, "build_path_trace_jobs");
+  trace_utils::Tracepoint::begin(&traceChannel, "build_path_trace_jobs");
 
   // Make the compute sets for path tracing stages:
   const std::string prefix = "render/";
@@ -383,19 +563,27 @@ void PathTracerApp::build(poplar::Graph& g, const poplar::Target& target) {
   auto pathRecords = buildPathRecords(g, prefix);
 
   const auto pathsPerTile = ipuJobs.front().getPixelCount();
-  traceBuffer = g.addVariable(
+  auto traceBuffer = g.addVariable(
       poplar::UNSIGNED_CHAR,
       {ipuJobs.size(), sizeof(TraceRecord) * pathsPerTile},
       prefix + "tracebuffer");
-  ipu_utils::logger()->info("Tracebuffer shape: {}", traceBuffer.get().shape());
+  ipu_utils::logger()->info("Tracebuffer shape: {}", traceBuffer.shape());
+  for (auto p = 0u; p < numPartitions; ++p) {
+    traceBuffers[p] = traceBuffer.slice(p * tilesPerPartition, (p + 1) * tilesPerPartition, 0);
+  }
   auto primaryRays = g.addVariable(
       poplar::HALF,
       {ipuJobs.size(), IpuPathTraceJob::numRayDirComponents * pathsPerTile},
       prefix + "primary_rays");
 
-  mapTensorOverJobs(g, traceBuffer.get());
+  mapTensorOverJobs(g, traceBuffer);
   mapTensorOverJobs(g, primaryRays);
 
+  // Cycle counts for every worker in the path-trace and accumulate compute sets:
+  const auto workers = target.getNumWorkerContexts();
+  tileCycleCounts.buildTensor(g, poplar::UNSIGNED_INT, {2, ipuJobs.size(), workers});
+  mapTensorOverJobs(g, tileCycleCounts.get().dimShuffle({1, 0, 2}));
+
   for (auto j = 0u; j < ipuJobs.size(); ++j) {
     // Create inputs: input to job on each tile is a slice of the global tensors:
     auto uvInputSlice = uvInput.slice(j, j + 1, 1);
@@ -403,19 +591,22 @@ void PathTracerApp::build(poplar::Graph& g, const poplar::Target& target) {
     auto aaNoiseFlatSlice = aaNoise.slice(j, j + 1, 0).flatten();
     auto samplesFlatSlice = primarySamples.slice(j, j + 1, 0).flatten();
     auto pathRecordsSlice = pathRecords.slice(j, j + 1, 0).reshape({pathRecords.dim(1), pathRecords.dim(2)});
-    auto traceBufferSlice = traceBuffer.get().slice(j, j + 1, 0).reshape({traceBuffer.get().dim(1)});
+    auto traceBufferSlice = traceBuffer.slice(j, j + 1, 0).reshape({traceBuffer.dim(1)});
     auto primaryRaysSlice = primaryRays.slice(j, j + 1, 0).reshape({primaryRays.dim(1)});
+    auto tileCyclesSlice = tileCycleCounts.get().slice(j, j + 1, 1).squeeze({1});
+    const auto partition = j / tilesPerPartition;
     const IpuPathTraceJob::InputMap jobInputs = {
         {"aa-scale", aaScaleTensor},
-        {"fov", fovTensor},
+        {"fov", fovTensor.get()[partition]},
         {"uv-input", uvInputSlice},
         {"env-map-result", nifResultSlice},
-        {"env-map-rotation", azimuthRotation},
+        {"env-map-rotation", azimuthRotation.get()[partition]},
         {"aa-noise", aaNoiseFlatSlice},
         {"primary-samples", samplesFlatSlice},
         {"path-records", pathRecordsSlice},
         {"tracebuffer", traceBufferSlice},
-        {"primary-rays", primaryRaysSlice}};
+        {"primary-rays", primaryRaysSlice},
+        {"tile-cycles", tileCyclesSlice}};
     auto& job = ipuJobs[j];
     job.buildGraph(g, jobInputs, computeSets, args);
   }
@@ -423,10 +614,14 @@ void PathTracerApp::build(poplar::Graph& g, const poplar::Target& target) {
   using namespace poplar::program;
 
   Sequence preTraceInit;
-  preTraceInit.add(traceBuffer.buildWrite(g, true));
+  for (auto& t : traceBuffers) {
+    preTraceInit.add(t.buildWrite(g, true));
+  }
   for (auto& j : ipuJobs) {
     preTraceInit.add(j.beginTraceJob());
   }
+  // Tile cycles are summed over the iterations of a step:
+  popops::zero(g, tileCycleCounts.get(), preTraceInit, "zero_tile_cycles");
 
   // Construct the core path tracing program:
   Sequence pathTraceIteration;
@@ -469,62 +664,74 @@ void PathTracerApp::build(poplar::Graph& g, const poplar::Target& target) {
 
   // Program to read back results and stats:
   Sequence readTraceResult;
-  readTraceResult.add(traceBuffer.buildRead(g, true));
+  for (auto& t : traceBuffers) {
+    readTraceResult.add(t.buildRead(g, true));
+  }
   readTraceResult.add(nifCycleCount.buildRead(g, true));
   readTraceResult.add(pathTraceCycleCount.buildRead(g, true));
   readTraceResult.add(iterationCycles.buildRead(g, true));
 
-  pvti::Tracepoint::end(&traceChannel, "build_path_trace_jobs");
+  // Per-tile cycle counts are only read back periodically (if requested):
+  Sequence readTileCycles;
+  readTileCycles.add(tileCycleCounts.buildRead(g, true));
+
+  trace_utils::Tracepoint::end(&traceChannel, "build_path_trace_jobs");
 
   programs.add("init_render_settings", initRenderSettings);
   programs.add("init_nif_weights", envNifs.init);
   programs.add("setup", preTraceInit);
   programs.add("path_trace", executeRayTrace);
   programs.add("read_results", readTraceResult);
+  programs.add("read_tile_cycles", readTileCycles);
 }
 
 // Initialise the work list (which pixels should be traced on
 // which tiles):
 void PathTracerApp::initialiseState(std::uint32_t imageWidth, std::uint32_t imageHeight,
                                     poplar::Engine& engine, const poplar::Target& target) {
-  auto jobs = createTracingJobs(imageWidth, imageHeight, target);
+  auto jobs = createTracingJobs(imageWidth, imageHeight, target.getNumTiles(), target.getNumWorkerContexts());
   ipu_utils::logger()->info("Created worklists for {} tiles", jobs.size());
 
-  // We have two pointers for tracked work: one which is to keep defunct
-  // data alive whilst asynchronous host processing completes on it.
-  traceState = std::make_unique<PathTracerState>(imageWidth, imageHeight);
-  traceState->work.randomiseWorkList(jobs);
-  traceState->work.getWork().active() = traceState->work.getWork().inactive();
+  // All host render state is allocated here so that restarts never
+  // allocate (one state keeps defunct data alive whilst asynchronous
+  // host processing completes on it):
+  renderStates.reset(new RenderStateArena(imageWidth, imageHeight, jobs, numViews));
   connectActiveWorkListStreams(engine);
 }
 
 void PathTracerApp::connectActiveWorkListStreams(poplar::Engine& engine) {
-  pvti::Tracepoint scopedTrace(&traceChannel, "connect_work_list_streams");
-  traceBuffer.connectReadStream(engine, traceState->work.getWork().active());
-  traceBuffer.connectWriteStream(engine, traceState->work.getWork().active());
+  connectWorkListStreams(engine, renderStates->current());
+}
+
+void PathTracerApp::connectWorkListStreams(poplar::Engine& engine, PathTracerState& state, std::size_t partition) {
+  trace_utils::Tracepoint scopedTrace(&traceChannel, "connect_work_list_streams");
+  traceBuffers.at(partition).connectReadStream(engine, state.work.getWork().active());
+  traceBuffers.at(partition).connectWriteStream(engine, state.work.getWork().active());
+}
+
+void PathTracerApp::updateViewSettings(const poplar::Target& target, float fovRadians, float envRotationDegrees,
+                                       std::size_t partition) {
+  const auto offset = partition * numViews;
+  std::vector<float> fov(numViews, fovRadians);
+  for (auto v = 0u; v < numViews; ++v) {
+    if (!viewFovDegrees.empty()) {
+      fov[v] = viewFovDegrees[v] * (M_PI / 180.f);
+    }
+    viewRadians.at(offset + v) = ((envRotationDegrees + viewAzimuthDegrees[v]) / 360.f) * (2.0 * M_PI);
+  }
+  poplar::copyFloatToDeviceHalf(target, fov.data(), viewFovHalf.data() + offset, numViews);
 }
 
 // The user interaction invalidates all in progress rendering work but
 // we don't want to wait for those defunct jobs to complete before we
-// start new work. To achieve this we allocate new tracer state and
-// then swap the new state with the defunct state:
-void PathTracerApp::defunctState(std::uint32_t imageWidth, std::uint32_t imageHeight, poplar::Engine& engine) {
-  if (defunctTraceState) {
-    // Avoid reallocation as it is expensive (the workists are large):
-    pvti::Tracepoint scopedTrace(&traceChannel, "clear_defunct_worklist");
-    defunctTraceState->film.reset();
-  } else {
-    pvti::Tracepoint scopedTrace(&traceChannel, "allocate_new_worklist");
-    defunctTraceState.reset(new PathTracerState(imageWidth, imageHeight));
+// start new work. To achieve this we switch to the other preallocated
+// state, leaving the defunct one to the async task (see RenderStateArena):
+void PathTracerApp::defunctState(poplar::Engine& engine) {
+  {
+    trace_utils::Tracepoint scopedTrace(&traceChannel, "swap_render_state");
+    renderStates->restart();
   }
-
-  // Swap and then copy the up-to-date work from the now defunct worklist:
-  pvti::Tracepoint::begin(&traceChannel, "copy_worklists");
-  std::swap(traceState, defunctTraceState);
-  traceState->work.getWork().active() = defunctTraceState->work.getWork().active();
-  traceState->work.getWork().inactive() = defunctTraceState->work.getWork().active();
-  pvti::Tracepoint::end(&traceChannel, "copy_worklists");
-
+  ipu_utils::logger()->debug("Render state generation: {}", renderStates->generation());
   connectActiveWorkListStreams(engine);
 }
 
@@ -546,28 +753,111 @@ PathTracerApp::processUserInput(
     return InterfaceServer::Status::Disconnected;
   } else {
     if (!state.newNif.empty()) {
-      pvti::Tracepoint scopedTrace2(&traceChannel, "load_nif_file");
+      trace_utils::Tracepoint scopedTrace2(&traceChannel, "load_nif_file");
       // Load of a new NIF was requested:
       ipu_utils::logger()->info("Loading NIF: {}", state.newNif);
-      if (loadNifModels(models.size(), state.newNif)) {
+      MetricTimer timer(metrics.nifSwapSeconds);
+      if (loadNifModels(models.size(), {state.newNif})) {
         // Connect new NIF streams and upload the weights:
-        connectNifStreams(engine);
-        progs.run(engine, "init_nif_weights");
+        uploadNifWeights(engine);
       }
     }
 
-    pvti::Tracepoint scopedTrace3(&traceChannel, "reset_host_render_state");
-    defunctState(imageWidth, imageHeight, engine);
+    trace_utils::Tracepoint scopedTrace3(&traceChannel, "reset_host_render_state");
+    MetricTimer resetTimer(metrics.resetSeconds);
+    defunctState(engine);
 
     return InterfaceServer::Status::Restart;
   }
 }
 
+void PathTracerApp::connectCycleStreams(poplar::Engine& engine) {
+  nifCycleCount.connectReadStream(engine, &stepCycles.nif);
+  pathTraceCycleCount.connectReadStream(engine, &stepCycles.pathTrace);
+  iterationCycles.connectReadStream(engine, &stepCycles.iteration);
+}
+
+void PathTracerApp::runRenderStep(poplar::Engine& engine, double clockHz, std::size_t workListBytes) {
+  const auto& progs = getPrograms();
+  {
+    MetricTimer timer(*metrics.transferSeconds.at("to_device"));
+    progs.run(engine, "setup");
+  }
+  const auto pathTraceStartUs = trace_utils::ChromeTrace::instance().nowUs();
+  progs.run(engine, "path_trace");
+  {
+    MetricTimer timer(*metrics.transferSeconds.at("from_device"));
+    progs.run(engine, "read_results");
+  }
+  traceDevicePhases(pathTraceStartUs, samplesPerIpuStep, clockHz,
+                    stepCycles.nif, stepCycles.pathTrace, stepCycles.iteration);
+  ipu_utils::logger()->debug("Path-Trace cycle count: {}", stepCycles.pathTrace);
+  ipu_utils::logger()->debug("NIF cycle count: {}", stepCycles.nif);
+  ipu_utils::logger()->debug("Total cycles per iteration: {}", stepCycles.iteration);
+  metrics.deviceCycles.at("nif")->set(stepCycles.nif);
+  metrics.deviceCycles.at("path_trace")->set(stepCycles.pathTrace);
+  metrics.deviceCycles.at("iteration")->set(stepCycles.iteration);
+
+  // The worklists are streamed to and from the device every step:
+  metrics.bytesToDevice.add(workListBytes);
+  metrics.bytesFromDevice.add(workListBytes);
+}
+
+std::size_t PathTracerApp::processStepResults(std::size_t step, LoadBalancer& work, AccumulatedImage& film,
+                                              const cv::Rect& region, BalancePolicy* policy, std::size_t numTiles,
+                                              const std::function<void()>& publish) {
+  trace_utils::Tracepoint::begin(&hostTraceChannel, "accumulate_framebuffers");
+  MetricTimer accumulateTimer(*metrics.hostStageSeconds.at("accumulate_framebuffers"));
+  film.accumulate(work.getWork().inactive(), region);
+  accumulateTimer.stop();
+  trace_utils::Tracepoint::end(&hostTraceChannel, "accumulate_framebuffers");
+
+  publish();
+
+  if (metricsServer.serving()) {
+    // The inactive list holds the results from the last step in tile order:
+    metrics.worklistImbalance.set(pathLengthImbalance(work.getWork().inactive(), numTiles));
+  }
+
+  if (policy && step > 1) {
+    trace_utils::Tracepoint scopedTrace(&hostTraceChannel, "run_load_balancing");
+    MetricTimer timer(*metrics.hostStageSeconds.at("run_load_balancing"));
+    const auto predicted = work.allocateWorkByPathLength(*policy, numTiles, ipuJobs.front().getPixelCount());
+    metrics.predictedImbalance.set(predicted);
+  }
+
+  trace_utils::Tracepoint::begin(&hostTraceChannel, "clear_accumulators");
+  MetricTimer clearTimer(*metrics.hostStageSeconds.at("clear_accumulators"));
+  const auto rays = work.clearInactiveAccumulators();
+  clearTimer.stop();
+  trace_utils::Tracepoint::end(&hostTraceChannel, "clear_accumulators");
+  return rays;
+}
+
+double PathTracerApp::recordStepMetrics(double secs, std::size_t pixelSamples, std::size_t rays) {
+  const auto sampleRate = pixelSamples / secs;
+  metrics.samplesPerSec.set(sampleRate);
+  metrics.raysPerSec.set(rays / secs);
+  metrics.steps.add(1);
+  metrics.samples.add(pixelSamples);
+  metrics.stepSeconds.observe(secs);
+  return sampleRate;
+}
+
 void PathTracerApp::execute(poplar::Engine& engine, const poplar::Device& device) {
-  pvti::Tracepoint::begin(&traceChannel, "initialisation");
+  if (args.count("session")) {
+    executeSessions(engine, device);
+    return;
+  }
+  if (numPartitions > 1) {
+    executePartitions(engine, device);
+    return;
+  }
+
+  trace_utils::Tracepoint::begin(&traceChannel, "initialisation");
 
   auto imageWidth = args.at("width").as<std::uint32_t>();
-  auto imageHeight = args.at("height").as<std::uint32_t>();
+  auto imageHeight = args.at("height").as<std::uint32_t>() * numViews; // Views are stacked vertically.
   auto samplesPerPixel = args.at("samples").as<std::uint32_t>();
   auto seed = args.at("seed").as<std::uint64_t>();
   auto antiAliasingScale = args.at("aa-noise-scale").as<float>();
@@ -576,31 +866,31 @@ void PathTracerApp::execute(poplar::Engine& engine, const poplar::Device& device
   auto configGamma = args.at("gamma").as<float>();
   auto fileName = args.at("outfile").as<std::string>();
   auto loadBalanceEnabled = args.at("enable-load-balancing").as<bool>();
+  auto balancePolicy = createBalancePolicy(args.at("load-balance-policy").as<std::string>());
   auto saveInterval = args.at("save-interval").as<std::uint32_t>();
   samplesPerPixel = roundSamplesPerPixel(samplesPerPixel, samplesPerIpuStep);
   const auto steps = samplesPerPixel / samplesPerIpuStep;
-  // Convert env map rotation to radians:
   auto degrees = args.at("env-map-rotation").as<float>();
-  float radians = (degrees / 360.f) * (2.0 * M_PI);
 
   // Connect streams for render state:
   seedTensor.connectWriteStream(engine, &seed);
   std::uint16_t aaScaleHalf;
-  std::uint16_t fovHalf;
   poplar::copyFloatToDeviceHalf(device.getTarget(), &antiAliasingScale, &aaScaleHalf, 1);
-  poplar::copyFloatToDeviceHalf(device.getTarget(), &fieldOfView, &fovHalf, 1);
+  updateViewSettings(device.getTarget(), fieldOfView, degrees);
   aaScaleTensor.connectWriteStream(engine, &aaScaleHalf);
-  fovTensor.connectWriteStream(engine, &fovHalf);
-  azimuthRotation.connectWriteStream(engine, &radians);
+  fovTensor.connectWriteStream(engine, viewFovHalf);
+  azimuthRotation.connectWriteStream(engine, viewRadians);
   deviceSampleLimit.connectWriteStream(engine, &samplesPerIpuStep);
 
   // Connect streams for cycle counters:
-  std::int64_t nifCycles;
-  std::int64_t pathTraceCycles;
-  std::int64_t totalCycles;
-  nifCycleCount.connectReadStream(engine, &nifCycles);
-  pathTraceCycleCount.connectReadStream(engine, &pathTraceCycles);
-  iterationCycles.connectReadStream(engine, &totalCycles);
+  connectCycleStreams(engine);
+  const auto tileCycleInterval = args.at("tile-cycle-interval").as<std::uint32_t>();
+  std::vector<std::uint32_t> workerCycles(2 * ipuJobs.size() * device.getTarget().getNumWorkerContexts());
+  std::vector<TileCycleRecord> tileCycleRecords;
+  tileCycleCounts.connectReadStream(engine, workerCycles);
+
+  // Device phases are added to the Chrome trace (if enabled):
+  const double clockHz = device.getTarget().getTileClockFrequency();
 
   // Record a graph of sample rate for the system analyser:
   pvti::Graph plot("Throughput", "paths/sec");
@@ -609,8 +899,7 @@ void PathTracerApp::execute(poplar::Engine& engine, const poplar::Device& device
   const auto& progs = getPrograms();
   auto startTime = std::chrono::steady_clock::now();
 
-  connectNifStreams(engine);
-  progs.run(engine, "init_nif_weights");
+  uploadNifWeights(engine);
   progs.run(engine, "init_render_settings");
 
   // Build the tracing jobs:
@@ -621,9 +910,17 @@ void PathTracerApp::execute(poplar::Engine& engine, const poplar::Device& device
   InterfaceServer::State state;
   auto uiPort = args.at("ui-port").as<int>();
   if (uiPort) {
-    uiServer.reset(new InterfaceServer(uiPort));
+    uiServer.reset(new InterfaceServer(uiPort, args.at("ui-max-clients").as<std::uint32_t>()));
+    const auto sessionFile = args.at("ui-record").as<std::string>();
+    if (!sessionFile.empty()) {
+      uiServer->recordSession(sessionFile);
+    }
     uiServer->start();
     uiServer->initialiseVideoStream(imageWidth, imageHeight);
+    auto previewMinChange = args.at("preview-min-change").as<float>();
+    if (previewMinChange > 0.f) {
+      uiServer->enablePreviewFilter(previewMinChange, args.at("preview-max-skip").as<std::uint32_t>());
+    }
   } else {
     // If no remote UI attach set the UI state direct from the options/config:
     state.exposure = configExposure;
@@ -633,16 +930,46 @@ void PathTracerApp::execute(poplar::Engine& engine, const poplar::Device& device
     state.interactiveSamples = args.at("interactive-samples").as<std::uint32_t>();
   }
 
-  pvti::TraceChannel hostTraceChannel = {"host_processing"};
+  // Optionally publish previews to shared memory for local consumers:
+  std::unique_ptr<SharedMemoryPreview> shmPreview;
+  auto shmName = args.at("shm-preview").as<std::string>();
+  if (!shmName.empty()) {
+    shmPreview.reset(new SharedMemoryPreview(shmName, imageWidth, imageHeight,
+                                             args.at("shm-preview-slots").as<std::uint32_t>()));
+  }
+
+  // Optionally serve render telemetry:
+  auto metricsPort = args.at("metrics-port").as<int>();
+  if (metricsPort) {
+    metricsServer.start(metricsPort);
+  }
+
+  // Optionally record the work done in each step for offline load balancing experiments:
+  auto workTraceFile = args.at("record-work-trace").as<std::string>();
+  if (!workTraceFile.empty()) {
+    workTrace.reset(new work_trace::Writer(workTraceFile, imageWidth, imageHeight,
+                                           ipuJobs.size(), ipuJobs.front().getPixelCount()));
+    ipu_utils::logger()->info("Recording work trace to '{}'", workTraceFile);
+  }
+
   AsyncTask hostProcessing;
 
-  pvti::Tracepoint::end(&traceChannel, "initialisation");
-  pvti::Tracepoint::begin(&traceChannel, "rendering");
+  trace_utils::Tracepoint::end(&traceChannel, "initialisation");
+  trace_utils::Tracepoint::begin(&traceChannel, "rendering");
   ipu_utils::logger()->info("Render started");
 
   constexpr std::size_t sampleCountReversionStep = 5;
   std::size_t totalRays = 0;
 
+  // Accumulate device cycle counts so the mean per step can be checked against a baseline:
+  CycleCounts cycleTotals;
+  std::size_t cycleSteps = 0;
+
+  // Region of interest traced by each of the double buffered work lists (an
+  // empty region is the full frame) and the input that requested it:
+  const cv::Rect imageRect(0, 0, imageWidth, imageHeight);
+  InterfaceServer::InputStamp activeRegionInput, inactiveRegionInput;
+
   // Loop over the requisite number of steps with each step
   // computing many samples per pixel on IPU.
   for (auto step = 1u; step <= steps; ++step) {
@@ -650,7 +977,7 @@ void PathTracerApp::execute(poplar::Engine& engine, const poplar::Device& device
 
     // Do the simple thing and restart the entire render if any state changed:
     if (uiServer && uiServer->stateChanged()) {
-      pvti::Tracepoint scopedTrace1(&traceChannel, "ui_processing");
+      trace_utils::Tracepoint scopedTrace1(&traceChannel, "ui_processing");
       state = uiServer->consumeState();
       auto status = processUserInput(state, imageWidth, imageHeight, engine, progs);
 
@@ -678,34 +1005,67 @@ void PathTracerApp::execute(poplar::Engine& engine, const poplar::Device& device
     if (step == 1 || step == sampleCountReversionStep) {
       // Update the variables that are connected to streams and
       // then stream the new parameters to IPU:
-      pvti::Tracepoint::begin(&traceChannel, "update_ipu_settings");
-      radians = (state.envRotationDegrees / 360.f) * (2.0 * M_PI);
-      poplar::copyFloatToDeviceHalf(device.getTarget(), &state.fov, &fovHalf, 1);
+      trace_utils::Tracepoint::begin(&traceChannel, "update_ipu_settings");
+      updateViewSettings(device.getTarget(), state.fov, state.envRotationDegrees);
       progs.run(engine, "init_render_settings");
-      pvti::Tracepoint::end(&traceChannel, "update_ipu_settings");
+      trace_utils::Tracepoint::end(&traceChannel, "update_ipu_settings");
     }
 
-    pvti::Tracepoint::begin(&traceChannel, "ipu_render");
+    trace_utils::Tracepoint::begin(&traceChannel, "ipu_render");
     // Run ray tracing on the IPU and read back result (results go into into the active
     // buffer whilst the async host task processes the last result from the inactive buffer
     // so it doesn't matter that sync task is still processing the previous result):
-    progs.run(engine, "setup");
-    progs.run(engine, "path_trace");
-    progs.run(engine, "read_results");
-    ipu_utils::logger()->debug("Path-Trace cycle count: {}", pathTraceCycles);
-    ipu_utils::logger()->debug("NIF cycle count: {}", nifCycles);
-    ipu_utils::logger()->debug("Total cycles per iteration: {}", totalCycles);
-    pvti::Tracepoint::end(&traceChannel, "ipu_render");
+    runRenderStep(engine, clockHz, renderStates->current().work.getWork().active().size() * sizeof(TraceRecord));
+    cycleTotals["nif"] += stepCycles.nif;
+    cycleTotals["path_trace"] += stepCycles.pathTrace;
+    cycleTotals["iteration"] += stepCycles.iteration;
+    cycleSteps += 1;
+    std::vector<std::uint32_t> stepTileCycles;
+    if (tileCycleInterval && step % tileCycleInterval == 0) {
+      // Copy the counts (the stream buffer is overwritten by the next read)
+      // so that they are reported by the async host task:
+      progs.run(engine, "read_tile_cycles");
+      stepTileCycles = workerCycles;
+    }
+    trace_utils::Tracepoint::end(&traceChannel, "ipu_render");
 
     // Wait for completion of previous async task before starting the next:
-    pvti::Tracepoint::begin(&traceChannel, "wait_for_host");
+    trace_utils::Tracepoint::begin(&traceChannel, "wait_for_host");
     ipu_utils::logger()->trace("Waiting for async task to complete.");
+    MetricTimer waitTimer(*metrics.hostStageSeconds.at("wait_for_host"));
     hostProcessing.waitForCompletion();
+    waitTimer.stop();
     ipu_utils::logger()->trace("Async task completed.");
-    pvti::Tracepoint::end(&traceChannel, "wait_for_host");
+    trace_utils::Tracepoint::end(&traceChannel, "wait_for_host");
+
+    // The inactive worklist is traced next so apply any change to the region
+    // of interest now (this does not need a restart). If the remote UI went
+    // away return to full-frame rendering:
+    auto& traceState = renderStates->current();
+    {
+      const auto uiState = uiServer ? uiServer->getState() : state;
+      const auto region = uiServer ? uiState.region & imageRect : cv::Rect();
+      if (region != traceState.work.getWork().inactiveRegion()) {
+        trace_utils::Tracepoint scopedTrace(&traceChannel, "fill_region");
+        const auto recordsPerPixel = traceState.work.fillRegion(region, imageWidth, imageHeight);
+        ipu_utils::logger()->debug("Filled work list for region {}x{} at ({}, {}) with {} records per pixel",
+                                   region.width, region.height, region.x, region.y, recordsPerPixel);
+      }
+      if (region != traceState.film.getRegion()) {
+        traceState.film.setRegion(region);
+        if (region.empty()) {
+          ipu_utils::logger()->info("Region of interest cleared: rendering full frame");
+        } else {
+          ipu_utils::logger()->info("Rendering region of interest {}x{} at ({}, {})",
+                                    region.width, region.height, region.x, region.y);
+        }
+      }
+      inactiveRegionInput = uiState.regionInput;
+    }
 
     // Swap the worklist buffers and reconnect new active buffer to engine:
-    traceState->work.getWork().swap();
+    traceState.work.getWork().swap();
+    std::swap(activeRegionInput, inactiveRegionInput);
     connectActiveWorkListStreams(engine);
 
     // This lambda function asynchronously processes the result so far on
@@ -714,57 +1074,80 @@ void PathTracerApp::execute(poplar::Engine& engine, const poplar::Device& device
     // has returned. We explicitly capture pointers to the work list and
     // film that we are going to process as these may be made defunct by
     // user interaction if remote-UI is enabled.
-    hostProcessing.run([&, step, workPtr = &traceState->work, filmPtr = &traceState->film]() {
-      pvti::Tracepoint asyncScopedTrace(&hostTraceChannel, "async_work");
+    hostProcessing.run([&, step, renderInput = state.renderInput, generation = renderStates->generation(),
+                        region = traceState.work.getWork().inactiveRegion(), regionInput = inactiveRegionInput,
+                        workPtr = &traceState.work, filmPtr = &traceState.film,
+                        tileCycles = std::move(stepTileCycles)]() {
+      trace_utils::Tracepoint asyncScopedTrace(&hostTraceChannel, "async_work");
 
       // We process results from the inactive worklist while the IPU
       // is using the active work list:
-      pvti::Tracepoint::begin(&hostTraceChannel, "accumulate_framebuffers");
-      filmPtr->accumulate(workPtr->getWork().inactive());
-      pvti::Tracepoint::end(&hostTraceChannel, "accumulate_framebuffers");
-
-      if (uiServer) {
-        // Send data to update the remote UI:
-        {
-          pvti::Tracepoint::begin(&hostTraceChannel, "tone_map");
-          auto& ldr = filmPtr->updateLdrImage(step, uiServer->getState().exposure, uiServer->getState().gamma);
-          pvti::Tracepoint::end(&hostTraceChannel, "tone_map");
-          pvti::Tracepoint scopedTrace(&hostTraceChannel, "ui_encode_video");
-          uiServer->sendPreviewImage(ldr);
+      auto balancer = loadBalanceEnabled ? balancePolicy.get() : nullptr;
+      totalRays = processStepResults(step, *workPtr, *filmPtr, region, balancer, ipuJobs.size(), [&]() {
+        // Full-frame passes stop while a region of interest is rendered:
+        const auto filmSteps = std::max<std::size_t>(1, filmPtr->getStepCount());
+
+        // There is no point showing results from a state that user interaction
+        // has already made defunct (the preview would briefly go back in time):
+        const bool defunct = generation != renderStates->generation();
+        if ((uiServer || shmPreview) && !defunct) {
+          trace_utils::Tracepoint::begin(&hostTraceChannel, "tone_map");
+          MetricTimer toneMapTimer(*metrics.hostStageSeconds.at("tone_map"));
+          const auto uiState = uiServer ? uiServer->getState() : state;
+          auto& ldr = filmPtr->updateLdrImage(filmSteps, uiState.exposure, uiState.gamma);
+          toneMapTimer.stop();
+          trace_utils::Tracepoint::end(&hostTraceChannel, "tone_map");
+
+          if (shmPreview) {
+            trace_utils::Tracepoint scopedTrace(&hostTraceChannel, "shm_publish");
+            shmPreview->publish(ldr, filmPtr->getScaledImage(), step, uiState.exposure, uiState.gamma);
+          }
+
+          if (uiServer) {
+            // Send data to update the remote UI:
+            {
+              trace_utils::Tracepoint scopedTrace(&hostTraceChannel, "ui_submit_video");
+              uiServer->updateFilm(filmPtr->getScaledImage(), renderInput, regionInput);
+              uiServer->sendPreviewImage(ldr, renderInput, uiState.toneInput, regionInput);
+            }
+            trace_utils::Tracepoint scopedTrace(&hostTraceChannel, "ui_send_events");
+            uiServer->updateProgress(step, steps);
+          }
         }
-        pvti::Tracepoint scopedTrace(&hostTraceChannel, "ui_send_events");
-        uiServer->updateProgress(step, steps);
-      }
 
-      if (loadBalanceEnabled && step > 1) {
-        pvti::Tracepoint scopedTrace(&hostTraceChannel, "run_load_balancing");
-        workPtr->allocateWorkByPathLength(ipuJobs);
-      }
+        if (workTrace) {
+          trace_utils::Tracepoint scopedTrace(&hostTraceChannel, "record_work_trace");
+          workTrace->writePathLengths(step, workPtr->getWork().inactive());
+        }
 
-      pvti::Tracepoint::begin(&hostTraceChannel, "clear_accumulators");
-      totalRays = workPtr->clearInactiveAccumulators();
-      pvti::Tracepoint::end(&hostTraceChannel, "clear_accumulators");
+        if (!tileCycles.empty()) {
+          // Must run before load balancing reorders the traced work list:
+          trace_utils::Tracepoint scopedTrace(&hostTraceChannel, "report_tile_cycles");
+          tileCycleRecords.push_back(reportTileCycles(step, tileCycles, workPtr->getWork().inactive()));
+        }
+      });
 
       // If there is a UI server we do not save
       // images as we go (only on the final step):
       if (step % saveInterval == 0 || step == steps) {
+        const auto filmSteps = std::max<std::size_t>(1, filmPtr->getStepCount());
         if (uiServer) {
           // If there is a UI server we start transmitting full
           // uncompressed image data at the save interval.
-          uiServer->startSendingRawImage(filmPtr->getHdrImage(), step);
+          uiServer->startSendingRawImage(filmPtr->getScaledImage(), 1);
         } else {
-          pvti::Tracepoint scopedTrace(&hostTraceChannel, "save_images");
-          filmPtr->saveImages(fileName, step, state.exposure, state.gamma);
+          trace_utils::Tracepoint scopedTrace(&hostTraceChannel, "save_images");
+          MetricTimer timer(metrics.saveSeconds);
+          filmPtr->saveImages(fileName, filmSteps, state.exposure, state.gamma);
           ipu_utils::logger()->info("Saved images at step {}", step);
         }
       }
     });
 
-    pvti::Tracepoint::begin(&traceChannel, "log_stats");
+    trace_utils::Tracepoint::begin(&traceChannel, "log_stats");
     auto loopEndTime = std::chrono::steady_clock::now();
     auto secs = std::chrono::duration<double>(loopEndTime - loopStartTime).count();
-    const auto pixelSamplesPerStep = imageWidth * imageHeight * samplesPerIpuStep;
-    auto sampleRate = pixelSamplesPerStep / secs;
+    auto sampleRate = recordStepMetrics(secs, imageWidth * imageHeight * samplesPerIpuStep, totalRays);
     auto rayRate = totalRays / secs;
     ipu_utils::logger()->info("Completed render step {}/{} in {} seconds (Samples/sec {}) (Rays/sec {})",
                               step, steps, secs, sampleRate, rayRate);
@@ -772,12 +1155,13 @@ void PathTracerApp::execute(poplar::Engine& engine, const poplar::Device& device
 
     if (uiServer) {
       uiServer->updateSampleRate(sampleRate, rayRate);
+      uiServer->updateEncoderStats();
     }
-    pvti::Tracepoint::end(&traceChannel, "log_stats");
+    trace_utils::Tracepoint::end(&traceChannel, "log_stats");
   }
 
   hostProcessing.waitForCompletion();
-  pvti::Tracepoint::end(&traceChannel, "rendering");
+  trace_utils::Tracepoint::end(&traceChannel, "rendering");
 
   auto endTime = std::chrono::steady_clock::now();
   const auto elapsedSecs = std::chrono::duration<double>(endTime - startTime).count();
@@ -789,6 +1173,420 @@ void PathTracerApp::execute(poplar::Engine& engine, const poplar::Device& device
   const double samplesPerSecPerTile = samplesPerSec / numTiles;
   ipu_utils::logger()->info("Samples/sec: {}", samplesPerSec);
   ipu_utils::logger()->info("Samples/sec/tile: {}", samplesPerSecPerTile);
+
+  if (!tileCycleRecords.empty()) {
+    saveTileCycleReport(tileCycleRecords, numTiles, args.at("tile-cycle-prefix").as<std::string>() + ".json");
+  }
+
+  // The regression checks are made once the profile is complete (see checkForRegressions()):
+  meanStepCycles = cycleTotals;
+  for (auto& c : meanStepCycles) {
+    c.second /= cycleSteps;
+  }
+}
+
+void PathTracerApp::executeSessions(poplar::Engine& engine, const poplar::Device& device) {
+  trace_utils::Tracepoint::begin(&traceChannel, "initialisation");
+
+  auto imageWidth = args.at("width").as<std::uint32_t>();
+  auto imageHeight = args.at("height").as<std::uint32_t>() * numViews; // Views are stacked vertically.
+  auto samplesPerPixel = args.at("samples").as<std::uint32_t>();
+  const auto baseSeed = args.at("seed").as<std::uint64_t>();
+  auto antiAliasingScale = args.at("aa-noise-scale").as<float>();
+  auto loadBalanceEnabled = args.at("enable-load-balancing").as<bool>();
+  auto balancePolicy = createBalancePolicy(args.at("load-balance-policy").as<std::string>());
+  auto saveInterval = args.at("save-interval").as<std::uint32_t>();
+  samplesPerPixel = roundSamplesPerPixel(samplesPerPixel, samplesPerIpuStep);
+  const auto steps = samplesPerPixel / samplesPerIpuStep;
+
+  // Variables connected to the render settings streams. These are updated
+  // from the scheduled session's settings whenever the session changes:
+  std::uint64_t seed = baseSeed;
+  std::uint16_t aaScaleHalf;
+  poplar::copyFloatToDeviceHalf(device.getTarget(), &antiAliasingScale, &aaScaleHalf, 1);
+  seedTensor.connectWriteStream(engine, &seed);
+  aaScaleTensor.connectWriteStream(engine, &aaScaleHalf);
+  fovTensor.connectWriteStream(engine, viewFovHalf);
+  azimuthRotation.connectWriteStream(engine, viewRadians);
+  deviceSampleLimit.connectWriteStream(engine, &samplesPerIpuStep);
+  connectCycleStreams(engine);
+  const double clockHz = device.getTarget().getTileClockFrequency();
+
+  const auto& progs = getPrograms();
+  uploadNifWeights(engine);
+
+  // Every session keeps its own work lists and film resident:
+  struct Session {
+    SessionSettings settings;
+    std::unique_ptr<PathTracerState> state;
+    std::unique_ptr<SharedMemoryPreview> preview;
+    std::size_t step = 0;
+  };
+  SessionSettings defaults;
+  defaults.fovDegrees = args.at("fov").as<float>();
+  defaults.envRotationDegrees = args.at("env-map-rotation").as<float>();
+  defaults.exposure = args.at("exposure").as<float>();
+  defaults.gamma = args.at("gamma").as<float>();
+
+  auto jobs = createTracingJobs(imageWidth, imageHeight, device.getTarget().getNumTiles(), device.getTarget().getNumWorkerContexts());
+  std::vector<Session> sessions;
+  SessionScheduler scheduler;
+  for (const auto& description : args.at("session").as<std::vector<std::string>>()) {
+    Session s;
+    defaults.name = "session" + std::to_string(sessions.size());
+    defaults.outfile.clear();
+    s.settings = parseSessionSettings(description, defaults);
+    if (s.settings.outfile.empty()) {
+      s.settings.outfile = s.settings.name + "_" + args.at("outfile").as<std::string>();
+    }
+    s.state.reset(new PathTracerState(imageWidth, imageHeight, jobs, numViews));
+    if (!s.settings.shmPreview.empty()) {
+      s.preview.reset(new SharedMemoryPreview(s.settings.shmPreview, imageWidth, imageHeight,
+                                              args.at("shm-preview-slots").as<std::uint32_t>()));
+    }
+    scheduler.add(s.settings.weight);
+    ipu_utils::logger()->info("Render session '{}': weight {} fov {} env-map-rotation {} output '{}'",
+                              s.settings.name, s.settings.weight, s.settings.fovDegrees,
+                              s.settings.envRotationDegrees, s.settings.outfile);
+    sessions.push_back(std::move(s));
+  }
+
+  auto metricsPort = args.at("metrics-port").as<int>();
+  if (metricsPort) {
+    metricsServer.start(metricsPort);
+  }
+
+  AsyncTask hostProcessing;
+
+  trace_utils::Tracepoint::end(&traceChannel, "initialisation");
+  trace_utils::Tracepoint::begin(&traceChannel, "rendering");
+  ipu_utils::logger()->info("Render started: {} sessions", sessions.size());
+  auto startTime = std::chrono::steady_clock::now();
+
+  std::size_t totalRays = 0;
+  std::size_t lastSession = sessions.size();
+  while (!scheduler.empty()) {
+    auto loopStartTime = std::chrono::steady_clock::now();
+    const auto id = scheduler.next();
+    auto& session = sessions[id];
+    session.step += 1;
+    const auto step = session.step;
+
+    if (id != lastSession) {
+      // Switch sessions: upload the session's settings. The seed is reset by
+      // the upload so it is made unique to the session and step (otherwise a
+      // session would repeat its samples every time it is switched back in):
+      trace_utils::Tracepoint scopedTrace(&traceChannel, "switch_session");
+      const auto& s = session.settings;
+      updateViewSettings(device.getTarget(), s.fovDegrees * (M_PI / 180.f), s.envRotationDegrees);
+      seed = baseSeed + (std::uint64_t(id) << 32) + step;
+      progs.run(engine, "init_render_settings");
+      lastSession = id;
+    }
+    connectWorkListStreams(engine, *session.state);
+
+    trace_utils::Tracepoint::begin(&traceChannel, "ipu_render");
+    runRenderStep(engine, clockHz, session.state->work.getWork().active().size() * sizeof(TraceRecord));
+    trace_utils::Tracepoint::end(&traceChannel, "ipu_render");
+
+    trace_utils::Tracepoint::begin(&traceChannel, "wait_for_host");
+    MetricTimer waitTimer(*metrics.hostStageSeconds.at("wait_for_host"));
+    hostProcessing.waitForCompletion();
+    waitTimer.stop();
+    trace_utils::Tracepoint::end(&traceChannel, "wait_for_host");
+
+    // The results are processed asynchronously while the IPU renders the
+    // next scheduled step (which can be for another session):
+    session.state->work.getWork().swap();
+    hostProcessing.run([&, step, sessionPtr = &session]() {
+      trace_utils::Tracepoint asyncScopedTrace(&hostTraceChannel, "async_work");
+      auto& film = sessionPtr->state->film;
+      const auto& s = sessionPtr->settings;
+
+      auto balancer = loadBalanceEnabled ? balancePolicy.get() : nullptr;
+      totalRays = processStepResults(step, sessionPtr->state->work, film, cv::Rect(), balancer, ipuJobs.size(), [&]() {
+        if (sessionPtr->preview) {
+          trace_utils::Tracepoint scopedTrace(&hostTraceChannel, "shm_publish");
+          MetricTimer timer(*metrics.hostStageSeconds.at("tone_map"));
+          auto& ldr = film.updateLdrImage(step, s.exposure, s.gamma);
+          sessionPtr->preview->publish(ldr, film.getScaledImage(), step, s.exposure, s.gamma);
+        }
+      });
+
+      if (step % saveInterval == 0 || step == steps) {
+        trace_utils::Tracepoint scopedTrace(&hostTraceChannel, "save_images");
+        MetricTimer timer(metrics.saveSeconds);
+        film.saveImages(s.outfile, step, s.exposure, s.gamma);
+        ipu_utils::logger()->info("Session '{}': saved images at step {}", s.name, step);
+      }
+    });
+
+    if (step == steps) {
+      scheduler.finish(id);
+    }
+
+    auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - loopStartTime).count();
+    auto sampleRate = recordStepMetrics(secs, imageWidth * imageHeight * samplesPerIpuStep, totalRays);
+    ipu_utils::logger()->info("Session '{}': completed render step {}/{} in {} seconds (Samples/sec {}) (Rays/sec {})",
+                              session.settings.name, step, steps, secs, sampleRate, totalRays / secs);
+  }
+
+  hostProcessing.waitForCompletion();
+  trace_utils::Tracepoint::end(&traceChannel, "rendering");
+
+  const auto elapsedSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  const double samplesPerSec = (double(imageWidth) * imageHeight * samplesPerPixel * sessions.size()) / elapsedSecs;
+  ipu_utils::logger()->info("Render finished: {} sessions in {} seconds", sessions.size(), elapsedSecs);
+  ipu_utils::logger()->info("Samples/sec (all sessions): {}", samplesPerSec);
+}
+
+void PathTracerApp::executePartitions(poplar::Engine& engine, const poplar::Device& device) {
+  trace_utils::Tracepoint::begin(&traceChannel, "initialisation");
+
+  auto imageWidth = args.at("width").as<std::uint32_t>();
+  auto imageHeight = args.at("height").as<std::uint32_t>() * numViews; // Views are stacked vertically.
+  auto samplesPerPixel = args.at("samples").as<std::uint32_t>();
+  auto seed = args.at("seed").as<std::uint64_t>();
+  auto antiAliasingScale = args.at("aa-noise-scale").as<float>();
+  auto loadBalanceEnabled = args.at("enable-load-balancing").as<bool>();
+  auto saveInterval = args.at("save-interval").as<std::uint32_t>();
+  samplesPerPixel = roundSamplesPerPixel(samplesPerPixel, samplesPerIpuStep);
+  const auto steps = samplesPerPixel / samplesPerIpuStep;
+  const auto tilesPerPartition = device.getTarget().getNumTiles() / numPartitions;
+
+  // Every partition is an independent job with its own settings (given in
+  // the same format as --session), work lists, film and host thread. Each
+  // needs its own balance policy as policies reuse scratch buffers:
+  struct Partition {
+    SessionSettings settings;
+    std::unique_ptr<PathTracerState> state;
+    std::unique_ptr<SharedMemoryPreview> preview;
+    std::unique_ptr<BalancePolicy> balancePolicy;
+    std::unique_ptr<AsyncTask> hostProcessing;
+    std::size_t rays = 0;
+  };
+  SessionSettings defaults;
+  defaults.fovDegrees = args.at("fov").as<float>();
+  defaults.envRotationDegrees = args.at("env-map-rotation").as<float>();
+  defaults.exposure = args.at("exposure").as<float>();
+  defaults.gamma = args.at("gamma").as<float>();
+  std::vector<std::string> descriptions(numPartitions);
+  if (args.count("partition")) {
+    descriptions = args.at("partition").as<std::vector<std::string>>();
+  }
+
+  auto jobs = createTracingJobs(imageWidth, imageHeight, tilesPerPartition, device.getTarget().getNumWorkerContexts());
+  std::vector<Partition> partitions(numPartitions);
+  for (auto p = 0u; p < numPartitions; ++p) {
+    auto& part = partitions[p];
+    defaults.name = "part" + std::to_string(p);
+    defaults.outfile.clear();
+    part.settings = parseSessionSettings(descriptions[p], defaults);
+    if (part.settings.outfile.empty()) {
+      part.settings.outfile = part.settings.name + "_" + args.at("outfile").as<std::string>();
+    }
+    part.state.reset(new PathTracerState(imageWidth, imageHeight, jobs, numViews));
+    if (!part.settings.shmPreview.empty()) {
+      part.preview.reset(new SharedMemoryPreview(part.settings.shmPreview, imageWidth, imageHeight,
+                                                 args.at("shm-preview-slots").as<std::uint32_t>()));
+    }
+    part.balancePolicy = createBalancePolicy(args.at("load-balance-policy").as<std::string>());
+    part.hostProcessing.reset(new AsyncTask());
+    updateViewSettings(device.getTarget(), part.settings.fovDegrees * (M_PI / 180.f),
+                       part.settings.envRotationDegrees, p);
+    connectWorkListStreams(engine, *part.state, p);
+    ipu_utils::logger()->info("Partition '{}': tiles [{}, {}) fov {} env-map-rotation {} output '{}'",
+                              part.settings.name, p * tilesPerPartition, (p + 1) * tilesPerPartition,
+                              part.settings.fovDegrees, part.settings.envRotationDegrees, part.settings.outfile);
+  }
+
+  std::uint16_t aaScaleHalf;
+  poplar::copyFloatToDeviceHalf(device.getTarget(), &antiAliasingScale, &aaScaleHalf, 1);
+  seedTensor.connectWriteStream(engine, &seed);
+  aaScaleTensor.connectWriteStream(engine, &aaScaleHalf);
+  fovTensor.connectWriteStream(engine, viewFovHalf);
+  azimuthRotation.connectWriteStream(engine, viewRadians);
+  deviceSampleLimit.connectWriteStream(engine, &samplesPerIpuStep);
+  connectCycleStreams(engine);
+  const double clockHz = device.getTarget().getTileClockFrequency();
+
+  const auto& progs = getPrograms();
+  uploadNifWeights(engine);
+  progs.run(engine, "init_render_settings");
+
+  auto metricsPort = args.at("metrics-port").as<int>();
+  if (metricsPort) {
+    metricsServer.start(metricsPort);
+  }
+
+  trace_utils::Tracepoint::end(&traceChannel, "initialisation");
+  trace_utils::Tracepoint::begin(&traceChannel, "rendering");
+  ipu_utils::logger()->info("Render started: {} partitions of {} tiles", numPartitions, tilesPerPartition);
+  auto startTime = std::chrono::steady_clock::now();
+
+  for (auto step = 1u; step <= steps; ++step) {
+    auto loopStartTime = std::chrono::steady_clock::now();
+
+    // All partitions are in the same programs so they step together:
+    trace_utils::Tracepoint::begin(&traceChannel, "ipu_render");
+    runRenderStep(engine, clockHz,
+                  partitions.front().state->work.getWork().active().size() * sizeof(TraceRecord) * numPartitions);
+    trace_utils::Tracepoint::end(&traceChannel, "ipu_render");
+
+    // Each partition's results are processed on its own thread while the
+    // IPUs render the next step:
+    std::size_t totalRays = 0;
+    for (auto p = 0u; p < numPartitions; ++p) {
+      auto& part = partitions[p];
+      {
+        trace_utils::Tracepoint scopedTrace(&traceChannel, "wait_for_host");
+        MetricTimer waitTimer(*metrics.hostStageSeconds.at("wait_for_host"));
+        part.hostProcessing->waitForCompletion();
+      }
+      totalRays += part.rays;
+      part.state->work.getWork().swap();
+      connectWorkListStreams(engine, *part.state, p);
+
+      part.hostProcessing->run([&, step, partPtr = &part]() {
+        trace_utils::Tracepoint asyncScopedTrace(&hostTraceChannel, "async_work");
+        auto& film = partPtr->state->film;
+        const auto& s = partPtr->settings;
+
+        auto balancer = loadBalanceEnabled ? partPtr->balancePolicy.get() : nullptr;
+        partPtr->rays = processStepResults(step, partPtr->state->work, film, cv::Rect(), balancer, tilesPerPartition, [&]() {
+          if (partPtr->preview) {
+            trace_utils::Tracepoint scopedTrace(&hostTraceChannel, "shm_publish");
+            MetricTimer timer(*metrics.hostStageSeconds.at("tone_map"));
+            auto& ldr = film.updateLdrImage(step, s.exposure, s.gamma);
+            partPtr->preview->publish(ldr, film.getScaledImage(), step, s.exposure, s.gamma);
+          }
+        });
+
+        if (step % saveInterval == 0 || step == steps) {
+          trace_utils::Tracepoint scopedTrace(&hostTraceChannel, "save_images");
+          MetricTimer timer(metrics.saveSeconds);
+          film.saveImages(s.outfile, step, s.exposure, s.gamma);
+          ipu_utils::logger()->info("Partition '{}': saved images at step {}", s.name, step);
+        }
+      });
+    }
+
+    auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - loopStartTime).count();
+    auto sampleRate = recordStepMetrics(secs, imageWidth * imageHeight * samplesPerIpuStep * numPartitions, totalRays);
+    ipu_utils::logger()->info("Completed render step {}/{} in {} seconds (Samples/sec {}) (Rays/sec {})",
+                              step, steps, secs, sampleRate, totalRays / secs);
+  }
+
+  for (auto& part : partitions) {
+    part.hostProcessing->waitForCompletion();
+  }
+  trace_utils::Tracepoint::end(&traceChannel, "rendering");
+
+  const auto elapsedSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  const double samplesPerSec = (double(imageWidth) * imageHeight * samplesPerPixel * numPartitions) / elapsedSecs;
+  ipu_utils::logger()->info("Render finished: {} partitions in {} seconds", numPartitions, elapsedSecs);
+  ipu_utils::logger()->info("Samples/sec (all partitions): {}", samplesPerSec);
+}
+
+bool PathTracerApp::checkForRegressions(const CycleCounts& computeSetCycles) {
+  bool pass = true;
+
+  const auto goldenFile = args.at("golden-image").as<std::string>();
+  if (!goldenFile.empty() && renderStates) {
+    // Normalise as the saved images are (by the number of full-frame passes):
+    const auto tolerance = args.at("golden-tolerance").as<double>();
+    const auto& film = renderStates->current().film;
+    cv::Mat hdr = film.getHdrImage() * (1.f / std::max<std::size_t>(1, film.getStepCount()));
+    const auto error = compareToGoldenImage(hdr, goldenFile);
+    if (error > tolerance) {
+      ipu_utils::logger()->error("Image differs from golden image '{}': relative RMS error {} > {}", goldenFile, error, tolerance);
+      pass = false;
+    } else {
+      ipu_utils::logger()->info("Image matches golden image '{}': relative RMS error {} <= {}", goldenFile, error, tolerance);
+    }
+  }
+
+  const auto baselineFile = args.at("cycle-baseline").as<std::string>();
+  if (!baselineFile.empty() && !meanStepCycles.empty()) {
+    auto cycles = meanStepCycles;
+    cycles.insert(computeSetCycles.begin(), computeSetCycles.end());
+    if (args.at("record-baseline").as<bool>()) {
+      saveCycleBaseline(cycles, baselineFile);
+    } else {
+      pass &= checkCycleBaseline(cycles, loadCycleBaseline(baselineFile), args.at("cycle-tolerance").as<double>());
+    }
+  }
+
+  return pass;
+}
+
+void PathTracerApp::traceDevicePhases(double startUs, std::size_t iterations, double clockHz,
+                                      std::int64_t nifCycles, std::int64_t pathTraceCycles, std::int64_t totalCycles) {
+  auto& chromeTrace = trace_utils::ChromeTrace::instance();
+  if (!chromeTrace.enabled()) {
+    return;
+  }
+
+  // Only durations are measured on the device: the program is assumed to
+  // start when the host launched it and the iterations run back to back.
+  // The path tracing and NIF phases interleave in every iteration so each
+  // is shown as its total over all iterations on a track of its own (they
+  // do not run in the order or at the times shown). The iteration count
+  // is in the event arguments:
+  constexpr int programTid = 1;
+  constexpr int pathTraceTid = 2;
+  constexpr int nifTid = 3;
+  chromeTrace.nameTrack(trace_utils::ChromeTrace::DEVICE, programTid, "path_trace program");
+  chromeTrace.nameTrack(trace_utils::ChromeTrace::DEVICE, pathTraceTid, "path_trace compute set (total)");
+  chromeTrace.nameTrack(trace_utils::ChromeTrace::DEVICE, nifTid, "nif (total)");
+  const double usPerCycle = 1e6 / clockHz;
+  const double programUs = iterations * totalCycles * usPerCycle;
+  const double pathTraceUs = iterations * pathTraceCycles * usPerCycle;
+  const double nifUs = iterations * nifCycles * usPerCycle;
+  const auto eventArgs = fmt::format("{{\"iterations\":{},\"iteration_cycles\":{},\"path_trace_cycles\":{},\"nif_cycles\":{}}}",
+                                     iterations, totalCycles, pathTraceCycles, nifCycles);
+  const auto phaseArgs = fmt::format("{{\"iterations\":{}}}", iterations);
+  chromeTrace.complete(trace_utils::ChromeTrace::DEVICE, programTid, "device", "path_trace", startUs, programUs, eventArgs);
+  chromeTrace.complete(trace_utils::ChromeTrace::DEVICE, pathTraceTid, "device", "path_trace_cs_total", startUs, pathTraceUs, phaseArgs);
+  chromeTrace.complete(trace_utils::ChromeTrace::DEVICE, nifTid, "device", "nif_total", startUs, nifUs, phaseArgs);
+}
+
+TileCycleRecord PathTracerApp::reportTileCycles(std::size_t step, const std::vector<std::uint32_t>& workerCycles,
+                                                const RecordList& tracedWork) {
+  const auto prefix = args.at("tile-cycle-prefix").as<std::string>();
+  const auto numTiles = ipuJobs.size();
+  const auto numWorkers = workerCycles.size() / (2 * numTiles);
+  const std::string names[] = {"path_trace", "accumulate"};
+
+  TileCycleRecord record{step, {}};
+  std::vector<std::vector<std::uint32_t>> perComputeSet;
+  for (auto c = 0u; c < std::size(names); ++c) {
+    auto tileCycles = maxOverWorkers(workerCycles.data() + c * numTiles * numWorkers, numTiles, numWorkers);
+    const auto s = summariseTileCycles(tileCycles);
+    metrics.tileCycleImbalance.at(names[c])->set(s.imbalance);
+    ipu_utils::logger()->info("Tile cycles '{}' at step {}: max {} (tile {}) mean {} min {} imbalance (max/mean) {:.3f}",
+                              names[c], step, s.max, s.maxTile, s.mean, s.min, s.imbalance);
+    cv::imwrite(prefix + "_" + names[c] + "_" + std::to_string(step) + ".png", renderTileHeatmap(tileCycles));
+    record.computeSets[names[c]] = s;
+    perComputeSet.push_back(std::move(tileCycles));
+  }
+
+  if (workTrace) {
+    // The traced list holds the work in tile order:
+    const auto recordsPerTile = tracedWork.size() / numTiles;
+    std::vector<work_trace::TileWork> tiles(numTiles);
+    for (auto t = 0u; t < numTiles; ++t) {
+      tiles[t].load = 0;
+      for (auto i = t * recordsPerTile; i < (t + 1) * recordsPerTile; ++i) {
+        tiles[t].load += tracedWork[i].pathLength;
+      }
+      tiles[t].pathTraceCycles = perComputeSet[0][t];
+      tiles[t].accumulateCycles = perComputeSet[1][t];
+    }
+    workTrace->writeTileWork(step, tiles);
+  }
+
+  return record;
 }
 
 void PathTracerApp::addToolOptions(boost::program_options::options_description& desc) {
@@ -814,6 +1612,8 @@ void PathTracerApp::addToolOptions(boost::program_options::options_description&
   "Choose distribution for anti-aliasing noise ['uniform', 'normal', 'truncated-normal'].")
   ("codelet-path", po::value<std::string>()->default_value("./"), "Path to ray tracing codelets.")
   ("enable-load-balancing", po::bool_switch()->default_value(false), "Run dynamic load balancing algorithm for path tracing.")
+  ("load-balance-policy", po::value<std::string>()->default_value("pairing"),
+    "Load balancing policy ['pairing', 'lpt', 'kk', 'incremental']. The predicted max/mean tile load is logged every step.")
   ("max-path-length", po::value<std::uint32_t>()->default_value(10))
   // Neural Environment-map Model Options:
   ("assets", po::value<std::string>()->required(),
@@ -825,6 +1625,77 @@ void PathTracerApp::addToolOptions(boost::program_options::options_description&
   ("max-nif-batch-size", po::value<std::size_t>()->default_value(30 * 1472),
     "Maximum batch-size for the NIF neural network. If the required batch is larger than this "
     "the batch will be serialised so that this value is not exceeded.")
+  ("golden-image", po::value<std::string>()->default_value(""),
+    "Compare the final HDR image against this golden image (e.g. an EXR from a previous run) and fail if it differs.")
+  ("golden-tolerance", po::value<double>()->default_value(0.01),
+    "Maximum relative RMS error allowed when comparing against the golden image.")
+  ("cycle-baseline", po::value<std::string>()->default_value(""),
+    "JSON file of mean device cycles per step. Fail if any cycle count increases by more than the cycle tolerance.")
+  ("cycle-tolerance", po::value<double>()->default_value(0.01),
+    "Maximum fractional increase in cycles allowed relative to the cycle baseline.")
+  ("record-baseline", po::bool_switch()->default_value(false),
+    "Write the measured cycle counts to the cycle-baseline file instead of comparing against it.")
+  ("chrome-trace", po::value<std::string>()->default_value(""),
+    "Also record the host tracepoints and the device phases (reconstructed from cycle counts) "
+    "into this Chrome trace event file (JSON) which can be viewed in chrome://tracing or Perfetto.")
+  ("metrics-port", po::value<int>()->default_value(0),
+    "Serve render telemetry in the Prometheus text format at http://localhost:<port>/metrics (0 disables).")
+  ("tile-cycle-interval", po::value<std::uint32_t>()->default_value(0),
+    "Read back per-tile cycle counts for the path-trace and accumulate compute sets every N steps (0 disables). "
+    "Counts are from the last iteration of the step.")
+  ("tile-cycle-prefix", po::value<std::string>()->default_value("tile_cycles"),
+    "File name prefix for the per-tile cycle heatmaps (<prefix>_<compute-set>_<step>.png) and summary (<prefix>.json).")
+  ("record-work-trace", po::value<std::string>()->default_value(""),
+    "Record the path length of every pixel in every step (and per-tile loads and cycles when --tile-cycle-interval "
+    "is set) to this binary file for offline load balancing experiments with lb_simulator.")
   ("ui-port", po::value<int>()->default_value(0), "Start a remote user-interface server on the specified port.")
+  ("shm-preview", po::value<std::string>()->default_value(""),
+    "Publish the latest LDR and HDR preview frames into a POSIX shared memory ring with this name (e.g. '/ipu_trace_preview').")
+  ("shm-preview-slots", po::value<std::uint32_t>()->default_value(3), "Number of frame slots in the shared memory preview ring.")
+  ("ui-record", po::value<std::string>()->default_value(""),
+    "Record the inputs received from the remote user-interface (with timestamps) to this file. "
+    "The session can be replayed with src/tools/ui_replay.")
+  ("ui-max-clients", po::value<std::uint32_t>()->default_value(1),
+    "Maximum number of remote user-interface clients. The first client to connect has control, the others can only view the render.")
+  ("preview-min-change", po::value<float>()->default_value(0.f),
+    "Drop preview frames in which less than this fraction of the image changed since the last frame sent (0 sends every frame).")
+  ("preview-max-skip", po::value<std::uint32_t>()->default_value(30),
+    "Maximum number of consecutive preview frames that can be dropped when preview-min-change is set.")
+  ("views", po::value<std::uint32_t>()->default_value(1),
+    "Number of views rendered together in every device step (e.g. 2 for a stereo pair). Views are stacked vertically "
+    "in the preview and saved to separate files ('<outfile>_view<i>'). Each view is --height pixels high.")
+  ("view-fov", po::value<std::vector<float>>()->multitoken(),
+    "Field of view (degrees) of each view. If not set every view uses --fov (or the remote UI's field of view).")
+  ("view-env-map-rotation", po::value<std::vector<float>>()->multitoken(),
+    "Environment map rotation (degrees) of each view, added to --env-map-rotation (default 0 for every view).")
+  ("session", po::value<std::vector<std::string>>(),
+    "Add an independent render session, e.g. 'name=left,weight=2,fov=60,env-map-rotation=45,outfile=left.png' "
+    "(other keys: exposure, gamma, shm-preview). Repeat to render several sessions time-sliced on one device: each "
+    "session keeps its own work lists and film and device steps are shared in proportion to the session weights. "
+    "Unset values are taken from the other options and the output defaults to '<name>_<outfile>'. Can not be "
+    "combined with --ui-port, --golden-image, --cycle-baseline, --tile-cycle-interval or --record-work-trace.")
+  ("broadcast-nif-weights", po::value<bool>()->default_value(true),
+    "Stream the NIF weights from the host to one IPU (per partition) and copy them to the other IPUs over IPU-links. "
+    "If false the weights are streamed to every IPU. Changes the graph so must match a saved executable.")
+  ("partitions", po::value<std::uint32_t>()->default_value(1),
+    "Split the IPUs into this many partitions that each render an independent image with their own NIF, work lists, "
+    "film and host processing thread. Partitions are whole IPUs so --ipus must be a multiple of the count. All "
+    "partitions share --width, --height, --samples and --samples-per-step so they render the same number of steps. "
+    "Can not be combined with --session, --ui-port, --golden-image, --cycle-baseline, --tile-cycle-interval or "
+    "--record-work-trace.")
+  ("partition", po::value<std::vector<std::string>>(),
+    "Settings of each partition in the same format as --session except that a weight can not be set. Output "
+    "defaults to 'part<i>_<outfile>'.")
+  ("partition-assets", po::value<std::vector<std::string>>()->multitoken(),
+    "NIF asset path of each partition (default --assets for every partition). The NIFs must have the same "
+    "architecture if an executable is saved and loaded for them.")
+  ("host-huge-pages", po::value<bool>()->default_value(true),
+    "Back large host buffers connected to device streams (work lists, NIF weights and results) with 2 MB huge pages. "
+    "Falls back to transparent huge pages if none are reserved (see /proc/sys/vm/nr_hugepages).")
+  ("lock-host-buffers", po::bool_switch()->default_value(false),
+    "Lock large stream buffers into physical memory (requires a sufficient 'ulimit -l').")
+  ("host-numa-node", po::value<int>()->default_value(-1),
+    "Bind large stream buffers to this NUMA node, i.e. the one local to the IPU's PCIe root "
+    "(see /sys/bus/pci/devices/<device>/numa_node). -1 disables binding. Nodes above 63 are not supported.")
   ;
 }
@@ -3,6 +3,7 @@
 #pragma once
 
 #include <chrono>
+#include <functional>
 #include <limits>
 #include <memory>
 #include <numeric>
@@ -16,19 +17,39 @@
 #include "InterfaceServer.hpp"
 #include "IpuPathTraceJob.hpp"
 #include "LoadBalancer.hpp"
+#include "MetricsServer.hpp"
+#include "RenderState.hpp"
+#include "TileCycleStats.hpp"
+#include "regression_utils.hpp"
+#include "trace_utils.hpp"
+#include "work_trace.hpp"
 
 #include <pvti/pvti.hpp>
 
 // fwd declarations:
 struct TraceRecord;
 
-struct PathTracerState {
-  PathTracerState(std::uint32_t imageWidth, std::uint32_t imageHeight)
-      : work(imageWidth * imageHeight),
-        film(imageWidth, imageHeight) {}
-
-  LoadBalancer work;
-  AccumulatedImage film;
+/// Render telemetry that can be scraped from the metrics server (see --metrics-port):
+struct RenderMetrics {
+  RenderMetrics(MetricsServer& server);
+
+  MetricGauge& samplesPerSec;
+  MetricGauge& raysPerSec;
+  MetricCounter& steps;
+  MetricCounter& samples;
+  MetricHistogram& stepSeconds;
+  std::map<std::string, MetricGauge*> deviceCycles;       // Keyed by program.
+  std::map<std::string, MetricHistogram*> hostStageSeconds; // Keyed by host processing stage.
+  MetricGauge& worklistImbalance;
+  MetricGauge& predictedImbalance;
+  std::map<std::string, MetricGauge*> tileCycleImbalance; // Keyed by compute set.
+  MetricCounter& bytesToDevice;
+  MetricCounter& bytesFromDevice;
+  std::map<std::string, MetricHistogram*> transferSeconds; // Keyed by direction.
+  MetricHistogram& nifSwapSeconds;
+  MetricHistogram& nifUploadSeconds;
+  MetricHistogram& saveSeconds;
+  MetricHistogram& resetSeconds;
 };
 
 /// This is the main application object. It implements the BuilderInterface
@@ -37,7 +58,7 @@ struct PathTracerApp : public ipu_utils::BuilderInterface {
   /// Constructor does nothing of note, conforming to Poplar
   /// explorer tool interface (see init() instead).
   PathTracerApp();
-  virtual ~PathTracerApp() {}
+  virtual ~PathTracerApp();
 
   /// Performs all initialisation that doesn't require a graph (and all
   /// init required on execeutable load):
@@ -56,19 +77,77 @@ struct PathTracerApp : public ipu_utils::BuilderInterface {
   /// Add options specifically for the path tracer:
   void addToolOptions(boost::program_options::options_description& desc);
 
+  /// Check the final image and the device cycle counts of the render
+  /// against golden results (if requested). This is called after the run
+  /// so that the per compute set cycles from the profile summary can be
+  /// checked with the cycles of each program (pass an empty set if no
+  /// profile was captured). Returns false if any check fails.
+  bool checkForRegressions(const CycleCounts& computeSetCycles);
+
 private:
   // Create a tensor for the UV neural environment map inputs:
   poplar::Tensor createNifInput(poplar::Graph& g, std::size_t numJobsInBatch, std::size_t pixelsPerJob);
 
-  bool loadNifModels(std::size_t numIpus, const std::string& assetPath);
+  /// Load a NIF for every IPU. The IPUs are divided evenly between the
+  /// asset paths (one path per partition, see --partitions):
+  bool loadNifModels(std::size_t numIpus, const std::vector<std::string>& assetPaths);
   void connectNifStreams(poplar::Engine& engine);
 
-  std::pair<poplar::program::Sequence, poplar::program::Sequence>
+  /// Connect the NIF streams and run init_nif_weights (timed):
+  void uploadNifWeights(poplar::Engine& engine);
+
+  /// True if the NIF on this IPU has its weights streamed from the host
+  /// (otherwise they are copied from the first IPU of its partition, see
+  /// --broadcast-nif-weights):
+  bool isNifWeightSource(std::size_t ipu) const;
+
+  poplar::program::Sequence
   buildEnvironmentNif(poplar::Graph& g, std::unique_ptr<NifModel>& model, poplar::Tensor input, poplar::Tensor& result);
 
   void initialiseState(std::uint32_t imageWidth, std::uint32_t imageHeight, poplar::Engine& engine, const poplar::Target& target);
-  void defunctState(std::uint32_t imageWidth, std::uint32_t imageHeight, poplar::Engine& engine);
+  void defunctState(poplar::Engine& engine);
   void connectActiveWorkListStreams(poplar::Engine& engine);
+  void connectWorkListStreams(poplar::Engine& engine, PathTracerState& state, std::size_t partition = 0);
+
+  /// Update the values streamed by init_render_settings for every view
+  /// of a partition from the partition's FOV and env-map rotation:
+  void updateViewSettings(const poplar::Target& target, float fovRadians, float envRotationDegrees,
+                          std::size_t partition = 0);
+
+  /// Device cycle counts of the last iteration of a step (read back with
+  /// the results once connectCycleStreams() has been called):
+  struct StepCycles {
+    std::int64_t nif = 0;
+    std::int64_t pathTrace = 0;
+    std::int64_t iteration = 0;
+  };
+  void connectCycleStreams(poplar::Engine& engine);
+
+  /// Run one render step on the device (setup, path_trace, read_results)
+  /// and record its transfer and cycle metrics and device phases. Every
+  /// render mode steps through this so they are instrumented alike:
+  void runRenderStep(poplar::Engine& engine, double clockHz, std::size_t workListBytes);
+
+  /// Process the work list traced in a step on the host (from the async
+  /// host task of every render mode): accumulate it into the film, call
+  /// publish (the film is up to date and the list is still in tile order),
+  /// load balance it if a policy is given, then clear it. Returns the
+  /// number of rays traced:
+  std::size_t processStepResults(std::size_t step, LoadBalancer& work, AccumulatedImage& film,
+                                 const cv::Rect& region, BalancePolicy* policy, std::size_t numTiles,
+                                 const std::function<void()>& publish);
+
+  /// Record the rate metrics of a completed step. Returns the samples/sec:
+  double recordStepMetrics(double secs, std::size_t pixelSamples, std::size_t rays);
+
+  /// Render several independent sessions (see --session) time-sliced by
+  /// steps on the loaded engine:
+  void executeSessions(poplar::Engine& engine, const poplar::Device& device);
+
+  /// Render an independent job on each partition of the tiles (see
+  /// --partitions). Partitions step together on the device but each has
+  /// its own host processing thread:
+  void executePartitions(poplar::Engine& engine, const poplar::Device& device);
 
   struct ReplicatedNifs {
     poplar::Tensor result;
@@ -91,6 +170,20 @@ private:
   void initialiseWorkList(std::vector<TraceRecord>& workList);
   std::vector<TraceRecord> loadBalanceWorkList(const std::vector<TraceRecord>& workList);
 
+  /// Add the device phases of one render step to the Chrome trace (the whole
+  /// program, and the path tracing and NIF totals over all iterations on
+  /// tracks of their own). The phases are reconstructed from the cycle
+  /// counts of the last iteration:
+  void traceDevicePhases(double startUs, std::size_t iterations, double clockHz,
+                         std::int64_t nifCycles, std::int64_t pathTraceCycles, std::int64_t totalCycles);
+
+  /// Log statistics and save heatmaps of the per-tile cycle counts
+  /// read back from the device (also recorded in the work trace if enabled).
+  /// This writes files so is called from the async host task with the work
+  /// list that was traced in the step (before it is load balanced):
+  TileCycleRecord reportTileCycles(std::size_t step, const std::vector<std::uint32_t>& workerCycles,
+                                   const RecordList& tracedWork);
+
   InterfaceServer::Status
   processUserInput(InterfaceServer::State& state,
                    std::uint32_t imageWidth,
@@ -99,6 +192,7 @@ private:
                    const ipu_utils::ProgramManager& progs);
 
   pvti::TraceChannel traceChannel = {"ipu_path_tracer"};
+  pvti::TraceChannel hostTraceChannel = {"host_processing"};
   boost::program_options::variables_map args;
   std::uint32_t samplesPerPixel;
   std::uint32_t samplesPerIpuStep;
@@ -112,11 +206,32 @@ private:
   ipu_utils::StreamableTensor nifCycleCount;
   ipu_utils::StreamableTensor pathTraceCycleCount;
   ipu_utils::StreamableTensor iterationCycles;
-  ipu_utils::StreamableTensor traceBuffer;
+  ipu_utils::StreamableTensor tileCycleCounts;
+  std::vector<ipu_utils::StreamableTensor> traceBuffers; // One per partition.
+  StepCycles stepCycles;
+
+  // Partitioning (see --partitions): each partition is a whole number of
+  // IPUs that renders its own image with its own NIF:
+  std::size_t numPartitions;
+  std::size_t ipusPerPartition;
+
+  // Multi-view rendering (see --views): views are stacked vertically in
+  // one frame. These are the per-view settings and the values streamed
+  // to the per-view FOV and environment rotation tensors (the streamed
+  // values are stored partition major):
+  std::size_t numViews;
+  std::vector<float> viewFovDegrees;     // Empty if every view uses the global FOV.
+  std::vector<float> viewAzimuthDegrees; // Added to the env-map rotation.
+  std::vector<std::uint16_t> viewFovHalf;
+  std::vector<float> viewRadians;
 
   poplin::matmul::PlanningCache cache;
   std::vector<std::unique_ptr<NifModel>> models;
 
-  std::unique_ptr<PathTracerState> traceState;
-  std::unique_ptr<PathTracerState> defunctTraceState;
+  std::unique_ptr<RenderStateArena> renderStates;
+
+  MetricsServer metricsServer;
+  RenderMetrics metrics;
+  std::unique_ptr<work_trace::Writer> workTrace;
+  CycleCounts meanStepCycles; // Mean device cycles per step of the render (keyed by program).
 };
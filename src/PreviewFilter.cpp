@@ -0,0 +1,104 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "PreviewFilter.hpp"
+
+#include "logging.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+PreviewFilter::PreviewFilter(float minChangeFraction,
+                             std::uint32_t maxSkippedFrames,
+                             int block,
+                             int pixelThreshold)
+    : minChange(minChangeFraction),
+      maxSkipped(maxSkippedFrames),
+      blockSize(block),
+      threshold(pixelThreshold),
+      skipped(0),
+      sent(0),
+      dropped(0) {}
+
+void PreviewFilter::reset() {
+  lastSent.release();
+  skipped = 0;
+}
+
+PreviewFilter::Result PreviewFilter::update(const cv::Mat& ldrImage, bool force) {
+  if (ldrImage.type() != CV_8UC3) {
+    throw std::logic_error("PreviewFilter only supports 8-bit 3 channel images.");
+  }
+
+  // Always send the first frame or any frame whose size changed:
+  if (lastSent.empty() || lastSent.size() != ldrImage.size()) {
+    ldrImage.copyTo(lastSent);
+    skipped = 0;
+    sent += 1;
+    return Result{true, cv::Rect(0, 0, ldrImage.cols, ldrImage.rows), 1.f};
+  }
+
+  float changedFraction = 0.f;
+  auto dirty = findDirtyRegion(ldrImage, changedFraction);
+
+  const bool changed = dirty.area() > 0 && changedFraction > minChange;
+  if (changed || force || skipped >= maxSkipped) {
+    // Only the dirty region differs from the last sent frame so only that needs updating:
+    ldrImage(dirty).copyTo(lastSent(dirty));
+    skipped = 0;
+    sent += 1;
+    return Result{true, dirty, changedFraction};
+  }
+
+  skipped += 1;
+  dropped += 1;
+  ipu_utils::logger()->trace("Preview frame dropped (changed fraction: {})", changedFraction);
+  return Result{false, dirty, changedFraction};
+}
+
+/// Compare the image in blocks against the last sent frame and
+/// return the bounding box of all blocks that changed:
+cv::Rect PreviewFilter::findDirtyRegion(const cv::Mat& ldrImage, float& changedFraction) const {
+  const int blockRows = (ldrImage.rows + blockSize - 1) / blockSize;
+  const int blockCols = (ldrImage.cols + blockSize - 1) / blockSize;
+  std::vector<std::uint8_t> blockChanged(blockRows * blockCols, 0);
+
+  #pragma omp parallel for schedule(auto)
+  for (auto br = 0; br < blockRows; ++br) {
+    const int rowEnd = std::min((br + 1) * blockSize, ldrImage.rows);
+    for (auto r = br * blockSize; r < rowEnd; ++r) {
+      auto newPtr = ldrImage.ptr<std::uint8_t>(r);
+      auto oldPtr = lastSent.ptr<std::uint8_t>(r);
+      for (auto c = 0; c < 3 * ldrImage.cols; ++c) {
+        if (std::abs(int(newPtr[c]) - int(oldPtr[c])) > threshold) {
+          blockChanged[br * blockCols + (c / 3) / blockSize] = 1;
+        }
+      }
+    }
+  }
+
+  // Bounding box of changed blocks:
+  int minRow = blockRows, maxRow = -1;
+  int minCol = blockCols, maxCol = -1;
+  std::size_t count = 0;
+  for (auto br = 0; br < blockRows; ++br) {
+    for (auto bc = 0; bc < blockCols; ++bc) {
+      if (blockChanged[br * blockCols + bc]) {
+        minRow = std::min(minRow, br);
+        maxRow = std::max(maxRow, br);
+        minCol = std::min(minCol, bc);
+        maxCol = std::max(maxCol, bc);
+        count += 1;
+      }
+    }
+  }
+
+  changedFraction = count / float(blockChanged.size());
+  if (count == 0) {
+    return cv::Rect();
+  }
+
+  cv::Rect dirty(minCol * blockSize, minRow * blockSize,
+                 (maxCol - minCol + 1) * blockSize, (maxRow - minRow + 1) * blockSize);
+  return dirty & cv::Rect(0, 0, ldrImage.cols, ldrImage.rows);
+}
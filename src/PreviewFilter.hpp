@@ -0,0 +1,53 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+
+/// Detects which regions of the tone-mapped preview have changed since
+/// the last frame that was sent to the video encoder. Late in a render
+/// very little visibly changes between steps so frames whose change is
+/// below a threshold can be dropped, reducing the effective frame rate
+/// (and so encode cost and link bandwidth) as the render converges.
+class PreviewFilter {
+public:
+  struct Result {
+    bool send;              // True if this frame should be encoded and sent.
+    cv::Rect dirty;         // Bounding box of the changed blocks (empty if none changed).
+    float changedFraction;  // Fraction of blocks that changed.
+  };
+
+  /// A frame is sent if more than minChangeFraction of the image blocks changed
+  /// or if maxSkippedFrames consecutive frames have already been dropped. A block
+  /// is considered changed if any of its 8-bit channel values differ by more than
+  /// pixelThreshold from the last frame that was sent.
+  PreviewFilter(float minChangeFraction,
+                std::uint32_t maxSkippedFrames,
+                int blockSize = 16,
+                int pixelThreshold = 2);
+  virtual ~PreviewFilter() {}
+
+  /// Compare the new frame against the last one sent and decide whether to send it.
+  /// If force is true the frame is always sent (e.g. it shows a new user input).
+  Result update(const cv::Mat& ldrImage, bool force = false);
+
+  /// Forget the last sent frame so that the next frame is always sent.
+  void reset();
+
+  std::uint64_t getSentCount() const { return sent; }
+  std::uint64_t getDroppedCount() const { return dropped; }
+
+private:
+  cv::Rect findDirtyRegion(const cv::Mat& ldrImage, float& changedFraction) const;
+
+  const float minChange;
+  const std::uint32_t maxSkipped;
+  const int blockSize;
+  const int threshold;
+  std::uint32_t skipped;
+  std::uint64_t sent;
+  std::uint64_t dropped;
+  cv::Mat lastSent;
+};
@@ -0,0 +1,122 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "ProfileSummary.hpp"
+
+#include "logging.hpp"
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <pva/pva.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+
+std::string computeSetCategory(const std::string& name) {
+  for (auto c : {"ray_gen", "pre_process_escaped_rays", "path_trace", "apply_env_lighting", "accumulate_lighting"}) {
+    if (name.find(c) != std::string::npos) {
+      return c;
+    }
+  }
+
+  // NIF layers are named '<model>/layer_<i>_<op>' (see NifModel::buildInference):
+  if (name.find("fourier_features") != std::string::npos) {
+    return "nif/fourier_features";
+  }
+  const std::string layer = "/layer_";
+  const auto l = name.find(layer);
+  if (l != std::string::npos) {
+    const auto end = name.find('_', l + layer.size());
+    return "nif" + name.substr(l, end - l);
+  }
+
+  return "other";
+}
+
+ProfileSummary summariseProfile(const std::string& reportFile) {
+  pva::Report report = pva::openReport(reportFile);
+  ProfileSummary s;
+
+  // Memory per tile:
+  const auto tiles = report.compilation().tiles();
+  s.numTiles = tiles.size();
+  s.minTileMemory = s.numTiles ? std::numeric_limits<std::uint64_t>::max() : 0;
+  for (auto t = 0u; t < tiles.size(); ++t) {
+    const std::uint64_t bytes = tiles[t].memory().total().includingGaps();
+    s.totalMemory += bytes;
+    s.minTileMemory = std::min(s.minTileMemory, bytes);
+    if (bytes > s.maxTileMemory) {
+      s.maxTileMemory = bytes;
+      s.maxMemoryTile = t;
+    }
+  }
+  s.meanTileMemory = s.numTiles ? s.totalMemory / double(s.numTiles) : 0.0;
+
+  // Cycles per compute set (IPUs execute in parallel so
+  // each step takes as long as the slowest IPU):
+  for (const auto& step : report.execution().steps()) {
+    const auto program = step.program();
+    if (program->type() != pva::Program::Type::OnTileExecute) {
+      continue;
+    }
+    std::uint64_t cycles = 0;
+    for (const auto& ipu : step.ipus()) {
+      cycles = std::max<std::uint64_t>(cycles, ipu.cycles());
+    }
+    auto& cs = s.computeSets[computeSetCategory(program->name())];
+    cs.cycles += cycles;
+    cs.executions += 1;
+    s.totalCycles += cycles;
+  }
+
+  return s;
+}
+
+std::string formatProfileSummary(const ProfileSummary& s) {
+  auto table = fmt::format("Memory: {} tiles, max {} bytes (tile {}), mean {:.0f}, min {}, total {}\n",
+                           s.numTiles, s.maxTileMemory, s.maxMemoryTile, s.meanTileMemory, s.minTileMemory, s.totalMemory);
+  table += fmt::format("{:<28}{:>16}{:>12}{:>10}\n", "compute sets", "cycles", "executions", "%");
+  for (const auto& cs : s.computeSets) {
+    const double percent = s.totalCycles ? 100.0 * cs.second.cycles / s.totalCycles : 0.0;
+    table += fmt::format("{:<28}{:>16}{:>12}{:>10.2f}\n", cs.first, cs.second.cycles, cs.second.executions, percent);
+  }
+  table += fmt::format("{:<28}{:>16}\n", "total", s.totalCycles);
+  return table;
+}
+
+void saveProfileSummary(const ProfileSummary& s, const std::string& fileName) {
+  boost::property_tree::ptree memory;
+  memory.put("tiles", s.numTiles);
+  memory.put("max", s.maxTileMemory);
+  memory.put("max_tile", s.maxMemoryTile);
+  memory.put("mean", s.meanTileMemory);
+  memory.put("min", s.minTileMemory);
+  memory.put("total", s.totalMemory);
+
+  boost::property_tree::ptree computeSets;
+  for (const auto& cs : s.computeSets) {
+    boost::property_tree::ptree p;
+    p.put("cycles", cs.second.cycles);
+    p.put("executions", cs.second.executions);
+    // Categories contain '/' so use a path separator that can not appear in them:
+    computeSets.add_child(boost::property_tree::ptree::path_type(cs.first, '|'), p);
+  }
+
+  boost::property_tree::ptree root;
+  root.add_child("memory", memory);
+  root.add_child("compute_sets", computeSets);
+  root.put("total_cycles", s.totalCycles);
+  std::ofstream fs(fileName);
+  boost::property_tree::write_json(fs, root);
+  ipu_utils::logger()->info("Saved profile summary to '{}'", fileName);
+}
+
+CycleCounts computeSetCycleCounts(const ProfileSummary& s) {
+  CycleCounts cycles;
+  for (const auto& cs : s.computeSets) {
+    if (cs.second.executions) {
+      cycles["compute_set/" + cs.first] = double(cs.second.cycles) / cs.second.executions;
+    }
+  }
+  return cycles;
+}
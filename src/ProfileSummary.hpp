@@ -0,0 +1,51 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include "regression_utils.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+/// Utilities for summarising the PopVision report captured with the
+/// --profile option so that changes in memory use or compute set
+/// cycles can be spotted in a log without opening the GUI.
+
+/// Cycles spent in all compute sets that belong to one category:
+struct ComputeSetCycles {
+  std::uint64_t cycles = 0;
+  std::size_t executions = 0;
+};
+
+struct ProfileSummary {
+  std::size_t numTiles = 0;
+  std::uint64_t maxTileMemory = 0; // Bytes including gaps.
+  std::size_t maxMemoryTile = 0;
+  double meanTileMemory = 0.0;
+  std::uint64_t minTileMemory = 0;
+  std::uint64_t totalMemory = 0;
+  std::uint64_t totalCycles = 0; // Cycles of every compute set that was executed.
+  std::map<std::string, ComputeSetCycles> computeSets; // Keyed by category.
+};
+
+/// Map a compute set name onto one of the categories used in the summary:
+/// the path tracing stages (ray_gen, path_trace, pre_process_escaped_rays,
+/// apply_env_lighting, accumulate_lighting), the NIF layers (e.g. nif/layer_0),
+/// or 'other'.
+std::string computeSetCategory(const std::string& name);
+
+/// Read a report (profile.pop) with libpva. Execution cycles are only
+/// available if the program ran while the profile was captured.
+ProfileSummary summariseProfile(const std::string& reportFile);
+
+/// Format the summary as a text table:
+std::string formatProfileSummary(const ProfileSummary& summary);
+
+void saveProfileSummary(const ProfileSummary& summary, const std::string& fileName);
+
+/// Mean cycles per execution of each category of compute sets, keyed by
+/// 'compute_set/<category>', so that they can be checked against a cycle
+/// baseline (see regression_utils.hpp):
+CycleCounts computeSetCycleCounts(const ProfileSummary& summary);
@@ -0,0 +1,35 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "RenderState.hpp"
+
+#include "codelets/TraceRecord.hpp"
+
+PathTracerState::PathTracerState(std::uint32_t imageWidth, std::uint32_t imageHeight,
+                                 const std::vector<RecordList>& jobs, std::size_t views)
+    : PathTracerState(imageWidth, imageHeight, views) {
+  work.randomiseWorkList(jobs);
+  work.getWork().active() = work.getWork().inactive();
+}
+
+RenderStateArena::RenderStateArena(std::uint32_t imageWidth, std::uint32_t imageHeight,
+                                   const std::vector<RecordList>& jobs, std::size_t views)
+    : currentIndex(0), currentGeneration(0) {
+  for (auto& s : states) {
+    s.reset(new PathTracerState(imageWidth, imageHeight, jobs, views));
+  }
+}
+
+RenderStateArena::~RenderStateArena() {}
+
+void RenderStateArena::restart() {
+  auto& defunct = current();
+  currentIndex = 1 - currentIndex;
+  auto& next = current();
+
+  // Every buffer always holds a complete work list with cleared accumulators
+  // (the async task clears the inactive list after processing it) so the new
+  // state can keep its old inactive list:
+  next.work.getWork().swapActive(defunct.work.getWork());
+  next.film.reset();
+  currentGeneration += 1;
+}
@@ -0,0 +1,61 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include "AccumulatedImage.hpp"
+#include "LoadBalancer.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+/// The image height is the height of the whole frame (views are stacked
+/// vertically, see AccumulatedImage):
+struct PathTracerState {
+  PathTracerState(std::uint32_t imageWidth, std::uint32_t imageHeight, std::size_t views = 1)
+      : work(imageWidth * imageHeight),
+        film(imageWidth, imageHeight, views) {}
+
+  /// Fill both work lists from the per-tile jobs (see createTracingJobs)
+  /// in a random order:
+  PathTracerState(std::uint32_t imageWidth, std::uint32_t imageHeight, const std::vector<RecordList>& jobs,
+                  std::size_t views = 1);
+
+  LoadBalancer work;
+  AccumulatedImage film;
+};
+
+/// User interaction invalidates all in progress rendering work but we
+/// don't want to wait for the defunct work to complete before new work
+/// starts. This holds two render states that are allocated up front: the
+/// current one and the one made defunct by the last restart (which async
+/// host processing may still be using). A restart only swaps which state
+/// is current and increments the generation: no large buffers are
+/// allocated or copied on the render thread.
+class RenderStateArena {
+public:
+  /// Allocate both states and fill their work lists from the per-tile jobs
+  /// (see createTracingJobs) in a random order:
+  RenderStateArena(std::uint32_t imageWidth, std::uint32_t imageHeight, const std::vector<RecordList>& jobs,
+                   std::size_t views = 1);
+  virtual ~RenderStateArena();
+
+  PathTracerState& current() { return *states[currentIndex]; }
+
+  /// Incremented by every restart (safe to read from any thread) so that
+  /// results from a defunct state can be recognised:
+  std::uint64_t generation() const { return currentGeneration; }
+
+  /// Make the other state current. The work list the current state was
+  /// about to trace is handed over (buffers are swapped, not copied) and
+  /// the new state's film is reset. The old state's inactive work list and
+  /// film are not touched so async processing of them can complete, but
+  /// it must have completed before the next restart.
+  void restart();
+
+private:
+  std::array<std::unique_ptr<PathTracerState>, 2> states;
+  std::size_t currentIndex;
+  std::atomic<std::uint64_t> currentGeneration;
+};
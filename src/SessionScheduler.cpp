@@ -0,0 +1,113 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "SessionScheduler.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+float parseFloat(const std::string& key, const std::string& value) {
+  try {
+    std::size_t end = 0;
+    auto f = std::stof(value, &end);
+    if (end == value.size()) {
+      return f;
+    }
+  } catch (const std::exception&) {
+  }
+  throw std::invalid_argument("Bad value for session setting '" + key + "': '" + value + "'");
+}
+
+} // end anonymous namespace
+
+SessionSettings parseSessionSettings(const std::string& description, const SessionSettings& defaults) {
+  SessionSettings s = defaults;
+  std::istringstream ss(description);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (item.empty()) {
+      continue;
+    }
+    const auto eq = item.find('=');
+    if (eq == std::string::npos) {
+      throw std::invalid_argument("Expected key=value in session description: '" + item + "'");
+    }
+    const auto key = item.substr(0, eq);
+    const auto value = item.substr(eq + 1);
+    if (key == "name") {
+      s.name = value;
+    } else if (key == "weight") {
+      s.weight = parseFloat(key, value);
+    } else if (key == "fov") {
+      s.fovDegrees = parseFloat(key, value);
+    } else if (key == "env-map-rotation") {
+      s.envRotationDegrees = parseFloat(key, value);
+    } else if (key == "exposure") {
+      s.exposure = parseFloat(key, value);
+    } else if (key == "gamma") {
+      s.gamma = parseFloat(key, value);
+    } else if (key == "outfile") {
+      s.outfile = value;
+    } else if (key == "shm-preview") {
+      s.shmPreview = value;
+    } else {
+      throw std::invalid_argument("Unknown session setting: '" + key + "'");
+    }
+  }
+  if (!(s.weight > 0.0)) {
+    throw std::invalid_argument("Session weight must be positive: '" + description + "'");
+  }
+  return s;
+}
+
+SessionScheduler::SessionScheduler() : activeCount(0) {}
+
+SessionScheduler::~SessionScheduler() {}
+
+std::size_t SessionScheduler::add(double weight) {
+  if (!(weight > 0.0)) {
+    throw std::invalid_argument("Session weight must be positive.");
+  }
+
+  // Start at the earliest virtual time of the active sessions so that a
+  // new session can not claim the steps it missed:
+  double start = 0.0;
+  if (activeCount) {
+    start = std::numeric_limits<double>::max();
+    for (const auto& e : sessions) {
+      if (e.active) {
+        start = std::min(start, e.virtualTime);
+      }
+    }
+  }
+  sessions.push_back(Entry{weight, start, 0, true});
+  activeCount += 1;
+  return sessions.size() - 1;
+}
+
+void SessionScheduler::finish(std::size_t session) {
+  auto& e = sessions.at(session);
+  if (e.active) {
+    e.active = false;
+    activeCount -= 1;
+  }
+}
+
+std::size_t SessionScheduler::next() {
+  if (empty()) {
+    throw std::logic_error("No render sessions left to schedule.");
+  }
+  std::size_t chosen = sessions.size();
+  for (auto i = 0u; i < sessions.size(); ++i) {
+    if (sessions[i].active && (chosen == sessions.size() || sessions[i].virtualTime < sessions[chosen].virtualTime)) {
+      chosen = i;
+    }
+  }
+  auto& e = sessions[chosen];
+  e.virtualTime += 1.0 / e.weight;
+  e.steps += 1;
+  return chosen;
+}
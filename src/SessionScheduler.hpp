@@ -0,0 +1,66 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/// Settings of one render session (see --session). Anything not set in the
+/// session's description is taken from the command line options.
+struct SessionSettings {
+  std::string name;
+  double weight = 1.0;
+  float fovDegrees = 90.f;
+  float envRotationDegrees = 0.f;
+  float exposure = 0.f;
+  float gamma = 2.2f;
+  std::string outfile;
+  std::string shmPreview;  // Empty if the session does not publish previews.
+};
+
+/// Parse a comma separated list of key=value pairs, e.g.
+/// "name=left,weight=2,fov=60,env-map-rotation=45,outfile=left.png".
+/// Keys are: name, weight, fov, env-map-rotation, exposure, gamma, outfile
+/// and shm-preview. Throws std::invalid_argument for unknown keys or bad
+/// values.
+SessionSettings parseSessionSettings(const std::string& description, const SessionSettings& defaults);
+
+/// Weighted fair scheduling of render sessions onto device steps (stride
+/// scheduling): each session has a virtual time that advances by 1/weight
+/// every step it is given and the session with the earliest virtual time
+/// is scheduled next (ties go to the session added first). Over any
+/// interval each active session gets a share of the steps proportional
+/// to its weight, within one step.
+class SessionScheduler {
+public:
+  SessionScheduler();
+  virtual ~SessionScheduler();
+
+  /// Add a session and return its index. Throws std::invalid_argument if
+  /// the weight is not positive:
+  std::size_t add(double weight);
+
+  /// The session will not be scheduled again:
+  void finish(std::size_t session);
+
+  /// True if all sessions have finished:
+  bool empty() const { return activeCount == 0; }
+
+  /// Choose the session that renders the next step. Throws
+  /// std::logic_error if all sessions have finished:
+  std::size_t next();
+
+  /// Number of steps given to a session so far:
+  std::size_t steps(std::size_t session) const { return sessions.at(session).steps; }
+
+private:
+  struct Entry {
+    double weight;
+    double virtualTime;
+    std::size_t steps;
+    bool active;
+  };
+  std::vector<Entry> sessions;
+  std::size_t activeCount;
+};
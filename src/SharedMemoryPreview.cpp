@@ -0,0 +1,103 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "SharedMemoryPreview.hpp"
+
+#include "ipu_utils.hpp"
+
+#include <ctime>
+#include <new>
+
+SharedMemoryPreview::SharedMemoryPreview(const std::string& shmName, std::uint32_t width, std::uint32_t height, std::uint32_t slots)
+    : name(shmName), size(0), base(nullptr), frames(0) {
+  if (slots < 2) {
+    throw std::logic_error("Shared memory preview needs at least 2 slots.");
+  }
+
+  const auto ldrOffset = shmPreviewAlign(sizeof(ShmPreviewSlot));
+  const auto hdrOffset = ldrOffset + shmPreviewAlign(shmPreviewLdrBytes(width, height));
+  const auto slotBytes = hdrOffset + shmPreviewAlign(shmPreviewHdrBytes(width, height));
+  size = sizeof(ShmPreviewHeader) + slots * slotBytes;
+
+  // Remove any stale object left behind by a previous run so readers
+  // never see a mixture of old and new layouts:
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("Could not create shared memory '" + name + "': " + std::strerror(errno));
+  }
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    shm_unlink(name.c_str());
+    throw std::runtime_error("Could not size shared memory '" + name + "': " + std::strerror(errno));
+  }
+  base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    shm_unlink(name.c_str());
+    throw std::runtime_error("Could not map shared memory '" + name + "': " + std::strerror(errno));
+  }
+
+  // ftruncate zero fills so only non-zero fields need setting. The magic
+  // number is written last so readers never see a partial header:
+  auto header = new (base) ShmPreviewHeader;
+  header->version = shmPreviewVersion;
+  header->width = width;
+  header->height = height;
+  header->slotCount = slots;
+  header->slotBytes = slotBytes;
+  header->ldrOffset = ldrOffset;
+  header->hdrOffset = hdrOffset;
+  header->latest.store(0, std::memory_order_relaxed);
+  for (auto s = 0u; s < slots; ++s) {
+    auto slot = new (static_cast<std::uint8_t*>(base) + sizeof(ShmPreviewHeader) + s * slotBytes) ShmPreviewSlot;
+    slot->sequence.store(0, std::memory_order_relaxed);
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = shmPreviewMagic;
+
+  ipu_utils::logger()->info("Publishing previews to shared memory '{}' ({} slots, {} MiB)",
+                            name, slots, size / (1024.f * 1024.f));
+}
+
+SharedMemoryPreview::~SharedMemoryPreview() {
+  munmap(base, size);
+  shm_unlink(name.c_str());
+}
+
+void SharedMemoryPreview::publish(const cv::Mat& ldrImage, const cv::Mat& hdrImage,
+                                  std::size_t step, float exposure, float gamma) {
+  auto header = static_cast<ShmPreviewHeader*>(base);
+  const int w = header->width;
+  const int h = header->height;
+  if (ldrImage.cols != w || ldrImage.rows != h || ldrImage.type() != CV_8UC3 ||
+      hdrImage.cols != w || hdrImage.rows != h || hdrImage.type() != CV_32FC3) {
+    throw std::logic_error("Preview images do not match the shared memory layout.");
+  }
+
+  const auto frame = frames + 1;
+  auto slotPtr = static_cast<std::uint8_t*>(base) + sizeof(ShmPreviewHeader) + (frame % header->slotCount) * header->slotBytes;
+  auto slot = reinterpret_cast<ShmPreviewSlot*>(slotPtr);
+
+  // Mark the slot as being written:
+  const auto sequence = slot->sequence.load(std::memory_order_relaxed);
+  slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  slot->frame = frame;
+  slot->step = step;
+  slot->timestampNs = std::int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+  slot->exposure = exposure;
+  slot->gamma = gamma;
+
+  // Copy straight into shared memory:
+  cv::Mat ldr(h, w, CV_8UC3, slotPtr + header->ldrOffset);
+  cv::Mat hdr(h, w, CV_32FC3, slotPtr + header->hdrOffset);
+  ldrImage.copyTo(ldr);
+  hdrImage.copyTo(hdr);
+
+  slot->sequence.store(sequence + 2, std::memory_order_release);
+  header->latest.store(frame, std::memory_order_release);
+  frames = frame;
+}
@@ -0,0 +1,33 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include "shm_preview.hpp"
+
+#include <opencv2/core.hpp>
+
+#include <string>
+
+/// Publishes the latest LDR and HDR preview frames into a POSIX shared
+/// memory ring (layout described in shm_preview.hpp) so that tools on the
+/// same host can read them without any video encoding or network transfer.
+class SharedMemoryPreview {
+public:
+  /// Create (or replace) the named shared memory object. The name must
+  /// start with a '/' (e.g. "/ipu_trace_preview").
+  SharedMemoryPreview(const std::string& name, std::uint32_t width, std::uint32_t height, std::uint32_t slots = 3);
+  virtual ~SharedMemoryPreview();
+
+  /// Write a new frame into the next slot. The HDR image must already be
+  /// normalised by the sample count (i.e. the image that was tone-mapped).
+  void publish(const cv::Mat& ldrImage, const cv::Mat& hdrImage,
+               std::size_t step, float exposure, float gamma);
+
+  std::uint64_t getFramesPublished() const { return frames; }
+
+private:
+  std::string name;
+  std::size_t size;
+  void* base;
+  std::uint64_t frames;
+};
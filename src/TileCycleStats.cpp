@@ -0,0 +1,113 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "TileCycleStats.hpp"
+
+#include "logging.hpp"
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+std::vector<std::uint32_t> maxOverWorkers(const std::uint32_t* workerCycles,
+                                          std::size_t numTiles, std::size_t numWorkers) {
+  std::vector<std::uint32_t> tileCycles(numTiles);
+  for (auto t = 0u; t < numTiles; ++t) {
+    auto first = workerCycles + t * numWorkers;
+    tileCycles[t] = *std::max_element(first, first + numWorkers);
+  }
+  return tileCycles;
+}
+
+TileCycleSummary summariseTileCycles(const std::vector<std::uint32_t>& tileCycles) {
+  TileCycleSummary s;
+  if (tileCycles.empty()) {
+    return s;
+  }
+  auto minMax = std::minmax_element(tileCycles.begin(), tileCycles.end());
+  double sum = 0.0;
+  for (auto c : tileCycles) {
+    sum += c;
+  }
+  s.min = *minMax.first;
+  s.max = *minMax.second;
+  s.maxTile = std::distance(tileCycles.begin(), minMax.second);
+  s.mean = sum / tileCycles.size();
+  s.imbalance = s.max / std::max(s.mean, 1.0);
+  return s;
+}
+
+cv::Mat renderTileHeatmap(const std::vector<std::uint32_t>& tileCycles, std::size_t cellSize) {
+  const std::size_t tilesPerRow = std::ceil(std::sqrt(double(tileCycles.size())));
+  const std::size_t rows = (tileCycles.size() + tilesPerRow - 1) / tilesPerRow;
+
+  const auto summary = summariseTileCycles(tileCycles);
+  const double range = std::max(summary.max - summary.min, 1.0);
+
+  cv::Mat grey(rows, tilesPerRow, CV_8UC1, cv::Scalar(0));
+  for (auto t = 0u; t < tileCycles.size(); ++t) {
+    grey.at<std::uint8_t>(t / tilesPerRow, t % tilesPerRow) = std::round(255.0 * (tileCycles[t] - summary.min) / range);
+  }
+
+  cv::Mat heatmap;
+  cv::applyColorMap(grey, heatmap, cv::COLORMAP_INFERNO);
+
+  // Unused cells in the last row are left black:
+  for (auto t = tileCycles.size(); t < rows * tilesPerRow; ++t) {
+    heatmap.at<cv::Vec3b>(t / tilesPerRow, t % tilesPerRow) = cv::Vec3b(0, 0, 0);
+  }
+
+  cv::resize(heatmap, heatmap, cv::Size(), cellSize, cellSize, cv::INTER_NEAREST);
+  return heatmap;
+}
+
+boost::property_tree::ptree toPtree(const TileCycleSummary& s) {
+  boost::property_tree::ptree p;
+  p.put("max", s.max);
+  p.put("mean", s.mean);
+  p.put("min", s.min);
+  p.put("max_tile", s.maxTile);
+  p.put("imbalance", s.imbalance);
+  return p;
+}
+
+void saveTileCycleReport(const std::vector<TileCycleRecord>& records, std::size_t numTiles,
+                         const std::string& fileName) {
+  boost::property_tree::ptree readings;
+  std::map<std::string, TileCycleSummary> totals;
+  for (const auto& r : records) {
+    boost::property_tree::ptree reading;
+    reading.put("step", r.step);
+    for (const auto& cs : r.computeSets) {
+      reading.add_child(cs.first, toPtree(cs.second));
+      auto& t = totals[cs.first];
+      t.max += cs.second.max;
+      t.mean += cs.second.mean;
+      t.min += cs.second.min;
+      t.imbalance += cs.second.imbalance;
+    }
+    readings.push_back(std::make_pair("", reading));
+  }
+
+  // The slowest tile changes between readings so it is omitted from the means:
+  boost::property_tree::ptree means;
+  for (auto& t : totals) {
+    auto p = toPtree(t.second);
+    p.erase("max_tile");
+    for (auto& v : p) {
+      v.second.put_value(v.second.get_value<double>() / records.size());
+    }
+    means.add_child(t.first, p);
+  }
+
+  boost::property_tree::ptree root;
+  root.put("tiles", numTiles);
+  root.add_child("mean", means);
+  root.add_child("readings", readings);
+  std::ofstream fs(fileName);
+  boost::property_tree::write_json(fs, root);
+  ipu_utils::logger()->info("Saved tile cycle report to '{}'", fileName);
+}
@@ -0,0 +1,46 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/// Utilities for analysing the per-tile cycle counts recorded by the
+/// path tracing codelets (see the --tile-cycle-interval option).
+
+/// Summary of the cycles all tiles spent in one compute set:
+struct TileCycleSummary {
+  double max = 0.0;
+  double mean = 0.0;
+  double min = 0.0;
+  std::size_t maxTile = 0; // The slowest tile.
+  double imbalance = 0.0;  // Ratio of max to mean (1 is perfectly balanced).
+};
+
+/// Summaries of each compute set from one read back of the counters:
+struct TileCycleRecord {
+  std::size_t step;
+  std::map<std::string, TileCycleSummary> computeSets;
+};
+
+/// Reduce per-worker cycle counts (stored tile major) to per-tile counts. The
+/// workers on a tile run concurrently and the compute set can not finish
+/// until every worker has finished so a tile takes as long as its slowest worker.
+std::vector<std::uint32_t> maxOverWorkers(const std::uint32_t* workerCycles,
+                                          std::size_t numTiles, std::size_t numWorkers);
+
+TileCycleSummary summariseTileCycles(const std::vector<std::uint32_t>& tileCycles);
+
+/// Render per-tile cycles as a heatmap with one square cell per tile
+/// (laid out in tile order row by row). Colours span the range from
+/// the fastest to the slowest tile.
+cv::Mat renderTileHeatmap(const std::vector<std::uint32_t>& tileCycles, std::size_t cellSize = 8);
+
+/// Save every summary and the mean of each statistic over all records as JSON:
+void saveTileCycleReport(const std::vector<TileCycleRecord>& records, std::size_t numTiles,
+                         const std::string& fileName);
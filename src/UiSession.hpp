@@ -0,0 +1,82 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// A remote-UI session is a text file with one user input per line:
+///
+///   <milliseconds> <packet-type> <value>
+///
+/// e.g. "1500 env_rotation 45.5" or "3000 load_nif /path/to/assets.extra".
+/// Times are relative to the first input. Blank lines and lines starting
+/// with '#' are ignored so sessions are easy to write by hand. Sessions
+/// are recorded by the server (--ui-record) and replayed by the headless
+/// client in src/tools/ui_replay.cpp.
+struct UiEvent {
+  double timeMs;
+  std::string type;
+  std::string value;
+};
+
+/// Appends every input accepted by the server to a session file:
+class UiSessionRecorder {
+public:
+  UiSessionRecorder(const std::string& fileName) : file(fileName), started(false) {
+    if (!file) {
+      throw std::runtime_error("Could not open UI session file: '" + fileName + "'");
+    }
+    file << "# Remote UI session recorded by ipu_trace: <milliseconds> <packet-type> <value>\n";
+  }
+
+  void record(const std::string& type, const std::string& value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto now = std::chrono::steady_clock::now();
+    if (!started) {
+      start = now;
+      started = true;
+    }
+    const auto ms = std::chrono::duration<double, std::milli>(now - start).count();
+    file << ms << " " << type << " " << value << std::endl;
+  }
+
+private:
+  std::mutex mutex;
+  std::ofstream file;
+  bool started;
+  std::chrono::steady_clock::time_point start;
+};
+
+/// Load a session, checking that inputs are in time order:
+inline std::vector<UiEvent> loadUiSession(const std::string& fileName) {
+  std::ifstream file(fileName);
+  if (!file) {
+    throw std::runtime_error("Could not open UI session file: '" + fileName + "'");
+  }
+
+  std::vector<UiEvent> events;
+  std::string line;
+  for (auto lineNumber = 1u; std::getline(file, line); ++lineNumber) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream ss(line);
+    UiEvent e;
+    if (!(ss >> e.timeMs >> e.type)) {
+      throw std::runtime_error(fileName + ":" + std::to_string(lineNumber) + ": expected '<milliseconds> <packet-type> <value>'");
+    }
+    // The value is the rest of the line (NIF paths can contain spaces):
+    std::getline(ss >> std::ws, e.value);
+    if (!events.empty() && e.timeMs < events.back().timeMs) {
+      throw std::runtime_error(fileName + ":" + std::to_string(lineNumber) + ": inputs must be in time order");
+    }
+    events.push_back(e);
+  }
+  return events;
+}
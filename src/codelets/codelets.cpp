@@ -17,8 +17,10 @@
 #include <ipu_memory_intrinsics>
 
 #define GET_TILE_ID __builtin_ipu_get_tile_id()
+#define GET_CYCLE_COUNT __builtin_ipu_get_scount_l()
 #else
 #define GET_TILE_ID 0u
+#define GET_CYCLE_COUNT 0u
 #endif // __IPU__
 
 using namespace poplar;
@@ -33,6 +35,10 @@ using Vec = light::Vector;
 /// This is a multi-vertex that decides how to distribute work
 /// over the hardware worker threads inside the compute method
 /// itself.
+///
+/// Several views can be rendered at once: they are stacked vertically
+/// in pixel coordinates (view i has rows [i * imageHeight, (i + 1) *
+/// imageHeight)) and each view has its own field of view.
 class GenerateCameraRays : public MultiVertex {
 
 public:
@@ -40,9 +46,9 @@ public:
   Output<Vector<half>> rays;
   Input<Vector<unsigned char>> traceBuffer;
   Input<unsigned> imageWidth;
-  Input<unsigned> imageHeight;
+  Input<unsigned> imageHeight; // Height of one view.
   Input<half> antiAliasScale;
-  Input<half> fov;
+  Input<Vector<half>> fov; // One per view.
 
   bool compute(unsigned workerId) {
     const auto workerCount = numWorkers();
@@ -65,12 +71,21 @@ public:
     // we simply offset the start address based on worker ID:
     auto workerPtr = traces + workerId;
     // Outer loop is parallelised over the worker threads:
-    float fovf32 = (float)*fov;
+    const unsigned viewCount = fov.size();
     for (auto k = 2 * workerId; k < rayCount; k += 2 * workerCount) {
+      // Find the view (padding records are clamped to the last view):
+      unsigned row = workerPtr->v;
+      unsigned view = 0;
+      if (viewCount > 1) {
+        view = row / imageHeight;
+        view = view < viewCount ? view : viewCount - 1;
+        row -= view * imageHeight;
+      }
+
       // Add anti-alias noise in pixel space:
       float c = workerPtr->u + (float)(*antiAliasScale * rng());
-      float r = workerPtr->v + (float)(*antiAliasScale * rng());
-      const Vec cam = light::pixelToRay(c, r, imageWidth, imageHeight, fovf32);
+      float r = row + (float)(*antiAliasScale * rng());
+      const Vec cam = light::pixelToRay(c, r, imageWidth, imageHeight, (float)fov[view]);
       rays[k]     = cam.x;
       rays[k + 1] = cam.y;
       workerPtr += workerCount;
@@ -99,8 +114,10 @@ public:
   Input<half> refractiveIndex;
   Input<half> stopProb;
   Input<unsigned short> rouletteDepth;
+  InOut<unsigned> cycles; // Tile cycles taken by this worker in the step so far (wraps at 32-bits).
 
   bool compute() {
+    const unsigned startCycles = GET_CYCLE_COUNT;
     const Vec zero(0.f, 0.f, 0.f);
     const Vec one(1.f, 1.f, 1.f);
     const auto X = Vec(1.f, 0.f, 0.f);
@@ -222,6 +239,7 @@ public:
       }
     } // end loop over camera rays
 
+    *cycles += GET_CYCLE_COUNT - startCycles;
     return true;
   }
 };
@@ -237,8 +255,10 @@ class AccumulateContributions : public Vertex {
 public:
   Vector<Input<Vector<unsigned char>>> contributionData;
   InOut<Vector<unsigned char>> traceBuffer;
+  InOut<unsigned> cycles; // Tile cycles taken by this worker in the step so far (wraps at 32-bits).
 
   bool compute() {
+    const unsigned startCycles = GET_CYCLE_COUNT;
     const Vec zero(0.f, 0.f, 0.f);
     const auto numRays = contributionData.size();
 
@@ -300,6 +320,7 @@ public:
       traces->sampleCount += 1;
     } // end loop over camera rays
 
+    *cycles += GET_CYCLE_COUNT - startCycles;
     return true;
   }
 
@@ -308,16 +329,21 @@ public:
 // This takes path trace results and calculates UV coords for all
 // the escaped rays in order to lookup lighting values from the
 // environment map. UVs are calculated using equirectangular
-// projection.
+// projection. Each view (see GenerateCameraRays) has its own
+// environment rotation.
 class PreProcessEscapedRays : public MultiVertex {
 public:
   Vector<InOut<Vector<unsigned char>>> contributionData;
-  Input<float> azimuthalOffset;
+  Input<Vector<unsigned char>> traceBuffer; // Gives the view of each ray.
+  Input<unsigned> imageHeight; // Height of one view.
+  Input<Vector<float>> azimuthalOffset; // One per view.
   Output<Vector<float>> u;
   Output<Vector<float>> v;
 
   bool compute(unsigned workerId) {
     const auto workerCount = numWorkers();
+    const TraceRecord* traces = reinterpret_cast<const TraceRecord*>(&traceBuffer[0]);
+    const unsigned viewCount = azimuthalOffset.size();
 
     // Parallelise over all workers (each worker starts at a different offset):
     for (auto r = workerId; r < contributionData.size(); r += workerCount) {
@@ -330,8 +356,13 @@ public:
         auto rayDir = c.clr;
         // Convert ray direction to UV coords using equirectangular projection.
         // Calc assumes ray-dir was already normalised (note: normalised in Ray constructor).
+        unsigned view = 0;
+        if (viewCount > 1) {
+          view = traces[r].v / imageHeight;
+          view = view < viewCount ? view : viewCount - 1;
+        }
         auto theta = acosf(rayDir.y);
-        auto phi = atan2(rayDir.z, rayDir.x) + azimuthalOffset;
+        auto phi = atan2(rayDir.z, rayDir.x) + azimuthalOffset[view];
         constexpr auto twoPi = 2.f * light::Pi;
         constexpr auto invPi = 1.f / light::Pi;
         constexpr auto inv2Pi = 1.f / twoPi;
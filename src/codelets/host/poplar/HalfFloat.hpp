@@ -0,0 +1,9 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+// Host stand-in for the IPU's native half type (see Vertex.hpp in this
+// directory). Half values are computed in single precision on host so
+// results differ slightly from the IPU, but the control flow (and so
+// the relative cost of algorithmic changes) is the same.
+using half = float;
@@ -0,0 +1,93 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+// Lightweight stand-ins for the parts of the Poplar vertex API used by
+// codelets.cpp. With this directory on the include path ahead of the
+// Poplar SDK the codelets compile as ordinary host C++ so they can be
+// driven with synthetic buffers, profiled and benchmarked natively (see
+// src/tools/codelet_benchmarks.cpp). This is not a simulation of the IPU:
+// fields are simple non-owning views of memory owned by the caller.
+
+#include <poplar/HalfFloat.hpp>
+
+#include <cstddef>
+
+namespace poplar {
+
+enum class VectorLayout {
+  ONE_PTR,
+  SPAN,
+  COMPACT_PTR,
+  SCALED_PTR32,
+  SCALED_PTR64
+};
+
+/// Non-owning view of a contiguous array (layout is ignored on host).
+template <class T, VectorLayout L = VectorLayout::SPAN>
+class Vector {
+public:
+  Vector() : ptr(nullptr), count(0) {}
+
+  /// Point the view at memory owned by the caller:
+  void reset(T* data, std::size_t size) {
+    ptr = data;
+    count = size;
+  }
+
+  std::size_t size() const { return count; }
+  T& operator[](std::size_t i) const { return ptr[i]; }
+  T* data() const { return ptr; }
+
+private:
+  T* ptr;
+  std::size_t count;
+};
+
+/// Scalar fields hold their value directly:
+template <class T>
+class Field {
+public:
+  Field() : value() {}
+  Field(const T& v) : value(v) {}
+  Field& operator=(const T& v) { value = v; return *this; }
+  operator const T&() const { return value; }
+  const T& operator*() const { return value; }
+
+protected:
+  T value;
+};
+
+template <class T> struct Input : Field<T> { using Field<T>::Field; using Field<T>::operator=; };
+template <class T> struct Output : Field<T> {
+  using Field<T>::Field;
+  using Field<T>::operator=;
+  using Field<T>::operator*;
+  T& operator*() { return this->value; }
+};
+template <class T> struct InOut : Field<T> {
+  using Field<T>::Field;
+  using Field<T>::operator=;
+  using Field<T>::operator*;
+  T& operator*() { return this->value; }
+};
+
+/// Vector fields are views:
+template <class T, VectorLayout L> struct Input<Vector<T, L>> : Vector<T, L> {};
+template <class T, VectorLayout L> struct Output<Vector<T, L>> : Vector<T, L> {};
+template <class T, VectorLayout L> struct InOut<Vector<T, L>> : Vector<T, L> {};
+
+class Vertex {
+public:
+  virtual ~Vertex() {}
+};
+
+/// Work is divided between worker contexts by the caller invoking
+/// compute(workerId) for each ID in [0, numWorkers()):
+class MultiVertex {
+public:
+  virtual ~MultiVertex() {}
+  static constexpr unsigned numWorkers() { return 6; }
+};
+
+} // end namespace poplar
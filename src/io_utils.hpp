@@ -2,51 +2,11 @@
 
 #pragma once
 
-#include <set>
-#include <vector>
-
-#include "codelets/TraceRecord.hpp"
 #include "ipu_utils.hpp"
+#include "stream_utils.hpp"
 
 #include <poputil/VarStructure.hpp>
 
-template <typename T1, typename T2>
-std::ostream& operator<<(std::ostream& s, const std::pair<T1, T2>& p) {
-  s << "(" << p.first << ", " << p.second << ")";
-  return s;
-}
-
-template <typename T>
-std::ostream& operator<<(std::ostream& s, const std::vector<T>& v) {
-  for (const auto& d : v) {
-    s << d << " ";
-  }
-  return s;
-}
-
-template <typename T>
-std::ostream& operator<<(std::ostream& s, const std::vector<std::vector<T>>& vv) {
-  for (const auto& v : vv) {
-    if (v.empty()) {
-      continue;
-    }
-    s << "[\n  ";
-    for (const auto& d : v) {
-      s << d << " ";
-    }
-    s << "\n]\n";
-  }
-  return s;
-}
-
-template <typename T>
-inline std::ostream& operator<<(std::ostream& os, const std::set<T>& s) {
-  for (auto& k : s) {
-    os << k << " ";
-  }
-  return os;
-}
-
 inline void logTensorInfo(poplar::Graph& g, poplar::Tensor t) {
   ipu_utils::logger()->info("Shape: {}", t.shape());
   ipu_utils::logger()->info("Total elements: {}", t.numElements());
@@ -61,8 +21,3 @@ inline void logTensorInfo(poplar::Graph& g, poplar::Tensor t) {
   }
   ipu_utils::logger()->info("Tiles used: {}", tilesUsed);
 }
-
-inline std::ostream& operator<<(std::ostream& s, const TraceRecord& t) {
-  s << "{ u:" << t.u << " v:" << t.v << " length:" << t.pathLength << " samples:" << t.sampleCount << " }";
-  return s;
-}
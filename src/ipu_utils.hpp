@@ -18,15 +18,10 @@
 #include <boost/property_tree/ptree.hpp>
 
 #include "logging.hpp"
+#include "trace_utils.hpp"
 
 namespace ipu_utils {
 
-/// Return the application's shared logger object.
-inline std::shared_ptr<spdlog::logger> logger() {
-  static auto logger = spdlog::stdout_logger_mt("ipu_trace_logger");
-  return spdlog::get("ipu_trace_logger");
-}
-
 inline std::string makeExeFileName(const std::string& name) {
   return name + ".poplar.exe";
 }
@@ -162,6 +157,7 @@ struct RuntimeConfig {
   bool loadExe;
   bool compileOnly;
   bool deferredAttach;
+  std::string profileDir; // Capture PopVision reports into this directory (empty disables).
 };
 
 /// Determine whether to acquire a HW device or IPU model, and number of IPUs
@@ -256,18 +252,18 @@ public:
 };
 
 /// Helper functions for device IO with std::vector and scalars.
-template <class T>
-void connectStream(poplar::Engine& e, const std::string& handle, std::vector<T>& v) {
+template <class T, class A>
+void connectStream(poplar::Engine& e, const std::string& handle, std::vector<T, A>& v) {
   e.connectStream(handle, v.data(), v.data() + v.size());
 }
 
-template <class T>
-void writeTensor(poplar::Engine& e, const std::string& handle, std::vector<T>& v) {
+template <class T, class A>
+void writeTensor(poplar::Engine& e, const std::string& handle, std::vector<T, A>& v) {
   e.writeTensor(handle, v.data(), v.data() + v.size());
 }
 
-template <class T>
-void readTensor(poplar::Engine& e, const std::string& handle, std::vector<T>& v) {
+template <class T, class A>
+void readTensor(poplar::Engine& e, const std::string& handle, std::vector<T, A>& v) {
   e.readTensor(handle, v.data(), v.data() + v.size());
 }
 
@@ -337,13 +333,13 @@ struct StreamableTensor {
     e.connectStream(getReadHandle(), data);
   }
 
-  template <class T>
-  void connectWriteStream(poplar::Engine& e, std::vector<T>& v) const {
+  template <class T, class A>
+  void connectWriteStream(poplar::Engine& e, std::vector<T, A>& v) const {
     connectStream(e, getWriteHandle(), v);
   }
 
-  template <class T>
-  void connectReadStream(poplar::Engine& e, std::vector<T>& v) const {
+  template <class T, class A>
+  void connectReadStream(poplar::Engine& e, std::vector<T, A>& v) const {
     connectStream(e, getReadHandle(), v);
   }
 
@@ -480,9 +476,19 @@ public:
       logger()->info("Creating graph with {} replicas", config.numReplicas);
       poplar::Graph graph(device->getTarget(), poplar::replication_factor(config.numReplicas));
 
+      // Options for compilation and the engine:
+      poplar::OptionFlags engineOptions;
+      if (!config.profileDir.empty()) {
+        engineOptions = getProfileOptions(config.profileDir);
+        logger()->info("Profiling enabled: reports will be written to '{}'", config.profileDir);
+        if (config.loadExe) {
+          logger()->warn("Graph is not being compiled so the report will only contain the execution profile.");
+        }
+      }
+
       if (config.loadExe) {
         // When loading, we simply load-construct the executable and run it:
-        pvti::Tracepoint::begin(&traceChannel, "loading_graph");
+        trace_utils::Tracepoint::begin(&traceChannel, "loading_graph");
         poplar::Executable exe = loadExe(config.exeName);
         // Need to load a ProgramManager also:
         auto progsFileName = makeProgramsFileName(config.exeName);
@@ -493,24 +499,24 @@ public:
           logger()->error("Error: failed to load program list from '{}'", progsFileName);
           throw;
         }
-        pvti::Tracepoint::end(&traceChannel, "loading_graph");
-        executeGraphProgram(exe, *device, builder);
+        trace_utils::Tracepoint::end(&traceChannel, "loading_graph");
+        executeGraphProgram(exe, *device, builder, engineOptions);
       } else {
         // Otherwise we must build and compile the graph:
         logger()->info("Graph construction started");
-        pvti::Tracepoint::begin(&traceChannel, "constructing_graph");
+        trace_utils::Tracepoint::begin(&traceChannel, "constructing_graph");
         builder.build(graph, device->getTarget());
-        pvti::Tracepoint::end(&traceChannel, "constructing_graph");
+        trace_utils::Tracepoint::end(&traceChannel, "constructing_graph");
         logger()->info("Graph construction finished");
 
         logger()->info("Graph compilation started");
-        pvti::Tracepoint::begin(&traceChannel, "compiling_graph");
+        trace_utils::Tracepoint::begin(&traceChannel, "compiling_graph");
         CallbackFilter progress([](int done, int todo) {
           logger()->debug("Compilation step {}/{}", done, todo);
         });
-        poplar::Executable exe = poplar::compileGraph(graph, builder.getPrograms().getList(), {},
+        poplar::Executable exe = poplar::compileGraph(graph, builder.getPrograms().getList(), engineOptions,
                                                       progress.getFilteredCallback(), "ipu_utils_engine");
-        pvti::Tracepoint::end(&traceChannel, "compiling_graph");
+        trace_utils::Tracepoint::end(&traceChannel, "compiling_graph");
         logger()->info("Graph compilation finished");
 
         if (config.saveExe) {
@@ -526,7 +532,7 @@ public:
         }
 
         // Run the graph we just built and compiled.
-        executeGraphProgram(exe, *device, builder);
+        executeGraphProgram(exe, *device, builder, engineOptions);
       }
 
     } catch (const std::exception& e) {
@@ -537,13 +543,25 @@ public:
     return EXIT_SUCCESS;
   }
 
+  /// Options that make Poplar write the compilation and execution reports
+  /// for PopVision (profile.pop) into the directory. The execution profile is
+  /// only complete once the engine is destroyed, i.e. when run() returns. Runs
+  /// should be short: execution is much slower while being profiled.
+  static poplar::OptionFlags getProfileOptions(const std::string& directory) {
+    return poplar::OptionFlags{
+        {"autoReport.all", "true"},
+        {"autoReport.directory", directory},
+        {"debug.retainDebugInformation", "true"}};
+  }
+
 private:
   void executeGraphProgram(poplar::Executable& exe,
                            DeviceInterface& device,
-                           BuilderInterface& builder) {
+                           BuilderInterface& builder,
+                           const poplar::OptionFlags& engineOptions) {
     // Prepare the execution engine and connect
     // data streams to/from IPU:
-    poplar::Engine engine(std::move(exe));
+    poplar::Engine engine(std::move(exe), engineOptions);
     device.attach();
     engine.load(device.getPoplarDevice());
     builder.execute(engine, device.getPoplarDevice());
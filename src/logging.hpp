@@ -9,3 +9,15 @@
 #include <spdlog/sinks/stdout_sinks.h>
 #endif
 #include <spdlog/fmt/ostr.h>
+
+#include <memory>
+
+namespace ipu_utils {
+
+/// Return the application's shared logger object.
+inline std::shared_ptr<spdlog::logger> logger() {
+  static auto logger = spdlog::stdout_logger_mt("ipu_trace_logger");
+  return spdlog::get("ipu_trace_logger");
+}
+
+} // end namespace ipu_utils
@@ -1,8 +1,10 @@
 // Copyright (c) 2020 Graphcore Ltd. All rights reserved.
 
 #include <cstdlib>
+#include <fstream>
 
 #include "PathTracerApp.hpp"
+#include "ProfileSummary.hpp"
 
 /// Process the command line options for the path tracing application.
 boost::program_options::options_description getStandardOptions() {
@@ -30,8 +32,14 @@ boost::program_options::options_description getStandardOptions() {
    "If set and save-exe is also set then exit after compiling and saving the graph.")
   ("defer-attach", po::bool_switch()->default_value(false),
    "If true hardware devices will not attach until execution is ready to begin. If false they will be attached (reserved) before compilation starts. ")
+  ("profile", po::value<std::string>()->default_value(""),
+   "Capture PopVision compilation and execution reports into this directory and summarise memory per tile "
+   "and cycles per compute set at the end of the run. Use a short run (e.g. a few steps): profiling is slow.")
   ("log-level", po::value<std::string>()->default_value("info"),
   "Set the log level to one of the following: 'trace', 'debug', 'info', 'warn', 'err', 'critical', 'off'.")
+  ("config", po::value<std::string>(),
+   "Load options from a file of 'option=value' lines (e.g. as written by src/tools/autotune.py). "
+   "Options given on the command line take precedence.")
   ;
   return desc;
 }
@@ -46,6 +54,17 @@ boost::program_options::variables_map parseOptions(int argc, char** argv, boost:
     throw std::runtime_error("Show help");
   }
 
+  // Values stored first take precedence so the config
+  // file must be parsed after the command line:
+  if (vm.count("config")) {
+    const auto configFile = vm.at("config").as<std::string>();
+    std::ifstream fs(configFile);
+    if (!fs.is_open()) {
+      throw std::runtime_error("Could not open config file: '" + configFile + "'");
+    }
+    po::store(po::parse_config_file(fs, desc), vm);
+  }
+
   po::notify(vm);
 
 #ifdef NO_VIRTUAL_GRAPHS
@@ -98,5 +117,33 @@ int main(int argc, char** argv) {
   auto opts = parseOptions(argc, argv, desc);
   setupLogging(opts);
   app.init(opts);
-  return ipu_utils::GraphManager().run(app);
+  auto exitCode = ipu_utils::GraphManager().run(app);
+
+  // The reports are complete once the graph manager has finished:
+  const auto profileDir = opts.at("profile").as<std::string>();
+  CycleCounts computeSetCycles;
+  if (exitCode == EXIT_SUCCESS && !profileDir.empty()) {
+    try {
+      const auto summary = summariseProfile(profileDir + "/profile.pop");
+      ipu_utils::logger()->info("Profile summary:\n{}", formatProfileSummary(summary));
+      saveProfileSummary(summary, profileDir + "/summary.json");
+      computeSetCycles = computeSetCycleCounts(summary);
+    } catch (const std::exception& e) {
+      ipu_utils::logger()->error("Could not summarise profile: {}", e.what());
+      exitCode = EXIT_FAILURE;
+    }
+  }
+
+  if (exitCode == EXIT_SUCCESS) {
+    try {
+      if (!app.checkForRegressions(computeSetCycles)) {
+        ipu_utils::logger()->error("Regression checks failed.");
+        exitCode = EXIT_FAILURE;
+      }
+    } catch (const std::exception& e) {
+      ipu_utils::logger()->error("Could not run regression checks: {}", e.what());
+      exitCode = EXIT_FAILURE;
+    }
+  }
+  return exitCode;
 }
@@ -2,6 +2,8 @@
 
 #pragma once
 
+#include <HostAllocator.hpp>
+
 struct HostTensor {
   HostTensor(const std::vector<std::size_t>& shape, poplar::Type dtype, const std::string& name)
     : shape(shape), nameSuffix(name), type(dtype) {}
@@ -12,7 +14,7 @@ struct HostTensor {
   std::string nameSuffix;
   //ipu_utils::StreamableTensor tensor;
   poplar::Type type;
-  std::vector<std::uint8_t> data;
+  HostBuffer<std::uint8_t> data; // Connected to a weight stream.
 };
 
 struct DenseLayer {
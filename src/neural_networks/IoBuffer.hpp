@@ -2,6 +2,8 @@
 
 #pragma once
 
+#include <HostAllocator.hpp>
+
 #include <vector>
 
 struct IoBuffer {
@@ -13,7 +15,7 @@ struct IoBuffer {
   bool storeBatchOutput();
 
   std::size_t batchSize;
-  std::vector<float> connectedBuffer;
+  HostBuffer<float> connectedBuffer;
   std::vector<std::vector<float>> data;
   std::size_t index;
 };
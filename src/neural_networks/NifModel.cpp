@@ -58,10 +58,10 @@ void NifModel::Data::setupModel(const std::string& h5File) {
     auto dtype = l.dtype == "float16" ? poplar::HALF : poplar::FLOAT;
     layers.emplace_back(l.kernelData.shape, dtype, l.activation, l.name);
     auto& newLayer = layers.back();
-    newLayer.kernel.data = l.kernelData.storage;
+    newLayer.kernel.data.assign(l.kernelData.storage.begin(), l.kernelData.storage.end());
     ipu_utils::logger()->debug("Added dense kernel: {} size: {}", newLayer.kernel.getName(), newLayer.kernel.data.size());
     if (l.useBias) {
-      newLayer.bias.data = l.biasData.storage;
+      newLayer.bias.data.assign(l.biasData.storage.begin(), l.biasData.storage.end());
       ipu_utils::logger()->debug("Added bias: {} size: {}", newLayer.bias.getName(), newLayer.bias.data.size());
       ipu_utils::logger()->debug("Layer {}: weight tensors: {} ({}) {} ({})",
         i, newLayer.kernel.getName(), newLayer.kernel.shape, newLayer.bias.getName(), newLayer.bias.shape);
@@ -372,7 +372,49 @@ poplar::program::Sequence NifModel::buildInit(poplar::Graph& g, bool optimiseStr
   return initProg;
 }
 
-void NifModel::connectStreams(poplar::Engine& engine) {
+std::vector<poplar::Tensor> NifModel::getParameterTensors() const {
+  std::vector<poplar::Tensor> params;
+  for (const auto& p : modelTensors) {
+    params.push_back(p.second.get());
+  }
+  params.push_back(max.get());
+  params.push_back(mean.get());
+  return params;
+}
+
+poplar::program::Sequence NifModel::buildBroadcastWeights(const std::vector<NifModel*>& models,
+                                                          const std::string& debugPrefix) {
+  std::vector<std::vector<poplar::Tensor>> params;
+  for (auto m : models) {
+    if (!m->inferenceBuilt) {
+      throw std::runtime_error("You must call 'buildInference' before you call 'buildBroadcastWeights'.");
+    }
+    params.push_back(m->getParameterTensors());
+    if (params.back().size() != params.front().size()) {
+      throw std::logic_error("NIF models must have the same architecture to broadcast weights.");
+    }
+  }
+
+  // In each round every model that has the weights sends them to one that
+  // does not. The sends for a parameter are merged into one copy so that
+  // they are exchanged in parallel:
+  poplar::program::Sequence prog;
+  for (std::size_t have = 1, round = 0; have < models.size(); have *= 2, ++round) {
+    for (auto p = 0u; p < params.front().size(); ++p) {
+      std::vector<poplar::Tensor> src;
+      std::vector<poplar::Tensor> dst;
+      for (auto i = 0u; i < have && i + have < models.size(); ++i) {
+        src.push_back(params[i][p].flatten());
+        dst.push_back(params[i + have][p].flatten());
+      }
+      prog.add(poplar::program::Copy(poplar::concat(src), poplar::concat(dst), false,
+                                     debugPrefix + "/round" + std::to_string(round)));
+    }
+  }
+  return prog;
+}
+
+void NifModel::connectStreams(poplar::Engine& engine, bool connectWeights) {
   if (streamedIO) {
     cycleCount.connectReadStream(engine, &cycleCountResult);
 
@@ -383,6 +425,10 @@ void NifModel::connectStreams(poplar::Engine& engine) {
     inputV.connectWriteStream(engine, inputBufferV->connectedBuffer);
   }
 
+  if (!connectWeights) {
+    return;
+  }
+
   // Connect tone-map-decode parameters:
   max.connectWriteStream(engine, &data->getMetaData().max);
   mean.connectWriteStream(engine, data->getMetaData().mean.data());
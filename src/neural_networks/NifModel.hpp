@@ -62,8 +62,18 @@ struct NifModel {
   /// Build graph to initialise model weights.
   poplar::program::Sequence buildInit(poplar::Graph& g, bool optimiseStreamMemory);
 
-  /// Connect all the model's streams to the engine.
-  void connectStreams(poplar::Engine& engine);
+  /// Build a program that copies the weights of the first model to all the
+  /// others on the device (the models must have the same architecture and
+  /// are typically on different IPUs). Each round of copies doubles the
+  /// number of models that hold the weights so no model sends them more than
+  /// once per round. Only the first model needs the program from buildInit():
+  static poplar::program::Sequence buildBroadcastWeights(const std::vector<NifModel*>& models,
+                                                         const std::string& debugPrefix);
+
+  /// Connect all the model's streams to the engine. The weight streams are
+  /// skipped if connectWeights is false (e.g. the model's weights are copied
+  /// by buildBroadcastWeights() and it never called buildInit()).
+  void connectStreams(poplar::Engine& engine, bool connectWeights = true);
 
   /// Generate host input samples to reconstruct the whole image:
   void generateInputSamples();
@@ -78,6 +88,9 @@ struct NifModel {
 
 private:
   void setupStreamableTensors();
+
+  /// All tensors initialised by buildInit() in a fixed order:
+  std::vector<poplar::Tensor> getParameterTensors() const;
   void setupIoBuffers();
 
   /// Calculate the power coefficients for Fourier features:
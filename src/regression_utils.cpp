@@ -0,0 +1,78 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "regression_utils.hpp"
+
+#include "logging.hpp"
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+double compareToGoldenImage(const cv::Mat& hdrImage, const std::string& goldenFile) {
+  cv::Mat golden = cv::imread(goldenFile, cv::IMREAD_UNCHANGED);
+  if (golden.empty()) {
+    throw std::runtime_error("Could not load golden image: '" + goldenFile + "'");
+  }
+  if (golden.size() != hdrImage.size() || golden.channels() != hdrImage.channels()) {
+    throw std::runtime_error("Golden image '" + goldenFile + "' does not match the size of the rendered image.");
+  }
+  golden.convertTo(golden, CV_32F);
+
+  cv::Mat image;
+  hdrImage.convertTo(image, CV_32F);
+  const double rmsError = cv::norm(image, golden, cv::NORM_L2) / std::sqrt(double(golden.total() * golden.channels()));
+  const double meanAbs = cv::norm(golden, cv::NORM_L1) / double(golden.total() * golden.channels());
+  return rmsError / std::max(meanAbs, 1e-12);
+}
+
+void saveCycleBaseline(const CycleCounts& cycles, const std::string& fileName) {
+  boost::property_tree::ptree counts;
+  for (const auto& c : cycles) {
+    counts.put(c.first, c.second);
+  }
+  boost::property_tree::ptree root;
+  root.add_child("cycles", counts);
+  std::ofstream fs(fileName);
+  boost::property_tree::write_json(fs, root);
+  ipu_utils::logger()->info("Saved cycle baseline to '{}'", fileName);
+}
+
+CycleCounts loadCycleBaseline(const std::string& fileName) {
+  std::ifstream fs(fileName);
+  if (!fs.is_open()) {
+    throw std::runtime_error("Could not open cycle baseline: '" + fileName + "'");
+  }
+  boost::property_tree::ptree root;
+  boost::property_tree::read_json(fs, root);
+  CycleCounts cycles;
+  for (const auto& c : root.get_child("cycles")) {
+    cycles[c.first] = c.second.get_value<double>();
+  }
+  return cycles;
+}
+
+bool checkCycleBaseline(const CycleCounts& cycles, const CycleCounts& baseline, double tolerance) {
+  bool pass = true;
+  for (const auto& b : baseline) {
+    auto found = cycles.find(b.first);
+    if (found == cycles.end()) {
+      ipu_utils::logger()->error("Cycle count '{}' is in the baseline but was not measured.", b.first);
+      pass = false;
+      continue;
+    }
+    const auto change = (found->second - b.second) / std::max(b.second, 1.0);
+    if (change > tolerance) {
+      ipu_utils::logger()->error("Cycle regression '{}': {} cycles (baseline {}, {:+.2f}%)",
+                                 b.first, found->second, b.second, 100.0 * change);
+      pass = false;
+    } else {
+      ipu_utils::logger()->info("Cycles '{}': {} (baseline {}, {:+.2f}%)",
+                                b.first, found->second, b.second, 100.0 * change);
+    }
+  }
+  return pass;
+}
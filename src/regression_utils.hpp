@@ -0,0 +1,29 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <opencv2/core.hpp>
+
+#include <map>
+#include <string>
+
+/// Utilities for checking that a change does not alter the rendered
+/// image or increase the device cycle costs (e.g. by rendering a small
+/// image with a fixed seed on the IPUModel).
+
+/// Named cycle counts (e.g. mean cycles per step for each program):
+using CycleCounts = std::map<std::string, double>;
+
+/// Return the relative RMS error between the HDR image and the golden
+/// image loaded from the file (i.e. RMS error divided by the mean
+/// absolute value of the golden image). Throws if the golden image
+/// can not be loaded or its size does not match.
+double compareToGoldenImage(const cv::Mat& hdrImage, const std::string& goldenFile);
+
+void saveCycleBaseline(const CycleCounts& cycles, const std::string& fileName);
+CycleCounts loadCycleBaseline(const std::string& fileName);
+
+/// Compare cycle counts against a baseline. Logs every count and returns
+/// false if any count increased by more than the tolerance (a fraction of
+/// the baseline) or if any baseline count is missing from the new counts.
+bool checkCycleBaseline(const CycleCounts& cycles, const CycleCounts& baseline, double tolerance);
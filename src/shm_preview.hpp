@@ -0,0 +1,168 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+// Layout of the POSIX shared memory ring that the path tracer can publish
+// preview frames into (see SharedMemoryPreview) and a reader for it. This
+// header has no dependencies beyond the standard library and POSIX so that
+// local tools can include it directly.
+//
+// The shared memory object starts with a ShmPreviewHeader followed by
+// slotCount slots. Each slot starts with a ShmPreviewSlot header followed
+// by the LDR image (8-bit BGR) and the HDR image (32-bit float BGR, already
+// divided by the sample count). Rows are tightly packed.
+//
+// Each slot is protected by a sequence lock: the writer makes the sequence
+// number odd while it writes the slot and even again when it has finished.
+// Frames are written to slots in turn and the header records the most
+// recently completed frame so readers always find the latest frame, and
+// because a slot is not rewritten until slotCount - 1 further frames have
+// been written readers rarely have to retry.
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+              "Shared memory sequence locks require lock free 64-bit atomics.");
+
+constexpr std::uint32_t shmPreviewMagic = 0x50545049; // "IPTP"
+constexpr std::uint32_t shmPreviewVersion = 1;
+
+struct ShmPreviewHeader {
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::uint32_t width;
+  std::uint32_t height;
+  std::uint32_t slotCount;
+  std::uint32_t padding;
+  std::uint64_t slotBytes;  // Size of each slot including its header.
+  std::uint64_t ldrOffset;  // Offset of LDR pixels from the start of a slot.
+  std::uint64_t hdrOffset;  // Offset of HDR pixels from the start of a slot.
+  std::atomic<std::uint64_t> latest; // Number of the latest complete frame (0 = none yet).
+};
+
+struct ShmPreviewSlot {
+  std::atomic<std::uint64_t> sequence; // Odd while the slot is being written.
+  std::uint64_t frame;                 // Frame number (starts at 1).
+  std::uint64_t step;                  // Render step the frame was taken from.
+  std::int64_t timestampNs;            // Publish time (CLOCK_MONOTONIC).
+  float exposure;                      // Tone-map settings used for the LDR image.
+  float gamma;
+};
+
+/// Round up to a multiple of 64 bytes so each slot starts on a new cache line:
+inline std::uint64_t shmPreviewAlign(std::uint64_t bytes) {
+  return (bytes + 63) & ~std::uint64_t(63);
+}
+
+inline std::uint64_t shmPreviewLdrBytes(std::uint32_t width, std::uint32_t height) {
+  return std::uint64_t(width) * height * 3;
+}
+
+inline std::uint64_t shmPreviewHdrBytes(std::uint32_t width, std::uint32_t height) {
+  return std::uint64_t(width) * height * 3 * sizeof(float);
+}
+
+/// Pointers into shared memory for a frame returned by ShmPreviewReader.
+/// The data is not copied so it is only guaranteed to be intact if
+/// ShmPreviewReader::stillValid() returns true after it has been used.
+struct ShmPreviewFrame {
+  const ShmPreviewSlot* slot = nullptr;
+  std::uint64_t sequence = 0;
+  std::uint64_t frame = 0;
+  std::uint64_t step = 0;
+  std::int64_t timestampNs = 0;
+  float exposure = 0.f;
+  float gamma = 0.f;
+  const std::uint8_t* ldr = nullptr;
+  const float* hdr = nullptr;
+};
+
+/// Maps an existing preview ring read-only.
+class ShmPreviewReader {
+public:
+  ShmPreviewReader(const std::string& name) : size(0), base(nullptr) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+      throw std::runtime_error("Could not open shared memory '" + name + "': " + std::strerror(errno));
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || std::size_t(info.st_size) < sizeof(ShmPreviewHeader)) {
+      close(fd);
+      throw std::runtime_error("Shared memory '" + name + "' is too small to contain a preview ring.");
+    }
+    size = info.st_size;
+    base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+      throw std::runtime_error("Could not map shared memory '" + name + "': " + std::strerror(errno));
+    }
+    auto& h = header();
+    if (h.magic != shmPreviewMagic || h.version != shmPreviewVersion) {
+      munmap(base, size);
+      throw std::runtime_error("Shared memory '" + name + "' is not a compatible preview ring.");
+    }
+    if (sizeof(ShmPreviewHeader) + h.slotCount * h.slotBytes > size) {
+      munmap(base, size);
+      throw std::runtime_error("Shared memory '" + name + "' is truncated.");
+    }
+  }
+
+  virtual ~ShmPreviewReader() {
+    munmap(base, size);
+  }
+
+  const ShmPreviewHeader& header() const {
+    return *static_cast<const ShmPreviewHeader*>(base);
+  }
+
+  /// Number of the most recent complete frame (0 if none have been published):
+  std::uint64_t latestFrameNumber() const {
+    return header().latest.load(std::memory_order_acquire);
+  }
+
+  /// Get pointers to the most recent complete frame. Returns false if no
+  /// frame has been published yet or the writer is currently rewriting it.
+  bool latest(ShmPreviewFrame& f) const {
+    const auto n = latestFrameNumber();
+    if (n == 0) {
+      return false;
+    }
+    auto& h = header();
+    auto slotPtr = static_cast<const std::uint8_t*>(base) + sizeof(ShmPreviewHeader) + (n % h.slotCount) * h.slotBytes;
+    auto slot = reinterpret_cast<const ShmPreviewSlot*>(slotPtr);
+    f.slot = slot;
+    f.sequence = slot->sequence.load(std::memory_order_acquire);
+    if (f.sequence & 1) {
+      return false;
+    }
+    f.frame = slot->frame;
+    f.step = slot->step;
+    f.timestampNs = slot->timestampNs;
+    f.exposure = slot->exposure;
+    f.gamma = slot->gamma;
+    f.ldr = slotPtr + h.ldrOffset;
+    f.hdr = reinterpret_cast<const float*>(slotPtr + h.hdrOffset);
+    return stillValid(f);
+  }
+
+  /// Returns true if the frame's slot has not been overwritten since
+  /// it was returned by latest() (i.e. any data read from it is good):
+  bool stillValid(const ShmPreviewFrame& f) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return f.slot->sequence.load(std::memory_order_relaxed) == f.sequence;
+  }
+
+private:
+  std::size_t size;
+  void* base;
+};
@@ -0,0 +1,55 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+// Stream operators used for logging. These have no Poplar
+// dependencies so can be used in host-only code.
+
+#include <cstdint>
+#include <ostream>
+#include <set>
+#include <vector>
+
+#include "codelets/TraceRecord.hpp"
+
+template <typename T1, typename T2>
+std::ostream& operator<<(std::ostream& s, const std::pair<T1, T2>& p) {
+  s << "(" << p.first << ", " << p.second << ")";
+  return s;
+}
+
+template <typename T, typename A>
+std::ostream& operator<<(std::ostream& s, const std::vector<T, A>& v) {
+  for (const auto& d : v) {
+    s << d << " ";
+  }
+  return s;
+}
+
+template <typename T>
+std::ostream& operator<<(std::ostream& s, const std::vector<std::vector<T>>& vv) {
+  for (const auto& v : vv) {
+    if (v.empty()) {
+      continue;
+    }
+    s << "[\n  ";
+    for (const auto& d : v) {
+      s << d << " ";
+    }
+    s << "\n]\n";
+  }
+  return s;
+}
+
+template <typename T>
+inline std::ostream& operator<<(std::ostream& os, const std::set<T>& s) {
+  for (auto& k : s) {
+    os << k << " ";
+  }
+  return os;
+}
+
+inline std::ostream& operator<<(std::ostream& s, const TraceRecord& t) {
+  s << "{ u:" << t.u << " v:" << t.v << " length:" << t.pathLength << " samples:" << t.sampleCount << " }";
+  return s;
+}
@@ -0,0 +1,168 @@
+# Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+# Search for the fastest combination of throughput critical options for
+# ipu_trace. Options that change the compiled graph are compiled in
+# parallel (executables are cached so re-running a search only compiles
+# new candidates) and then every candidate is benchmarked on the target
+# for a fixed number of render steps, once for each runtime option value.
+# The best configuration is written to a file that ipu_trace can load
+# with --config.
+#
+# Options that are not being tuned are passed through to every ipu_trace
+# invocation after '--', e.g.:
+#
+#   python3 ../src/tools/autotune.py --ipu-trace ./ipu_trace --partials-type half float \
+#     --available-memory-proportion 0.4 0.6 --output tuned.cfg -- \
+#     --assets ../nif_models/urban_alley_01_4k_fp16_yuv/assets.extra/ -w 1440 -h 1440 --ipus 4
+#
+#   ./ipu_trace --config tuned.cfg --assets ... -w 1440 -h 1440 --ipus 4 -s 10000 -o image.png
+
+import argparse
+import concurrent.futures
+import hashlib
+import itertools
+import os
+import random
+import re
+import statistics
+import subprocess
+import sys
+
+# Options that change the compiled graph (a new executable is needed for each value):
+COMPILE_OPTIONS = ["max-nif-batch-size", "available-memory-proportion", "partials-type", "max-path-length"]
+
+# Options that can be changed without recompiling:
+RUNTIME_OPTIONS = ["samples-per-step"]
+
+STEP_RATE = re.compile(r"Completed render step (\d+)/(\d+) in .* seconds \(Samples/sec ([0-9.eE+-]+)\)")
+
+
+def parse_args():
+    parser = argparse.ArgumentParser("Autotune throughput critical ipu_trace options.")
+    parser.add_argument("--ipu-trace", type=str, default="./ipu_trace", help="Path to the ipu_trace executable.")
+    parser.add_argument("--cache-dir", type=str, default="autotune_cache", help="Directory for cached executables and logs.")
+    parser.add_argument("--output", type=str, default="autotune.cfg", help="File to write the best configuration to.")
+    parser.add_argument("--compile-jobs", type=int, default=2, help="Number of candidates to compile in parallel.")
+    parser.add_argument("--steps", type=int, default=10, help="Render steps to benchmark each candidate for.")
+    parser.add_argument("--warmup-steps", type=int, default=2, help="Steps to ignore at the start of each benchmark.")
+    parser.add_argument("--timeout", type=float, default=3600, help="Seconds before a compile or benchmark is abandoned.")
+    parser.add_argument("--max-candidates", type=int, default=0,
+                        help="Benchmark a random subset of this many candidates (0 benchmarks all of them).")
+    parser.add_argument("--seed", type=int, default=1, help="Seed for choosing a random subset of candidates.")
+    parser.add_argument("--samples-per-step", type=int, nargs="+", default=[128, 256, 512])
+    parser.add_argument("--max-nif-batch-size", type=int, nargs="+", default=[30 * 1472])
+    parser.add_argument("--available-memory-proportion", type=float, nargs="+", default=[0.6])
+    parser.add_argument("--partials-type", type=str, nargs="+", default=["half"])
+    parser.add_argument("--max-path-length", type=int, nargs="+", default=[10])
+    args, passthrough = parser.parse_known_args()
+    if passthrough and passthrough[0] == "--":
+        passthrough = passthrough[1:]
+    reserved = ["-o", "--outfile", "-s", "--samples", "--save-interval", "--save-exe", "--load-exe", "--compile-only", "--defer-attach"]
+    reserved += [f"--{o}" for o in COMPILE_OPTIONS + RUNTIME_OPTIONS]
+    clashes = [a for a in passthrough if a.split("=")[0] in reserved]
+    if clashes:
+        parser.error(f"These options are set by the autotuner and can not be passed through: {clashes}")
+    return args, passthrough
+
+
+def option_args(options):
+    cmd = []
+    for k, v in options.items():
+        cmd += [f"--{k}", str(v)]
+    return cmd
+
+
+def exe_name(cache_dir, compile_options, passthrough):
+    # The executable depends on the pass through options (image size, IPU count, NIF model etc) too:
+    key = " ".join(option_args(compile_options) + passthrough)
+    return os.path.join(cache_dir, "exe_" + hashlib.sha1(key.encode()).hexdigest()[:16])
+
+
+def compile_candidate(args, passthrough, compile_options):
+    exe = exe_name(args.cache_dir, compile_options, passthrough)
+    if os.path.exists(exe + ".poplar.exe") and os.path.exists(exe + ".poplar.progs"):
+        return exe, "cached"
+    cmd = [args.ipu_trace, "--compile-only", "--defer-attach", "--save-exe", exe, "-o", exe + ".png"]
+    cmd += option_args(compile_options) + passthrough
+    with open(exe + ".compile.log", "w") as log:
+        result = subprocess.run(cmd, stdout=log, stderr=subprocess.STDOUT, timeout=args.timeout)
+    if result.returncode != 0:
+        return None, f"compile failed (see {exe}.compile.log)"
+    return exe, "compiled"
+
+
+def benchmark(args, passthrough, exe, compile_options, runtime_options):
+    # Every step renders samples-per-step samples so this fixes the number of steps:
+    samples = args.steps * runtime_options["samples-per-step"]
+    cmd = [args.ipu_trace, "--load-exe", exe, "-s", str(samples), "-o", exe + ".png",
+           "--save-interval", str(samples)]
+    cmd += option_args(compile_options) + option_args(runtime_options) + passthrough
+    try:
+        result = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                                universal_newlines=True, timeout=args.timeout)
+    except subprocess.TimeoutExpired:
+        return None
+    if result.returncode != 0:
+        return None
+    rates = [float(m.group(3)) for m in STEP_RATE.finditer(result.stdout)]
+    rates = rates[args.warmup_steps:]
+    return statistics.median(rates) if rates else None
+
+
+def write_config(file_name, options, rate, exe):
+    with open(file_name, "w") as f:
+        f.write(f"# Written by autotune.py: {rate:.4g} samples/sec (median)\n")
+        f.write(f"# Compiled executable for these options: {exe}\n")
+        for k, v in options.items():
+            f.write(f"{k}={v}\n")
+
+
+if __name__ == '__main__':
+    args, passthrough = parse_args()
+    os.makedirs(args.cache_dir, exist_ok=True)
+    settings = vars(args)
+
+    def grid(names):
+        values = [settings[n.replace("-", "_")] for n in names]
+        return [dict(zip(names, v)) for v in itertools.product(*values)]
+
+    compile_grid = grid(COMPILE_OPTIONS)
+    runtime_grid = grid(RUNTIME_OPTIONS)
+    candidates = list(itertools.product(range(len(compile_grid)), runtime_grid))
+    if args.max_candidates and args.max_candidates < len(candidates):
+        candidates = random.Random(args.seed).sample(candidates, args.max_candidates)
+    to_compile = sorted(set(c for c, _ in candidates))
+    print(f"Search space: {len(candidates)} candidates ({len(to_compile)} executables)")
+
+    # Compile in parallel (candidates that fail to compile, e.g. by running out of tile memory, are dropped):
+    exes = {}
+    with concurrent.futures.ThreadPoolExecutor(max_workers=args.compile_jobs) as pool:
+        futures = {pool.submit(compile_candidate, args, passthrough, compile_grid[c]): c for c in to_compile}
+        for f in concurrent.futures.as_completed(futures):
+            c = futures[f]
+            try:
+                exe, status = f.result()
+            except subprocess.TimeoutExpired:
+                exe, status = None, "compile timed out"
+            print(f"{compile_grid[c]}: {status}")
+            if exe:
+                exes[c] = exe
+
+    # Benchmarks run one at a time as they need exclusive use of the IPUs:
+    results = []
+    for c, runtime_options in candidates:
+        if c not in exes:
+            continue
+        rate = benchmark(args, passthrough, exes[c], compile_grid[c], runtime_options)
+        options = {**compile_grid[c], **runtime_options}
+        print(f"{options}: " + (f"{rate:.4g} samples/sec" if rate else "benchmark failed"))
+        sys.stdout.flush()
+        if rate:
+            results.append((rate, options, exes[c]))
+
+    if not results:
+        raise RuntimeError("No candidate completed its benchmark.")
+
+    rate, options, exe = max(results, key=lambda r: r[0])
+    write_config(args.output, options, rate, exe)
+    print(f"Best: {options} {rate:.4g} samples/sec. Saved configuration to '{args.output}'")
@@ -0,0 +1,234 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+// Native host harness for the path tracing codelets. The codelets are
+// compiled against the stand-in vertex API in src/codelets/host and
+// driven with synthetic buffers laid out as they are on one tile, so
+// algorithmic changes can be profiled (e.g. with perf) and benchmarked
+// in seconds without building a Poplar graph. Timings are host timings
+// and are only useful for relative comparisons.
+
+#include "codelets/codelets.cpp"
+
+#include <boost/program_options.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+
+/// Per-tile buffers for the whole codelet pipeline:
+struct TileData {
+  TileData(std::size_t rayCount, std::size_t maxPathLength, std::size_t imageWidth, std::size_t imageHeight, std::uint32_t seed)
+      : traces(rayCount),
+        noise(2 * rayCount),
+        rays(2 * rayCount),
+        uniform(rayCount * maxPathLength * 3),
+        contributions(rayCount * maxPathLength * sizeof(light::Contribution)),
+        u(rayCount),
+        v(rayCount),
+        bgr(3 * rayCount) {
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<std::uint32_t> col(0, imageWidth - 1);
+    std::uniform_int_distribution<std::uint32_t> row(0, imageHeight - 1);
+    std::normal_distribution<float> normal(0.f, 1.f);
+    std::uniform_real_distribution<float> uniform01(0.f, 1.f);
+    for (auto& t : traces) {
+      t = TraceRecord(col(gen), row(gen));
+    }
+    for (auto& n : noise) {
+      n = normal(gen);
+    }
+    for (auto& x : uniform) {
+      x = uniform01(gen);
+    }
+    // There is no environment network on host so escaped
+    // rays all get the same (sky blue) environment colour:
+    for (auto r = 0u; r < rayCount; ++r) {
+      bgr[3 * r] = 0.9f;
+      bgr[3 * r + 1] = 0.7f;
+      bgr[3 * r + 2] = 0.5f;
+    }
+  }
+
+  std::size_t rayBytes() const { return contributions.size() / traces.size(); }
+
+  std::vector<TraceRecord> traces;
+  std::vector<half> noise;
+  std::vector<half> rays;
+  std::vector<half> uniform;
+  std::vector<unsigned char> contributions;
+  std::vector<float> u;
+  std::vector<float> v;
+  std::vector<float> bgr;
+};
+
+/// Make a vector of per-ray views into a flat buffer:
+template <class F, class T>
+std::vector<F> sliceFields(T* data, std::size_t count, std::size_t sliceSize) {
+  std::vector<F> fields(count);
+  for (auto i = 0u; i < count; ++i) {
+    fields[i].reset(data + i * sliceSize, sliceSize);
+  }
+  return fields;
+}
+
+template <class V, class C>
+void bind(V& field, C& container) {
+  field.reset(container.data(), container.size());
+}
+
+template <class V>
+void runMultiVertex(V& vertex) {
+  for (auto w = 0u; w < V::numWorkers(); ++w) {
+    vertex.compute(w);
+  }
+}
+
+/// Return the mean time per call in nanoseconds:
+double timeIt(std::size_t repeats, const std::function<void()>& f) {
+  auto start = std::chrono::steady_clock::now();
+  for (auto r = 0u; r < repeats; ++r) {
+    f();
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / repeats;
+}
+
+void report(const std::string& name, std::size_t rays, double ns) {
+  std::cout << std::left << std::setw(26) << name
+            << std::right << std::setw(14) << std::fixed << std::setprecision(3) << ns * 1e-3
+            << std::setw(14) << std::setprecision(1) << ns / rays << "\n";
+}
+
+} // end anonymous namespace
+
+int main(int argc, char** argv) {
+  namespace po = boost::program_options;
+  po::options_description desc("Options");
+  desc.add_options()
+  ("help", "Show command help.")
+  ("rays", po::value<std::size_t>()->default_value(1440), "Rays per tile.")
+  ("max-path-length", po::value<std::size_t>()->default_value(10), "Maximum path length (contributions per ray).")
+  ("width,w", po::value<std::uint32_t>()->default_value(1024), "Image width used to generate pixel coordinates.")
+  ("height,h", po::value<std::uint32_t>()->default_value(1024), "Image height used to generate pixel coordinates.")
+  ("repeats", po::value<std::size_t>()->default_value(100), "Timed repetitions of each kernel.")
+  ("seed", po::value<std::uint32_t>()->default_value(1), "Seed for the synthetic input data.")
+  ("kernel", po::value<std::string>()->default_value("all"),
+   "Only run one kernel (for profiling): 'camera', 'trace', 'pre-escaped', 'post-escaped', 'accumulate' or 'all'.")
+  ;
+
+  po::variables_map args;
+  po::store(po::parse_command_line(argc, argv, desc), args);
+  if (args.count("help")) {
+    std::cout << desc << "\n";
+    return EXIT_SUCCESS;
+  }
+  po::notify(args);
+
+  const auto rayCount = args.at("rays").as<std::size_t>();
+  const auto repeats = args.at("repeats").as<std::size_t>();
+  const auto kernel = args.at("kernel").as<std::string>();
+  const auto width = args.at("width").as<std::uint32_t>();
+  const auto height = args.at("height").as<std::uint32_t>();
+  TileData tile(rayCount, args.at("max-path-length").as<std::size_t>(), width, height,
+                args.at("seed").as<std::uint32_t>());
+  auto traceBytes = reinterpret_cast<unsigned char*>(tile.traces.data());
+  const auto traceByteCount = tile.traces.size() * sizeof(TraceRecord);
+
+  // Connect the vertex fields to the tile buffers:
+  GenerateCameraRays camera;
+  camera.antiAliasNoise.reset(tile.noise.data(), tile.noise.size());
+  bind(camera.rays, tile.rays);
+  camera.traceBuffer.reset(traceBytes, traceByteCount);
+  camera.imageWidth = width;
+  camera.imageHeight = height;
+  camera.antiAliasScale = 0.3f;
+  std::vector<half> fov(1, 90.f * (light::Pi / 180.f));
+  bind(camera.fov, fov);
+
+  RayTraceKernel trace;
+  bind(trace.cameraRays, tile.rays);
+  bind(trace.uniform_0_1, tile.uniform);
+  auto traceOutputs = sliceFields<Output<Vector<unsigned char>>>(tile.contributions.data(), rayCount, tile.rayBytes());
+  bind(trace.contributionData, traceOutputs);
+  trace.refractiveIndex = 1.5f;
+  trace.stopProb = 0.3f;
+  trace.rouletteDepth = 3;
+
+  PreProcessEscapedRays preEscaped;
+  auto escapedInOut = sliceFields<InOut<Vector<unsigned char>>>(tile.contributions.data(), rayCount, tile.rayBytes());
+  bind(preEscaped.contributionData, escapedInOut);
+  preEscaped.traceBuffer.reset(traceBytes, traceByteCount);
+  preEscaped.imageHeight = height;
+  std::vector<float> azimuthalOffset(1, 0.f);
+  bind(preEscaped.azimuthalOffset, azimuthalOffset);
+  bind(preEscaped.u, tile.u);
+  bind(preEscaped.v, tile.v);
+
+  PostProcessEscapedRays postEscaped;
+  bind(postEscaped.contributionData, escapedInOut);
+  auto bgrInputs = sliceFields<Input<Vector<float>>>(tile.bgr.data(), rayCount, 3);
+  bind(postEscaped.bgr, bgrInputs);
+
+  AccumulateContributions accumulate;
+  auto accumulateInputs = sliceFields<Input<Vector<unsigned char>>>(tile.contributions.data(), rayCount, tile.rayBytes());
+  bind(accumulate.contributionData, accumulateInputs);
+  accumulate.traceBuffer.reset(traceBytes, traceByteCount);
+
+  // Every kernel needs the outputs of the previous ones so run the whole
+  // pipeline once before timing anything. The escaped ray kernels modify
+  // the contributions in place so keep a copy of the ray tracing result:
+  runMultiVertex(camera);
+  trace.compute();
+  const auto traced = tile.contributions;
+  runMultiVertex(preEscaped);
+  runMultiVertex(postEscaped);
+  accumulate.compute();
+
+  // Print a checksum of the single pass so that changes which
+  // should not alter the result can be checked:
+  double checksum = 0.0;
+  std::size_t pathLength = 0;
+  for (const auto& t : tile.traces) {
+    checksum += t.r + t.g + t.b;
+    pathLength += t.pathLength;
+  }
+  std::cout << "Checksum: " << std::setprecision(6) << checksum
+            << " mean path length: " << pathLength / double(rayCount) << "\n";
+
+  std::cout << std::left << std::setw(26) << "kernel"
+            << std::right << std::setw(14) << "us/call" << std::setw(14) << "ns/ray" << "\n";
+  auto selected = [&](const char* name) { return kernel == "all" || kernel == name; };
+  if (selected("camera")) {
+    report("GenerateCameraRays", rayCount, timeIt(repeats, [&] { runMultiVertex(camera); }));
+  }
+  if (selected("trace")) {
+    report("RayTraceKernel", rayCount, timeIt(repeats, [&] { trace.compute(); }));
+  }
+  if (selected("pre-escaped")) {
+    report("PreProcessEscapedRays", rayCount, timeIt(repeats, [&] {
+      std::memcpy(tile.contributions.data(), traced.data(), traced.size());
+      runMultiVertex(preEscaped);
+    }));
+  }
+  if (selected("post-escaped")) {
+    report("PostProcessEscapedRays", rayCount, timeIt(repeats, [&] {
+      std::memcpy(tile.contributions.data(), traced.data(), traced.size());
+      runMultiVertex(postEscaped);
+    }));
+  }
+  if (selected("accumulate")) {
+    report("AccumulateContributions", rayCount, timeIt(repeats, [&] { accumulate.compute(); }));
+  }
+  report("(contribution restore)", rayCount, timeIt(repeats, [&] {
+    std::memcpy(tile.contributions.data(), traced.data(), traced.size());
+  }));
+
+  return EXIT_SUCCESS;
+}
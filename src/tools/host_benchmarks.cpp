@@ -0,0 +1,215 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+// Micro-benchmarks for the host code that runs between IPU steps (film
+// accumulation, tone-mapping and work list management). These run on
+// synthetic work lists so no IPU or Poplar installation is needed.
+
+#include "AccumulatedImage.hpp"
+#include "HostAllocator.hpp"
+#include "LoadBalancer.hpp"
+#include "RenderState.hpp"
+#include "logging.hpp"
+
+#include "codelets/TraceRecord.hpp"
+
+#include <boost/program_options.hpp>
+#include <omp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+
+namespace {
+
+// Worker contexts per tile on the IPU:
+constexpr std::size_t numWorkers = 6;
+
+/// Fill the records with plausible results from a render step:
+void fillSyntheticResults(RecordList& records, std::uint32_t seed) {
+  std::mt19937 gen(seed);
+  std::geometric_distribution<int> pathLength(0.3);
+  std::uniform_real_distribution<float> colour(0.f, 4.f);
+  for (auto& t : records) {
+    t.pathLength = 1 + std::min(pathLength(gen), 15);
+    t.sampleCount = 64;
+    t.r = colour(gen);
+    t.g = colour(gen);
+    t.b = colour(gen);
+  }
+}
+
+/// Run the function repeatedly and return the mean time per call (nanoseconds).
+/// Setup is called before each timed call but is not included in the time:
+double timeIt(std::size_t repeats, const std::function<void()>& setup, const std::function<void()>& f) {
+  double total = 0.0;
+  for (auto r = 0u; r < repeats; ++r) {
+    setup();
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    total += std::chrono::duration<double, std::nano>(end - start).count();
+  }
+  return total / repeats;
+}
+
+void report(const std::string& name, std::size_t tiles, std::size_t w, std::size_t h,
+            int threads, std::size_t items, double ns, double singleThreadNs) {
+  std::cout << std::left << std::setw(28) << name
+            << std::right << std::setw(7) << tiles
+            << std::setw(7) << w << "x" << std::left << std::setw(6) << h
+            << std::right << std::setw(5) << threads
+            << std::setw(12) << std::fixed << std::setprecision(3) << ns * 1e-6
+            << std::setw(12) << std::setprecision(3) << ns / items
+            << std::setw(10) << std::setprecision(2) << singleThreadNs / ns << "\n";
+}
+
+} // end anonymous namespace
+
+int main(int argc, char** argv) {
+  namespace po = boost::program_options;
+  po::options_description desc("Options");
+  desc.add_options()
+  ("help", "Show command help.")
+  ("tiles", po::value<std::vector<std::size_t>>()->multitoken()->default_value({1472, 5888, 23552}, "1472 5888 23552"),
+   "Tile counts to benchmark.")
+  ("megapixels", po::value<std::vector<float>>()->multitoken()->default_value({0.25f, 1.f, 4.f, 16.f}, "0.25 1 4 16"),
+   "Image sizes to benchmark (square images).")
+  ("threads", po::value<std::vector<int>>()->multitoken(),
+   "Thread counts to benchmark (default: powers of 2 up to the number of cores).")
+  ("repeats", po::value<std::size_t>()->default_value(5), "Timed repetitions of each benchmark.")
+  ("host-huge-pages", po::value<bool>()->default_value(true), "Back stream buffers with huge pages (see ipu_trace --help).")
+  ;
+
+  po::variables_map args;
+  po::store(po::parse_command_line(argc, argv, desc), args);
+  if (args.count("help")) {
+    std::cout << desc << "\n";
+    return EXIT_SUCCESS;
+  }
+  po::notify(args);
+
+  host_memory::config().hugePages = args.at("host-huge-pages").as<bool>();
+
+  // Load balancing logs at info level on every call:
+  spdlog::set_level(spdlog::level::warn);
+
+  std::vector<int> threadCounts;
+  if (args.count("threads")) {
+    threadCounts = args.at("threads").as<std::vector<int>>();
+  } else {
+    for (int t = 1; t < omp_get_max_threads(); t *= 2) {
+      threadCounts.push_back(t);
+    }
+    threadCounts.push_back(omp_get_max_threads());
+  }
+  const auto repeats = args.at("repeats").as<std::size_t>();
+
+  std::cout << std::left << std::setw(28) << "benchmark"
+            << std::right << std::setw(7) << "tiles"
+            << std::setw(14) << "image"
+            << std::setw(5) << "thr"
+            << std::setw(12) << "ms/call"
+            << std::setw(12) << "ns/item"
+            << std::setw(10) << "speedup" << "\n";
+
+  for (auto mp : args.at("megapixels").as<std::vector<float>>()) {
+    const std::size_t w = std::round(std::sqrt(mp * 1e6f));
+    const std::size_t h = w;
+    if (w > std::numeric_limits<std::uint16_t>::max()) {
+      std::cerr << "Skipping " << mp << " MP: image too large for 16-bit pixel coordinates.\n";
+      continue;
+    }
+    const auto pixels = w * h;
+    AccumulatedImage film(w, h);
+
+    for (auto tiles : args.at("tiles").as<std::vector<std::size_t>>()) {
+      const auto recordsPerTile = calculateMaxRaysPerTile(w, h, tiles, numWorkers);
+      const auto records = recordsPerTile * tiles;
+      LoadBalancer balancer(pixels);
+      std::vector<RecordList> jobs;
+      RecordList results;
+
+      // Single threaded benchmarks:
+      omp_set_num_threads(1);
+      auto ns = timeIt(repeats, [] {}, [&] { jobs = createTracingJobs(w, h, tiles, numWorkers); });
+      report("createTracingJobs", tiles, w, h, 1, records, ns, ns);
+
+      ns = timeIt(repeats, [] {}, [&] { balancer.randomiseWorkList(jobs); });
+      report("randomiseWorkList", tiles, w, h, 1, records, ns, ns);
+
+      // Resetting the host render state on user interaction by copying the
+      // work lists into a fresh state versus switching preallocated states:
+      {
+        RenderStateArena arena(w, h, jobs);
+        ns = timeIt(repeats, [] {}, [&] {
+          auto& work = arena.current().work.getWork();
+          balancer.getWork().active() = work.active();
+          balancer.getWork().inactive() = work.active();
+        });
+        report("restart:copy_worklists", tiles, w, h, 1, records, ns, ns);
+
+        ns = timeIt(repeats, [] {}, [&] { arena.restart(); });
+        report("restart:arena", tiles, w, h, 1, records, ns, ns);
+      }
+
+      fillSyntheticResults(balancer.getWork().inactive(), 1);
+      results = balancer.getWork().inactive();
+      for (const auto& name : balancePolicyNames()) {
+        auto policy = createBalancePolicy(name);
+        ns = timeIt(repeats,
+                    [&] { balancer.getWork().inactive() = results; },
+                    [&] { balancer.allocateWorkByPathLength(*policy, tiles, recordsPerTile); });
+        report("balance:" + name, tiles, w, h, 1, records, ns, ns);
+      }
+
+      // Host side of the work list stream copies each step: ordinary heap
+      // buffers versus stream buffers (huge pages unless unavailable). The
+      // first touch includes page faults for a newly allocated buffer:
+      {
+        std::vector<TraceRecord> heap;
+        ns = timeIt(repeats, [&] { std::vector<TraceRecord>().swap(heap); },
+                    [&] { heap.assign(results.begin(), results.end()); });
+        report("stream_first_touch:heap", tiles, w, h, 1, records, ns, ns);
+        ns = timeIt(repeats, [] {}, [&] { std::copy(results.begin(), results.end(), heap.begin()); });
+        report("stream_copy:heap", tiles, w, h, 1, records, ns, ns);
+
+        RecordList stream;
+        ns = timeIt(repeats, [&] { RecordList().swap(stream); },
+                    [&] { stream.assign(results.begin(), results.end()); });
+        report("stream_first_touch:host_alloc", tiles, w, h, 1, records, ns, ns);
+        ns = timeIt(repeats, [] {}, [&] { std::copy(results.begin(), results.end(), stream.begin()); });
+        report("stream_copy:host_alloc", tiles, w, h, 1, records, ns, ns);
+      }
+
+      // OpenMP parallel benchmarks:
+      double accumulateSerial = 0.0;
+      double toneMapSerial = 0.0;
+      double clearSerial = 0.0;
+      for (auto t : threadCounts) {
+        omp_set_num_threads(t);
+
+        ns = timeIt(repeats, [] {}, [&] { film.accumulate(results); });
+        accumulateSerial = t == threadCounts.front() ? ns : accumulateSerial;
+        report("AccumulatedImage::accumulate", tiles, w, h, t, records, ns, accumulateSerial);
+
+        ns = timeIt(repeats, [] {}, [&] { film.updateLdrImage(1, 0.f, 2.2f); });
+        toneMapSerial = t == threadCounts.front() ? ns : toneMapSerial;
+        report("updateLdrImage", tiles, w, h, t, pixels, ns, toneMapSerial);
+
+        ns = timeIt(repeats,
+                    [&] { balancer.getWork().inactive() = results; },
+                    [&] { balancer.clearInactiveAccumulators(); });
+        clearSerial = t == threadCounts.front() ? ns : clearSerial;
+        report("clearInactiveAccumulators", tiles, w, h, t, records, ns, clearSerial);
+      }
+      film.reset();
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
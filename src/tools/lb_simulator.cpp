@@ -0,0 +1,216 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+// Replays a work trace recorded with ipu_trace's --record-work-trace
+// option against each load balancing policy. For every recorded step the
+// policy assigns work using that step's path lengths (as the renderer
+// does) and the assignment is then scored with the path lengths of the
+// following step, i.e. the work the tiles would actually have done. No
+// IPU or Poplar installation is needed.
+
+#include "BalancePolicy.hpp"
+#include "work_trace.hpp"
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+
+namespace {
+
+/// Keeps the initial (random) assignment: the renderer's behaviour
+/// when load balancing is disabled.
+class NoBalancing : public BalancePolicy {
+public:
+  std::string name() const override { return "none"; }
+  void assign(const WorkCosts& costs, std::size_t, std::size_t, WorkOrder& order) override {
+    order.resize(costs.size());
+    std::iota(order.begin(), order.end(), 0u);
+  }
+};
+
+/// Linear model of tile cycles from tile load fitted by least squares
+/// to the per-tile records in the trace:
+struct CycleModel {
+  double slope = 0.0;
+  double intercept = 0.0;
+  std::size_t samples = 0;
+
+  double predict(double load) const { return slope * load + intercept; }
+};
+
+CycleModel fitCycleModel(const work_trace::Trace& trace) {
+  double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for (const auto& s : trace.steps) {
+    for (const auto& t : s.second.tiles) {
+      const double x = t.load;
+      const double y = t.pathTraceCycles;
+      n += 1;
+      sx += x;
+      sy += y;
+      sxx += x * x;
+      sxy += x * y;
+    }
+  }
+  CycleModel m;
+  m.samples = n;
+  const double d = n * sxx - sx * sx;
+  if (n > 1 && d != 0.0) {
+    m.slope = (n * sxy - sx * sy) / d;
+    m.intercept = (sy - m.slope * sx) / n;
+  }
+  return m;
+}
+
+struct PolicyResult {
+  double maxLoad = 0.0;    // Mean over steps of the max tile load.
+  double imbalance = 0.0;  // Mean over steps of max/mean tile load.
+  double hostMs = 0.0;     // Mean time taken by assign().
+  std::size_t steps = 0;
+};
+
+/// Pixel costs padded with zero cost items to fill every tile's work list:
+WorkCosts paddedCosts(const std::vector<std::uint16_t>& pathLengths, std::size_t numItems) {
+  WorkCosts costs(numItems, 0);
+  std::copy(pathLengths.begin(), pathLengths.end(), costs.begin());
+  return costs;
+}
+
+PolicyResult simulate(BalancePolicy& policy, const work_trace::Trace& trace) {
+  const auto numTiles = trace.header.numTiles;
+  const auto itemsPerTile = trace.header.recordsPerTile;
+  const auto numItems = std::size_t(numTiles) * itemsPerTile;
+
+  // Items (pixel indices) in tile order. The renderer starts from a shuffled work list:
+  WorkOrder current(numItems);
+  std::iota(current.begin(), current.end(), 0u);
+  std::mt19937 g(142u);
+  std::shuffle(current.begin(), current.end(), g);
+
+  // Consecutive pairs of steps that both recorded path lengths:
+  std::vector<const work_trace::Step*> steps;
+  for (const auto& s : trace.steps) {
+    if (!s.second.pathLengths.empty()) {
+      steps.push_back(&s.second);
+    }
+  }
+
+  PolicyResult result;
+  WorkCosts costs(numItems);
+  WorkOrder next(numItems);
+  WorkOrder order;
+  for (auto s = 0u; s + 1 < steps.size(); ++s) {
+    // Costs in the current tile order:
+    const auto measured = paddedCosts(steps[s]->pathLengths, numItems);
+    for (auto i = 0u; i < numItems; ++i) {
+      costs[i] = measured[current[i]];
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    policy.assign(costs, numTiles, itemsPerTile, order);
+    auto end = std::chrono::steady_clock::now();
+    for (auto i = 0u; i < numItems; ++i) {
+      next[i] = current[order[i]];
+    }
+    std::swap(current, next);
+
+    // Score the new assignment with the work actually done in the next step:
+    const auto actual = paddedCosts(steps[s + 1]->pathLengths, numItems);
+    const auto loads = tileLoads(actual, current, itemsPerTile);
+    result.maxLoad += *std::max_element(loads.begin(), loads.end());
+    result.imbalance += loadImbalance(loads);
+    result.hostMs += std::chrono::duration<double, std::milli>(end - start).count();
+    result.steps += 1;
+  }
+
+  if (result.steps) {
+    result.maxLoad /= result.steps;
+    result.imbalance /= result.steps;
+    result.hostMs /= result.steps;
+  }
+  return result;
+}
+
+} // end anonymous namespace
+
+int main(int argc, char** argv) {
+  namespace po = boost::program_options;
+  po::options_description desc("Options");
+  desc.add_options()
+  ("help", "Show command help.")
+  ("trace", po::value<std::string>()->required(), "Work trace recorded with ipu_trace --record-work-trace.")
+  ("policies", po::value<std::vector<std::string>>()->multitoken(),
+   "Policies to simulate (default: all of them). 'none' keeps the initial random assignment.")
+  ;
+
+  po::variables_map args;
+  po::store(po::parse_command_line(argc, argv, desc), args);
+  if (args.count("help")) {
+    std::cout << desc << "\n";
+    return EXIT_SUCCESS;
+  }
+  po::notify(args);
+
+  const auto trace = work_trace::load(args.at("trace").as<std::string>());
+  const auto& h = trace.header;
+  std::cout << "Trace: " << h.width << "x" << h.height << " image, " << h.numTiles << " tiles, "
+            << h.recordsPerTile << " records per tile, " << trace.steps.size() << " steps\n";
+  if (std::size_t(h.width) * h.height > std::size_t(h.numTiles) * h.recordsPerTile) {
+    std::cerr << "Invalid trace: more pixels than work records.\n";
+    return EXIT_FAILURE;
+  }
+
+  const auto model = fitCycleModel(trace);
+  if (model.samples) {
+    std::cout << "Cycle model: path-trace cycles = " << model.slope << " x load + " << model.intercept
+              << " (fitted to " << model.samples << " tile records)\n";
+  }
+
+  std::vector<std::string> names = {"none"};
+  if (args.count("policies")) {
+    names = args.at("policies").as<std::vector<std::string>>();
+  } else {
+    const auto all = balancePolicyNames();
+    names.insert(names.end(), all.begin(), all.end());
+  }
+
+  // Create every policy first so that a bad name fails before any simulation runs:
+  std::vector<std::unique_ptr<BalancePolicy>> policies;
+  for (const auto& name : names) {
+    if (name == "none") {
+      policies.emplace_back(new NoBalancing());
+    } else {
+      policies.push_back(createBalancePolicy(name));
+    }
+  }
+
+  std::cout << std::left << std::setw(14) << "policy"
+            << std::right << std::setw(16) << "max tile load"
+            << std::setw(12) << "max/mean"
+            << std::setw(14) << "host ms/step";
+  if (model.samples) {
+    std::cout << std::setw(18) << "max tile cycles";
+  }
+  std::cout << "\n";
+
+  for (auto& policy : policies) {
+    const auto r = simulate(*policy, trace);
+    if (!r.steps) {
+      std::cerr << "The trace needs path lengths from at least two steps.\n";
+      return EXIT_FAILURE;
+    }
+    std::cout << std::left << std::setw(14) << policy->name()
+              << std::right << std::setw(16) << std::fixed << std::setprecision(1) << r.maxLoad
+              << std::setw(12) << std::setprecision(4) << r.imbalance
+              << std::setw(14) << std::setprecision(3) << r.hostMs;
+    if (model.samples) {
+      std::cout << std::setw(18) << std::setprecision(0) << model.predict(r.maxLoad);
+    }
+    std::cout << "\n";
+  }
+
+  return EXIT_SUCCESS;
+}
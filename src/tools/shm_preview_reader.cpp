@@ -0,0 +1,108 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+// Small utility that reads preview frames published by ipu_trace's
+// --shm-preview option. It reports frame numbers and publish-to-read
+// latency and can save the latest LDR and HDR frames to disk.
+
+#include "shm_preview.hpp"
+
+#include <boost/program_options.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <thread>
+
+std::int64_t monotonicNs() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return std::int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+int main(int argc, char** argv) {
+  namespace po = boost::program_options;
+  po::options_description desc("Options");
+  desc.add_options()
+  ("help", "Show command help.")
+  ("name", po::value<std::string>()->default_value("/ipu_trace_preview"), "Name of the shared memory preview ring.")
+  ("frames", po::value<std::uint32_t>()->default_value(1), "Number of new frames to read before exiting.")
+  ("timeout", po::value<float>()->default_value(10.f), "Give up if no new frame arrives for this many seconds.")
+  ("ldr-out", po::value<std::string>()->default_value(""), "Save the last LDR frame read to this file.")
+  ("hdr-out", po::value<std::string>()->default_value(""), "Save the last HDR frame read to this file (e.g. .exr).")
+  ;
+
+  po::variables_map args;
+  po::store(po::parse_command_line(argc, argv, desc), args);
+  if (args.count("help")) {
+    std::cout << desc << "\n";
+    return EXIT_SUCCESS;
+  }
+  po::notify(args);
+
+  try {
+    ShmPreviewReader reader(args.at("name").as<std::string>());
+    const auto& header = reader.header();
+    std::cout << "Preview ring: " << header.width << "x" << header.height
+              << " (" << header.slotCount << " slots)\n";
+
+    const auto framesWanted = args.at("frames").as<std::uint32_t>();
+    const auto timeout = std::chrono::duration<float>(args.at("timeout").as<float>());
+    cv::Mat ldr(header.height, header.width, CV_8UC3);
+    cv::Mat hdr(header.height, header.width, CV_32FC3);
+    std::uint64_t lastFrame = 0;
+    std::uint32_t framesRead = 0;
+    std::uint32_t retries = 0;
+    auto lastNewFrame = std::chrono::steady_clock::now();
+
+    while (framesRead < framesWanted) {
+      ShmPreviewFrame frame;
+      if (!reader.latest(frame) || frame.frame == lastFrame) {
+        if (std::chrono::steady_clock::now() - lastNewFrame > timeout) {
+          std::cerr << "Timed out waiting for a new frame.\n";
+          return EXIT_FAILURE;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        continue;
+      }
+
+      // The frame data is used in place: only copy it out if it is going to be saved:
+      const auto latencyMs = (monotonicNs() - frame.timestampNs) * 1e-6;
+      if (framesRead + 1 == framesWanted) {
+        std::memcpy(ldr.data, frame.ldr, shmPreviewLdrBytes(header.width, header.height));
+        std::memcpy(hdr.data, frame.hdr, shmPreviewHdrBytes(header.width, header.height));
+      }
+      if (!reader.stillValid(frame)) {
+        // Writer lapped us while we were reading so try again:
+        retries += 1;
+        continue;
+      }
+
+      std::cout << "Frame " << frame.frame << " step " << frame.step
+                << " exposure " << frame.exposure << " gamma " << frame.gamma
+                << " latency " << latencyMs << " ms";
+      if (lastFrame && frame.frame != lastFrame + 1) {
+        std::cout << " (skipped " << frame.frame - lastFrame - 1 << ")";
+      }
+      std::cout << "\n";
+      lastFrame = frame.frame;
+      lastNewFrame = std::chrono::steady_clock::now();
+      framesRead += 1;
+    }
+
+    std::cout << "Read " << framesRead << " frames (" << retries << " torn reads retried)\n";
+    const auto ldrFile = args.at("ldr-out").as<std::string>();
+    if (!ldrFile.empty()) {
+      cv::imwrite(ldrFile, ldr);
+    }
+    const auto hdrFile = args.at("hdr-out").as<std::string>();
+    if (!hdrFile.empty()) {
+      cv::imwrite(hdrFile, hdr);
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,339 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+// Headless remote-UI client for reproducible interactive latency
+// benchmarks. It connects to ipu_trace's --ui-port, replays a session
+// (recorded with --ui-record or written by hand, see UiSession.hpp),
+// decodes the preview video stream and measures the time from sending
+// an input to decoding the first preview frame that reflects it.
+//
+// The server follows the video packets of every preview frame this client
+// receives with a 'preview_frame' packet in the same queue (frames the
+// client skips because it lags lose their packet too). The n-th of these
+// packets therefore describes the n-th decoded frame and says whether it
+// is the first frame that reflects a new input. A frame reflects every
+// input received before it so one updated frame completes the measurement
+// of all inputs sent before it was decoded: during a drag the latency is
+// measured from the oldest input that was not yet reflected.
+
+#include "LatencyStats.hpp"
+#include "UiSession.hpp"
+#include "ui_packets.hpp"
+
+#include <PacketComms.h>
+#include <PacketSerialisation.h>
+#include <VideoLib.h>
+#include <network/TcpSocket.h>
+
+#include <boost/program_options.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+/// Bytes of the preview video stream waiting to be decoded. The decoder
+/// reads from this in its own thread and blocks until data arrives:
+class VideoBuffer {
+public:
+  VideoBuffer() : closed(false) {}
+
+  void push(const std::vector<VectorStream::CharType>& data) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      bytes.insert(bytes.end(), data.begin(), data.end());
+    }
+    ready.notify_one();
+  }
+
+  /// Returns the number of bytes copied or -1 once the buffer is closed:
+  int read(std::uint8_t* buffer, int size) {
+    std::unique_lock<std::mutex> lock(mutex);
+    ready.wait(lock, [&]() { return closed || !bytes.empty(); });
+    if (bytes.empty()) {
+      return -1;
+    }
+    const auto n = std::min<std::size_t>(size, bytes.size());
+    std::copy(bytes.begin(), bytes.begin() + n, buffer);
+    bytes.erase(bytes.begin(), bytes.begin() + n);
+    return n;
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+    }
+    ready.notify_all();
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<VectorStream::CharType> bytes;
+  bool closed;
+};
+
+/// Tracks inputs that have been sent but not yet seen in a decoded frame.
+/// Decoded frames are paired with the 'preview_frame' packets in order (the
+/// packet can arrive before or after its frame has been decoded):
+class LatencyTracker {
+public:
+  LatencyTracker() : stats(1 << 16), framesDecoded(0), framesSkipped(0), infosReceived(0), nextFrameId(0) {}
+
+  void sent(Clock::time_point t) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.push_back(t);
+  }
+
+  /// The server sent the info for the next frame this client receives:
+  void frameInfo(const PreviewFrameInfo& info) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // A late joiner first gets the replayed first frame (id 0) so the gap
+    // to the frame after that is not a skip:
+    infosReceived += 1;
+    if (infosReceived > 2 && info.id > nextFrameId) {
+      framesSkipped += info.id - nextFrameId;
+    }
+    nextFrameId = info.id + 1;
+    infos.push_back(info);
+    match();
+  }
+
+  void frameDecoded() {
+    std::lock_guard<std::mutex> lock(mutex);
+    framesDecoded += 1;
+    decodeTimes.push_back(Clock::now());
+    match();
+    changed.notify_all();
+  }
+
+  /// Wait until at least the given number of frames has been decoded:
+  bool waitForFrames(std::size_t count, std::chrono::duration<double> timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return changed.wait_for(lock, timeout, [&]() { return framesDecoded >= count; });
+  }
+
+  /// Wait until every input sent has been reflected in a frame:
+  bool waitForPending(std::chrono::duration<double> timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return changed.wait_for(lock, timeout, [&]() { return pending.empty(); });
+  }
+
+  std::size_t unanswered() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending.size();
+  }
+
+  std::size_t frames() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return framesDecoded;
+  }
+
+  /// Frames the server skipped for this client because it was lagging:
+  std::size_t skipped() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return framesSkipped;
+  }
+
+  LatencyStats stats;
+  std::vector<float> samples;
+
+private:
+  /// Pair decoded frames with their info. An updated frame completes the
+  /// measurement of every input sent before it was decoded:
+  void match() {
+    while (!infos.empty() && !decodeTimes.empty()) {
+      const auto info = infos.front();
+      const auto decoded = decodeTimes.front();
+      infos.pop_front();
+      decodeTimes.pop_front();
+      auto reflected = std::find_if(pending.begin(), pending.end(), [&](auto t) { return t > decoded; });
+      if (info.reflectsNewInput && reflected != pending.begin()) {
+        const auto ms = std::chrono::duration<float, std::milli>(decoded - pending.front()).count();
+        stats.add(ms);
+        samples.push_back(ms);
+        pending.erase(pending.begin(), reflected);
+        changed.notify_all();
+      }
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::vector<Clock::time_point> pending;
+  std::deque<PreviewFrameInfo> infos;
+  std::deque<Clock::time_point> decodeTimes;
+  std::size_t framesDecoded;
+  std::size_t framesSkipped;
+  std::size_t infosReceived;
+  std::uint32_t nextFrameId;
+};
+
+/// Packets that a client can send to the server:
+const std::vector<std::string> inputTypes = {
+    "env_rotation", "exposure", "gamma", "fov", "interactive_samples", "load_nif", "roi", "stop", "detach"};
+
+/// Serialise an input with the payload type that the server expects:
+void sendInput(PacketMuxer& sender, const UiEvent& e) {
+  const auto type = e.type.c_str();
+  if (e.type == "env_rotation" || e.type == "exposure" || e.type == "gamma" || e.type == "fov") {
+    serialise(sender, type, std::stof(e.value));
+  } else if (e.type == "interactive_samples") {
+    serialise(sender, type, static_cast<std::uint32_t>(std::stoul(e.value)));
+  } else if (e.type == "load_nif") {
+    serialise(sender, type, e.value);
+  } else if (e.type == "roi") {
+    // Rectangle as "<x> <y> <width> <height>" (zero size clears the region):
+    PreviewRegion r{0, 0, 0, 0};
+    std::istringstream ss(e.value);
+    if (!(ss >> r.x >> r.y >> r.width >> r.height)) {
+      throw std::runtime_error("Expected '<x> <y> <width> <height>' for region of interest: '" + e.value + "'");
+    }
+    serialise(sender, type, r);
+  } else if (e.type == "stop" || e.type == "detach") {
+    serialise(sender, type, e.value != "0");
+  } else {
+    throw std::runtime_error("Unsupported input type in UI session: '" + e.type + "'");
+  }
+}
+
+} // end anonymous namespace
+
+int main(int argc, char** argv) {
+  namespace po = boost::program_options;
+  po::options_description desc("Options");
+  desc.add_options()
+  ("help", "Show command help.")
+  ("host", po::value<std::string>()->default_value("localhost"), "Host running ipu_trace with --ui-port.")
+  ("port", po::value<int>()->required(), "Remote user-interface port.")
+  ("session", po::value<std::string>()->required(), "Session file to replay (see src/UiSession.hpp).")
+  ("speed", po::value<double>()->default_value(1.0), "Replay speed relative to the recorded timing.")
+  ("warmup-frames", po::value<std::size_t>()->default_value(2), "Preview frames to decode before the replay starts.")
+  ("timeout", po::value<double>()->default_value(30.0), "Seconds to wait for the first frames and for the last updated frame.")
+  ("stop", po::bool_switch()->default_value(false), "Stop the render at the end of the session (default is to detach).")
+  ("csv", po::value<std::string>()->default_value(""), "Also write every latency measurement (ms) to this file.")
+  ;
+
+  po::variables_map args;
+  po::store(po::parse_command_line(argc, argv, desc), args);
+  if (args.count("help")) {
+    std::cout << desc << "\n";
+    return EXIT_SUCCESS;
+  }
+  po::notify(args);
+
+  const auto session = loadUiSession(args.at("session").as<std::string>());
+  for (const auto& e : session) {
+    if (std::find(inputTypes.begin(), inputTypes.end(), e.type) == inputTypes.end()) {
+      throw std::runtime_error("Unsupported input type in UI session: '" + e.type + "'");
+    }
+  }
+  const auto timeout = std::chrono::duration<double>(args.at("timeout").as<double>());
+
+  auto socket = std::make_unique<TcpSocket>();
+  const auto host = args.at("host").as<std::string>();
+  const auto port = args.at("port").as<int>();
+  if (!socket->Connect(host.c_str(), port)) {
+    std::cerr << "Could not connect to " << host << ":" << port << "\n";
+    return EXIT_FAILURE;
+  }
+  socket->setBlocking(false);
+  PacketDemuxer receiver(*socket, packetTypes);
+  PacketMuxer sender(*socket, packetTypes);
+
+  VideoBuffer video;
+  LatencyTracker tracker;
+  std::atomic<bool> hasControl(false);
+  std::vector<PacketSubscription> subscriptions;
+  subscriptions.push_back(receiver.subscribe("render_preview", [&](const ComPacket::ConstSharedPacket& packet) {
+    video.push(packet->getDataStream());
+  }));
+  subscriptions.push_back(receiver.subscribe("preview_frame", [&](const ComPacket::ConstSharedPacket& packet) {
+    PreviewFrameInfo info;
+    deserialise(packet, info);
+    tracker.frameInfo(info);
+  }));
+  subscriptions.push_back(receiver.subscribe("control", [&](const ComPacket::ConstSharedPacket& packet) {
+    bool control = false;
+    deserialise(packet, control);
+    hasControl = control;
+  }));
+
+  // Decode the preview stream in its own thread:
+  std::thread decoder([&]() {
+    FFMpegStdFunctionIO videoIO(FFMpegCustomIO::ReadBuffer, [&](std::uint8_t* buffer, int size) {
+      return video.read(buffer, size);
+    });
+    LibAvCapture capture(videoIO);
+    if (!capture.IsOpen()) {
+      std::cerr << "Could not open the preview video stream.\n";
+      return;
+    }
+    while (capture.GetFrame()) {
+      capture.DoneFrame();
+      tracker.frameDecoded();
+    }
+  });
+
+  int exitCode = EXIT_SUCCESS;
+  const auto warmupFrames = args.at("warmup-frames").as<std::size_t>();
+  if (!tracker.waitForFrames(warmupFrames, timeout)) {
+    std::cerr << "Timed out waiting for preview frames.\n";
+    exitCode = EXIT_FAILURE;
+  } else if (!hasControl) {
+    std::cerr << "Another client has control of the render: inputs would be ignored.\n";
+    exitCode = EXIT_FAILURE;
+  } else {
+    // Replay the session with its original timing:
+    const auto speed = args.at("speed").as<double>();
+    const auto start = Clock::now();
+    for (const auto& e : session) {
+      const auto due = start + std::chrono::duration_cast<Clock::duration>(
+                                   std::chrono::duration<double, std::milli>(e.timeMs / speed));
+      std::this_thread::sleep_until(due);
+      if (e.type != "stop" && e.type != "detach") {
+        tracker.sent(Clock::now());
+      }
+      sendInput(sender, e);
+    }
+    if (!tracker.waitForPending(timeout)) {
+      std::cerr << "Timed out waiting for a preview that reflects the last input.\n";
+    }
+
+    const auto& s = tracker.stats;
+    std::cout << "Replayed " << session.size() << " inputs, decoded " << tracker.frames() << " frames ("
+              << tracker.skipped() << " skipped by the server)\n";
+    std::cout << "Time to updated frame (ms): p50 " << s.percentile(50.f) << " p90 " << s.percentile(90.f)
+              << " p99 " << s.percentile(99.f) << " max " << s.max() << " (" << s.total() << " measurements, "
+              << tracker.unanswered() << " inputs unanswered)\n";
+
+    const auto csvFile = args.at("csv").as<std::string>();
+    if (!csvFile.empty()) {
+      std::ofstream csv(csvFile);
+      csv << "latency_ms\n";
+      for (auto ms : tracker.samples) {
+        csv << ms << "\n";
+      }
+    }
+  }
+
+  // Leave the render running unless asked to stop it:
+  serialise(sender, args.at("stop").as<bool>() ? "stop" : "detach", true);
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  video.close();
+  decoder.join();
+  subscriptions.clear();
+  return exitCode;
+}
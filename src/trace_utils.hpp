@@ -0,0 +1,202 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <pvti/pvti.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "logging.hpp"
+
+namespace trace_utils {
+
+/// Records a timeline in the Chrome trace event format (which can be
+/// viewed in chrome://tracing or https://ui.perfetto.dev) alongside the
+/// PopVision trace. Host events are recorded by trace_utils::Tracepoint
+/// and device phases are added explicitly with complete(). Events are
+/// written to the file as they are recorded so memory use does not grow
+/// with the length of the render. Recording is disabled until enable() is
+/// called so it costs one atomic load per tracepoint otherwise.
+class ChromeTrace {
+public:
+  /// Processes (groups of tracks) in the timeline:
+  enum Process : int {
+    HOST = 1,
+    DEVICE = 2
+  };
+
+  static ChromeTrace& instance() {
+    static ChromeTrace trace;
+    return trace;
+  }
+
+  /// Start recording into the file (see close()):
+  void enable(const std::string& fileName) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (recording) {
+      return;
+    }
+    file.open(fileName);
+    if (!file) {
+      ipu_utils::logger()->error("Could not open Chrome trace file '{}'", fileName);
+      return;
+    }
+    name = fileName;
+    file.precision(3);
+    file << std::fixed;
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    file << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << HOST << ",\"args\":{\"name\":\"host\"}},\n";
+    file << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << DEVICE
+         << ",\"args\":{\"name\":\"ipu (reconstructed from cycle counts)\"}}";
+    recording = true;
+  }
+
+  bool enabled() const { return recording.load(std::memory_order_relaxed); }
+
+  /// Microseconds since the trace was created:
+  double nowUs() const {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - startTime).count();
+  }
+
+  void begin(const char* channel, const std::string& name) {
+    if (enabled()) {
+      add({'B', name, channel, HOST, threadId(channel), nowUs(), 0.0, ""});
+    }
+  }
+
+  void end(const char* channel, const std::string& name) {
+    if (enabled()) {
+      add({'E', name, channel, HOST, threadId(channel), nowUs(), 0.0, ""});
+    }
+  }
+
+  /// Add an event with a known start time and duration. The args
+  /// must be a JSON object (or empty):
+  void complete(Process pid, int tid, const char* category, const std::string& name,
+                double startUs, double durationUs, const std::string& args = "") {
+    if (enabled()) {
+      add({'X', name, category, pid, tid, startUs, durationUs, args});
+    }
+  }
+
+  /// Name a track in the timeline (only the first name of a track is kept):
+  void nameTrack(Process pid, int tid, const std::string& trackName) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (recording && namedTracks.insert({pid, tid}).second) {
+      file << ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid << ",\"tid\":" << tid
+           << ",\"args\":{\"name\":\"" << escape(trackName) << "\"}}";
+    }
+  }
+
+  /// Stop recording and complete the file:
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!recording) {
+      return;
+    }
+    recording = false;
+    file << "\n]}\n";
+    file.close();
+    ipu_utils::logger()->info("Saved Chrome trace ({} events) to '{}'", eventCount, name);
+  }
+
+private:
+  struct Event {
+    char phase;
+    std::string name;
+    std::string category;
+    int pid;
+    int tid;
+    double ts;
+    double dur;
+    std::string args;
+  };
+
+  ChromeTrace() : startTime(std::chrono::steady_clock::now()), recording(false), nextThreadId(1), eventCount(0) {}
+
+  void add(const Event& e) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!recording) {
+      return;
+    }
+    file << ",\n{\"ph\":\"" << e.phase << "\",\"name\":\"" << escape(e.name) << "\",\"cat\":\"" << escape(e.category)
+         << "\",\"pid\":" << e.pid << ",\"tid\":" << e.tid << ",\"ts\":" << e.ts;
+    if (e.phase == 'X') {
+      file << ",\"dur\":" << e.dur;
+    }
+    if (!e.args.empty()) {
+      file << ",\"args\":" << e.args;
+    }
+    file << "}";
+    eventCount += 1;
+  }
+
+  /// Each host thread gets its own track which is named after
+  /// the first trace channel used on that thread:
+  int threadId(const char* channel) {
+    thread_local int id = 0;
+    if (id == 0) {
+      id = nextThreadId++;
+      nameTrack(HOST, id, channel);
+    }
+    return id;
+  }
+
+  static std::string escape(const std::string& s) {
+    std::string escaped;
+    for (auto c : s) {
+      if (c == '"' || c == '\\') {
+        escaped += '\\';
+      }
+      escaped += c;
+    }
+    return escaped;
+  }
+
+  const std::chrono::steady_clock::time_point startTime;
+  std::atomic<bool> recording;
+  std::atomic<int> nextThreadId;
+  std::mutex mutex;
+  std::ofstream file;
+  std::string name;
+  std::size_t eventCount;
+  std::set<std::pair<int, int>> namedTracks;
+};
+
+/// Drop in replacement for pvti::Tracepoint that also records
+/// into the Chrome trace (if it is enabled):
+class Tracepoint {
+public:
+  Tracepoint(pvti::TraceChannel* channel, const std::string& name)
+      : channel(channel), name(name), scoped(channel, name) {
+    ChromeTrace::instance().begin(channel->name, name);
+  }
+
+  ~Tracepoint() {
+    ChromeTrace::instance().end(channel->name, name);
+  }
+
+  static void begin(pvti::TraceChannel* channel, const std::string& name) {
+    pvti::Tracepoint::begin(channel, name);
+    ChromeTrace::instance().begin(channel->name, name);
+  }
+
+  static void end(pvti::TraceChannel* channel, const std::string& name) {
+    pvti::Tracepoint::end(channel, name);
+    ChromeTrace::instance().end(channel->name, name);
+  }
+
+private:
+  pvti::TraceChannel* channel;
+  const std::string name;
+  pvti::Tracepoint scoped;
+};
+
+}  // end namespace trace_utils
@@ -0,0 +1,179 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Packet types and payloads of the remote user-interface protocol. These
+/// are shared by the server (InterfaceServer.hpp) and the headless client
+/// (src/tools/ui_replay.cpp) so must not depend on Poplar.
+
+namespace {
+
+const std::vector<std::string> packetTypes {
+    "stop",                // Tell server to stop rendering and exit (client -> server)
+    "detach",              // Detach the remote-ui but continue: server can destroy the
+                           // communication interface and continue (client -> server)
+    "progress",            // Send render progress (server -> client)
+    "sample_rate",         // Send throughput measurement (server -> client)
+    "env_rotation",        // Update environment light rotation (client -> server)
+    "exposure",            // Update tone-map exposure (client -> server)
+    "gamma",               // Update tone-map gamma (client -> server)
+    "fov",                 // Update field-of-view (client -> server)
+    "load_nif",            // Insruct server to load a new
+                           // NIF environemnt light (client -> server)
+    "render_preview",      // used to send compressed video packets
+                           // for render preview (server -> client)
+    "hdr_header",          // Header for sending full uncompressed HDR
+                           // image data (server -> client).
+    "hdr_packet",          // Packet containing a portion of the full uncompressed
+                           // HDR image (server -> client).
+    "interactive_samples", // New value for interactive samples per step
+    "preview_roi",         // Bounding box of the region of the preview that changed
+                           // since the last preview frame (server -> client).
+    "encoder_stats",       // Send video encoder telemetry (server -> client)
+    "interaction_latency", // Send percentiles of time from receiving user input to
+                           // encoding the first preview that reflects it (server -> client)
+    "control",             // Tell a client whether it has control or is only a
+                           // viewer whose input is ignored (server -> client)
+    "roi",                 // Region of interest to render (client -> server). An
+                           // empty rectangle returns to full-frame rendering.
+    "hdr_region_request",  // Ask for the raw HDR values in a small rectangle of
+                           // the latest image (client -> server).
+    "hdr_region",          // Reply to a region request (server -> client).
+    "preview_frame",       // Sent after the last video packet of each preview frame
+                           // a client receives (server -> client).
+};
+
+// Struct and serialize function for HDR
+// image data header packet.
+struct HdrHeader {
+  std::int32_t width;  // image width
+  std::int32_t height; // image height
+  // Data will be broken into this many packets
+  // for transmission so that the comms-link is not
+  // blocking on a single giant image packet:
+  std::uint32_t packets;
+};
+
+template <typename T>
+void serialize(T& ar, HdrHeader& s) {
+  ar(s.width, s.height, s.packets);
+}
+
+
+struct HdrPacket {
+  std::uint32_t id;
+  std::vector<float> data;
+};
+
+template <typename T>
+void serialize(T& ar, HdrPacket& p) {
+  ar(p.id, p.data);
+}
+
+// Struct and serialize function to request the raw HDR values
+// of a rectangle of the image. To inspect a pixel and its
+// neighbourhood request the square centred on it:
+struct HdrRegionRequest {
+  std::uint32_t id;  // Returned in the reply.
+  std::int32_t x;
+  std::int32_t y;
+  std::int32_t width;
+  std::int32_t height;
+};
+
+template <typename T>
+void serialize(T& ar, HdrRegionRequest& r) {
+  ar(r.id, r.x, r.y, r.width, r.height);
+}
+
+// Struct and serialize function for the reply to a region request. The
+// rectangle is the requested one clipped to the image (it is empty if
+// nothing could be returned) and the data holds its RGB values row by row:
+struct HdrRegion {
+  std::uint32_t id;
+  std::int32_t x;
+  std::int32_t y;
+  std::int32_t width;
+  std::int32_t height;
+  std::vector<float> data;
+};
+
+template <typename T>
+void serialize(T& ar, HdrRegion& r) {
+  ar(r.id, r.x, r.y, r.width, r.height, r.data);
+}
+
+// Struct and serialize function to send
+// telemetry in a single packet:
+struct SampleRates {
+  float pathRate;
+  float rayRate;
+};
+
+template <typename T>
+void serialize(T& ar, SampleRates& s) {
+  ar(s.pathRate, s.rayRate);
+}
+
+// Struct and serialize function to send video
+// encoder telemetry in a single packet:
+struct EncoderStats {
+  float latencyMs;          // Time from frame submission to encode completion (last frame).
+  float encodeMs;           // Time spent encoding (last frame).
+  std::uint32_t encoded;    // Total frames encoded.
+  std::uint32_t dropped;    // Total frames dropped because the encoder was busy.
+};
+
+template <typename T>
+void serialize(T& ar, EncoderStats& s) {
+  ar(s.latencyMs, s.encodeMs, s.encoded, s.dropped);
+}
+
+// Struct and serialize function to send input-to-preview
+// latency percentiles (milliseconds) in a single packet:
+struct LatencyReport {
+  float p50;
+  float p90;
+  float p99;
+  float max;
+  std::uint32_t count;  // Number of interactions measured so far.
+};
+
+template <typename T>
+void serialize(T& ar, LatencyReport& r) {
+  ar(r.p50, r.p90, r.p99, r.max, r.count);
+}
+
+// Struct and serialize function to identify a preview frame. It
+// follows the frame's video packets in the same client queue so the
+// n-th of these a client receives describes the n-th frame it decodes:
+struct PreviewFrameInfo {
+  std::uint32_t id;       // Frames sent by the server so far (gaps are frames this client skipped).
+  bool reflectsNewInput;  // First frame that shows an input (see 'interaction_latency').
+};
+
+template <typename T>
+void serialize(T& ar, PreviewFrameInfo& f) {
+  ar(f.id, f.reflectsNewInput);
+}
+
+// Struct and serialize function for a region of the image (used
+// for the region of the preview that changed in the last sent
+// frame and for the region of interest to render):
+struct PreviewRegion {
+  std::int32_t x;
+  std::int32_t y;
+  std::int32_t width;
+  std::int32_t height;
+};
+
+template <typename T>
+void serialize(T& ar, PreviewRegion& r) {
+  ar(r.x, r.y, r.width, r.height);
+}
+
+}  // end anonymous namespace
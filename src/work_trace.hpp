@@ -0,0 +1,164 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "codelets/TraceRecord.hpp"
+
+/// Compact binary trace of the work done in each render step, used to
+/// evaluate load balancing policies offline. The file is a header
+/// followed by chunks, each tagged with its type and render step:
+///
+///   Header | ChunkHeader payload | ChunkHeader payload | ...
+///
+/// All values are little-endian as written by the host.
+namespace work_trace {
+
+constexpr char magic[4] = {'I', 'P', 'W', 'T'};
+constexpr std::uint32_t version = 1;
+
+struct Header {
+  char magic[4];
+  std::uint32_t version;
+  std::uint32_t width;
+  std::uint32_t height;
+  std::uint32_t numTiles;
+  std::uint32_t recordsPerTile;
+};
+
+enum ChunkType : std::uint32_t {
+  PATH_LENGTHS = 1, // One uint16 per pixel (image order).
+  TILE_WORK = 2     // One TileWork per tile.
+};
+
+struct ChunkHeader {
+  std::uint32_t type;
+  std::uint32_t step;
+  std::uint64_t bytes;
+};
+
+/// Work assigned to a tile and the cycles (max over workers) it took:
+struct TileWork {
+  std::uint64_t load; // Sum of path lengths on the tile.
+  std::uint32_t pathTraceCycles;
+  std::uint32_t accumulateCycles;
+};
+
+/// Appends chunks to a trace file. Chunks can be written from the
+/// render loop and the async host task so writes are serialised.
+class Writer {
+public:
+  Writer(const std::string& fileName, std::uint32_t width, std::uint32_t height,
+         std::uint32_t numTiles, std::uint32_t recordsPerTile)
+      : file(fileName, std::ios::binary), width(width), height(height) {
+    if (!file) {
+      throw std::runtime_error("Could not open work trace file: '" + fileName + "'");
+    }
+    Header h{{}, version, width, height, numTiles, recordsPerTile};
+    std::memcpy(h.magic, magic, sizeof(magic));
+    file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+  }
+
+  /// Record the path lengths from a render step. Records can be in any
+  /// order (they are stored by pixel) and padding records are skipped:
+  template <class Records>
+  void writePathLengths(std::uint32_t step, const Records& records) {
+    std::vector<std::uint16_t> lengths(width * height, 0);
+    for (const auto& r : records) {
+      if (r.u < width && r.v < height) {
+        lengths[r.v * width + r.u] = r.pathLength;
+      }
+    }
+    writeChunk(PATH_LENGTHS, step, lengths);
+  }
+
+  void writeTileWork(std::uint32_t step, const std::vector<TileWork>& tiles) {
+    writeChunk(TILE_WORK, step, tiles);
+  }
+
+private:
+  template <class T>
+  void writeChunk(ChunkType type, std::uint32_t step, const std::vector<T>& payload) {
+    ChunkHeader c{type, step, payload.size() * sizeof(T)};
+    std::lock_guard<std::mutex> lock(mutex);
+    file.write(reinterpret_cast<const char*>(&c), sizeof(c));
+    file.write(reinterpret_cast<const char*>(payload.data()), c.bytes);
+    file.flush();
+  }
+
+  std::mutex mutex;
+  std::ofstream file;
+  const std::uint32_t width;
+  const std::uint32_t height;
+};
+
+/// Data recorded for one render step (either vector can be empty):
+struct Step {
+  std::vector<std::uint16_t> pathLengths;
+  std::vector<TileWork> tiles;
+};
+
+struct Trace {
+  Header header;
+  std::map<std::uint32_t, Step> steps; // Keyed by render step.
+};
+
+/// Read a whole trace. Chunks of unknown type are skipped and a
+/// truncated final chunk (e.g. from an aborted render) is ignored.
+inline Trace load(const std::string& fileName) {
+  std::ifstream file(fileName, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("Could not open work trace file: '" + fileName + "'");
+  }
+
+  Trace trace;
+  file.read(reinterpret_cast<char*>(&trace.header), sizeof(trace.header));
+  if (!file || std::memcmp(trace.header.magic, magic, sizeof(magic)) != 0) {
+    throw std::runtime_error("Not a work trace file: '" + fileName + "'");
+  }
+  if (trace.header.version != version) {
+    throw std::runtime_error("Unsupported work trace version: " + std::to_string(trace.header.version));
+  }
+
+  auto readPayload = [&](auto& v, std::uint64_t bytes) {
+    using T = typename std::decay_t<decltype(v)>::value_type;
+    v.resize(bytes / sizeof(T));
+    file.read(reinterpret_cast<char*>(v.data()), bytes);
+  };
+
+  ChunkHeader c;
+  while (file.read(reinterpret_cast<char*>(&c), sizeof(c))) {
+    Step s;
+    if (c.type == PATH_LENGTHS) {
+      readPayload(s.pathLengths, c.bytes);
+    } else if (c.type == TILE_WORK) {
+      readPayload(s.tiles, c.bytes);
+    } else {
+      file.seekg(c.bytes, std::ios::cur);
+      continue;
+    }
+    if (!file) {
+      break;
+    }
+    auto& step = trace.steps[c.step];
+    if (!s.pathLengths.empty()) {
+      step.pathLengths = std::move(s.pathLengths);
+    }
+    if (!s.tiles.empty()) {
+      step.tiles = std::move(s.tiles);
+    }
+  }
+
+  return trace;
+}
+
+} // end namespace work_trace